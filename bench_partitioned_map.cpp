@@ -0,0 +1,104 @@
+//
+//  bench_partitioned_map.cpp
+//  MySpace
+//
+//  Local benchmark of PartitionedMapClient against PartitionServer processes on Unix domain sockets.
+//
+//  g++ -std=c++17 -O2 -I. bench_partitioned_map.cpp -o bench_partitioned_map && ./bench_partitioned_map [servers] [keys] > bench_output.txt
+//
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "my_partitioned_map.hpp"
+
+
+using Server = PartitionServer<uint64_t, uint64_t>;
+using Client = PartitionedMapClient<uint64_t, uint64_t>;
+
+static Server* server = nullptr;
+
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+
+static void report(const char* what, size_t batch, size_t window, size_t ops, double ms){
+    printf("%-12s batch %5zu window %3zu  %10zu ops %10.1f ms %12.0f ops/s\n", what, batch, window, ops, ms, double(ops) / ms * 1000);
+    fflush(stdout);
+}
+
+
+int main(int argc, char** argv){
+    size_t servers = argc > 1 ? size_t(atol(argv[1])) : 4;
+    size_t keys = argc > 2 ? size_t(atol(argv[2])) : 1000000;
+
+    std::vector<std::string> paths;
+    std::vector<pid_t> pids;
+    for (size_t s = 0; s < servers; ++s){
+        paths.push_back("/tmp/bench_partitioned_map." + std::to_string(getpid()) + "." + std::to_string(s) + ".sock");
+        pid_t pid = fork();
+        if (pid == 0){
+            {
+                Server srv(paths.back());
+                server = &srv;
+                signal(SIGTERM, [](int){ server->stop(); });
+                srv.serve();
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    usleep(200000);
+
+    std::vector<std::pair<uint64_t, uint64_t> > items(keys);
+    std::vector<uint64_t> probe(keys);
+    for (size_t i = 0; i < keys; ++i){
+        items[i] = std::make_pair(uint64_t(i), uint64_t(i) * 7);
+        probe[i] = uint64_t(i * 2);      // half of the probes miss
+    }
+
+    printf("%zu servers, %zu keys\n", servers, keys);
+    const std::pair<size_t, size_t> configs[] = {{1, 1}, {64, 1}, {512, 1}, {512, 8}, {4096, 8}};
+    for (auto [batch, window] : configs){
+        Client client(paths, batch, window);
+        size_t n = batch == 1 ? std::min<size_t>(keys, 100000) : keys;
+        std::vector<std::pair<uint64_t, uint64_t> > put(items.begin(), items.begin() + n);
+        std::vector<uint64_t> get(probe.begin(), probe.begin() + n);
+
+        auto start = std::chrono::steady_clock::now();
+        client.multi_put(put);
+        report("multi_put", batch, window, n, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        client.multi_get(get);
+        report("multi_get", batch, window, n, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        client.multi_erase(get);
+        report("multi_erase", batch, window, n, elapsed_ms(start));
+    }
+
+    {
+        Client client(paths);
+        size_t n = std::min<size_t>(keys, 100000);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; ++i)
+            client.get(probe[i]);
+        report("get", 1, 1, n, elapsed_ms(start));
+    }
+
+    for (pid_t pid : pids){
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    return 0;
+}
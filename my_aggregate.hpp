@@ -0,0 +1,132 @@
+//
+//  my_aggregate.hpp
+//  MySpace
+//
+
+#ifndef MyAggregate_hpp
+#define MyAggregate_hpp
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#include "my_unordered_map.hpp"
+#include "my_parallel.hpp"
+#include "my_radix_partitioner.hpp"
+
+
+template<typename Range>
+using __range_row_t = std::decay_t<decltype(*std::begin(std::declval<const Range&>()))>;
+
+template<typename Range, typename KeyFn>
+using __range_key_t = std::decay_t<std::invoke_result_t<KeyFn&, decltype(*std::begin(std::declval<const Range&>()))> >;
+
+
+/*
+ the key and hash of a row, computed once before the rows are partitioned
+ */
+template<typename Key>
+struct __agg_key{
+    size_t hash;
+    Key key;
+};
+
+
+/*
+ a row partitioned for aggregation with its key and hash, so that a partition is folded from one contiguous array
+ */
+template<typename Key, typename Row>
+struct __agg_entry{
+    size_t hash;
+    Key key;
+    Row row;
+};
+
+
+/**
+ @brief groups the rows of range by key_fn and folds every group with combine, starting from init.
+        key_fn and the hash are evaluated once per row into a staged (hash, key) array, then MyRadixPartitioner scatters (hash, key, row) entries,
+        the rows read straight from range, into partitions of at most about 64K rows, so that every partition is a contiguous array folded into its own
+        MyUnorderedMap, sized for the partition, that stays in cache. Up to 2^16 partitions are used, so inputs beyond 2^32 rows get larger partitions.
+        Threads then aggregate whole partitions, and the per-partition results are concatenated.
+        Peak memory is an entry and a staged hash and key per row. Rows and keys are copied into the partitions, so both must be default constructible
+        and copy assignable.
+ @param const Range& range, a random access range of rows
+ @param KeyFn key_fn, returns the key of a row; called concurrently
+ @param Acc init
+ @param Combine combine, called as combine(Acc&, const Row&); called concurrently for different keys
+ @param size_t threads
+ @param Hash hash, must agree with a default constructed Hash: its value is reused for the lookups of the per-partition maps
+ @returns std::vector<std::pair<Key, Acc>> in unspecified order
+ @exception std::bad_alloc();
+ */
+template<typename Range,
+            typename KeyFn,
+            typename Acc,
+            typename Combine,
+            typename Hash = std::hash<__range_key_t<Range, KeyFn> >,
+            typename Cmp = std::equal_to<__range_key_t<Range, KeyFn> > >
+std::vector<std::pair<__range_key_t<Range, KeyFn>, Acc> >
+aggregate(const Range& range, KeyFn key_fn, Acc init, Combine combine, size_t threads = 1, Hash hash = Hash()){
+    using Key = __range_key_t<Range, KeyFn>;
+
+    auto first = std::begin(range);
+    size_t n = std::distance(first, std::end(range));
+    threads = std::max<size_t>(1, threads);
+
+    size_t bits = 0;
+    while (bits < 16 && ((size_t(1) << bits) < 4 * threads || (n >> bits) > (size_t(1) << 16)))
+        ++bits;
+    MyRadixPartitioner partitioner(bits, threads);
+    size_t parts = partitioner.partitions();
+
+    using Entry = __agg_entry<Key, __range_row_t<Range> >;
+
+    // keys and hashes of the rows, read sequentially; the scatter then moves every key next to its row
+    std::vector<__agg_key<Key> > staged(n);
+    my_parallel_for(threads, threads, [&](size_t chunk, size_t){
+        auto [lo, hi] = my_chunk(n, threads, chunk);
+        for (size_t i = lo; i < hi; ++i){
+            staged[i].key = key_fn(first[i]);
+            staged[i].hash = hash(staged[i].key);
+        }
+    });
+    std::vector<Entry> entries(n);
+    std::vector<size_t> part_start = partitioner.scatter(n, [&](size_t i){
+        return Entry{staged[i].hash, std::move(staged[i].key), first[i]};
+    }, [&](size_t i){ return staged[i].hash; }, entries.data());
+    std::vector<__agg_key<Key> >().swap(staged);
+
+    // every partition in its own map
+    std::vector<std::vector<std::pair<Key, Acc> > > results(parts);
+    my_parallel_for(threads, parts, [&](size_t p, size_t){
+        MyUnorderedMap<Key, Acc, Hash, Cmp> groups;
+        if (part_start[p + 1] > part_start[p])
+            groups.rehash(size_t(ceil(float(part_start[p + 1] - part_start[p]) / groups.max_load_factor())));
+        for (size_t j = part_start[p]; j < part_start[p + 1]; ++j){
+            Entry& e = entries[j];
+            auto it = groups.find(e.key, e.hash);
+            if (it == groups.end())
+                it = groups.insert(std::make_pair(std::move(e.key), init)).first;
+            combine(it->second, std::as_const(e.row));
+        }
+        results[p].reserve(groups.count());
+        for (auto it = groups.begin(); it != groups.end(); ++it)
+            results[p].push_back(std::move(*it));
+    });
+
+    std::vector<std::pair<Key, Acc> > res;
+    size_t total = 0;
+    for (auto& r : results)
+        total += r.size();
+    res.reserve(total);
+    for (auto& r : results)
+        std::move(r.begin(), r.end(), std::back_inserter(res));
+    return res;
+}
+
+#endif /* MyAggregate_hpp */
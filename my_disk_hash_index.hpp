@@ -0,0 +1,768 @@
+//
+//  my_disk_hash_index.hpp
+//  MySpace
+//
+
+#ifndef MyDiskHashIndex_hpp
+#define MyDiskHashIndex_hpp
+
+#include <new>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/syscall.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define MY_DISK_HASH_INDEX_IO_URING 1
+#endif
+#endif
+
+#include "my_unordered_map.hpp"
+
+
+constexpr size_t __disk_page = 4096;
+
+
+/*
+ aligned page buffers for O_DIRECT
+ */
+struct __page_buffer{
+    char* data = nullptr;
+    size_t pages = 0;
+
+    explicit __page_buffer(size_t pages = 0){
+        resize(pages);
+    }
+
+    void resize(size_t n){
+        if (n <= pages) return;
+        void* p = nullptr;
+        if (posix_memalign(&p, __disk_page, n * __disk_page) != 0)
+            throw std::bad_alloc();
+        memset(p, 0, n * __disk_page);
+        free(data);
+        data = static_cast<char*>(p);
+        pages = n;
+    }
+
+    char* page(size_t i) const noexcept{
+        return data + i * __disk_page;
+    }
+
+    __page_buffer(const __page_buffer&) = delete;
+    __page_buffer& operator=(const __page_buffer&) = delete;
+
+    ~__page_buffer(){
+        free(data);
+    }
+};
+
+
+/*
+ reads batches of pages at given offsets. With io_uring every batch is one submission of up to the ring size reads and one wait for all of them;
+ without it, or when the kernel refuses, the reads are plain preads.
+ */
+class __page_reader{
+    int __fd;
+
+#ifdef MY_DISK_HASH_INDEX_IO_URING
+    int __ring = -1;
+    unsigned __entries = 0;
+    void* __sq_map = nullptr;
+    void* __cq_map = nullptr;
+    size_t __sq_bytes = 0;
+    size_t __cq_bytes = 0;
+    io_uring_sqe* __sqes = nullptr;
+    unsigned* __sq_tail = nullptr;
+    unsigned* __sq_mask = nullptr;
+    unsigned* __sq_array = nullptr;
+    unsigned* __cq_head = nullptr;
+    unsigned* __cq_tail = nullptr;
+    unsigned* __cq_mask = nullptr;
+    io_uring_cqe* __cqes = nullptr;
+
+
+    void __setup(unsigned entries) noexcept{
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int ring = int(::syscall(__NR_io_uring_setup, entries, &p));
+        if (ring < 0) return;
+
+        __sq_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        __cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) __sq_bytes = __cq_bytes = std::max(__sq_bytes, __cq_bytes);
+
+        void* sq = ::mmap(nullptr, __sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        void* cq = single ? sq : ::mmap(nullptr, __cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        void* sqes = ::mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED){
+            if (sq != MAP_FAILED) ::munmap(sq, __sq_bytes);
+            if (!single && cq != MAP_FAILED) ::munmap(cq, __cq_bytes);
+            if (sqes != MAP_FAILED) ::munmap(sqes, p.sq_entries * sizeof(io_uring_sqe));
+            ::close(ring);
+            return;
+        }
+        char* s = static_cast<char*>(sq);
+        char* c = static_cast<char*>(cq);
+        __ring = ring;
+        __entries = p.sq_entries;
+        __sq_map = sq;
+        __cq_map = single ? nullptr : cq;
+        __sqes = static_cast<io_uring_sqe*>(sqes);
+        __sq_tail = reinterpret_cast<unsigned*>(s + p.sq_off.tail);
+        __sq_mask = reinterpret_cast<unsigned*>(s + p.sq_off.ring_mask);
+        __sq_array = reinterpret_cast<unsigned*>(s + p.sq_off.array);
+        __cq_head = reinterpret_cast<unsigned*>(c + p.cq_off.head);
+        __cq_tail = reinterpret_cast<unsigned*>(c + p.cq_off.tail);
+        __cq_mask = reinterpret_cast<unsigned*>(c + p.cq_off.ring_mask);
+        __cqes = reinterpret_cast<io_uring_cqe*>(c + p.cq_off.cqes);
+    }
+
+
+    // submits reads[first, last) and waits for all of them; failed reads are redone with pread
+    void __uring_batch(const std::vector<std::pair<uint64_t, char*> >& reads, size_t first, size_t last){
+        unsigned tail = *__sq_tail;
+        for (size_t i = first; i < last; ++i, ++tail){
+            unsigned idx = tail & *__sq_mask;
+            io_uring_sqe* sqe = &__sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = __fd;
+            sqe->addr = reinterpret_cast<uint64_t>(reads[i].second);
+            sqe->len = __disk_page;
+            sqe->off = reads[i].first;
+            sqe->user_data = i;
+            __sq_array[idx] = idx;
+        }
+        __atomic_store_n(__sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned n = unsigned(last - first), done = 0;
+        std::vector<size_t> failed;
+        while (done < n){
+            int r = int(::syscall(__NR_io_uring_enter, __ring, done == 0 ? n : 0, n - done, IORING_ENTER_GETEVENTS, nullptr, 0));
+            if (r < 0 && errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "__page_reader: io_uring_enter");
+            unsigned head = *__cq_head;
+            while (head != __atomic_load_n(__cq_tail, __ATOMIC_ACQUIRE)){
+                io_uring_cqe* cqe = &__cqes[head & *__cq_mask];
+                if (cqe->res != int(__disk_page))
+                    failed.push_back(size_t(cqe->user_data));
+                ++head;
+                ++done;
+            }
+            __atomic_store_n(__cq_head, head, __ATOMIC_RELEASE);
+        }
+        for (size_t i : failed)
+            __pread(reads[i].first, reads[i].second);
+    }
+#endif
+
+
+    void __pread(uint64_t off, char* buf) const{
+        size_t got = 0;
+        while (got < __disk_page){
+            ssize_t r = ::pread(__fd, buf + got, __disk_page - got, off_t(off + got));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0)
+                throw std::system_error(r < 0 ? errno : EIO, std::generic_category(), "__page_reader: pread");
+            got += size_t(r);
+        }
+    }
+
+public:
+
+    explicit __page_reader(int fd, unsigned entries = 64): __fd(fd){
+#ifdef MY_DISK_HASH_INDEX_IO_URING
+        __setup(entries);
+#else
+        (void)entries;
+#endif
+    }
+
+
+    __page_reader(const __page_reader&) = delete;
+    __page_reader& operator=(const __page_reader&) = delete;
+
+
+    bool uses_io_uring() const noexcept{
+#ifdef MY_DISK_HASH_INDEX_IO_URING
+        return __ring >= 0;
+#else
+        return false;
+#endif
+    }
+
+
+    /*
+     reads one page for every (offset, buffer) pair
+     */
+    void read(const std::vector<std::pair<uint64_t, char*> >& reads){
+#ifdef MY_DISK_HASH_INDEX_IO_URING
+        if (__ring >= 0){
+            for (size_t first = 0; first < reads.size(); first += __entries)
+                __uring_batch(reads, first, std::min(reads.size(), first + __entries));
+            return;
+        }
+#endif
+        for (auto& r : reads)
+            __pread(r.first, r.second);
+    }
+
+
+    ~__page_reader(){
+#ifdef MY_DISK_HASH_INDEX_IO_URING
+        if (__ring < 0) return;
+        ::munmap(__sqes, __entries * sizeof(io_uring_sqe));
+        ::munmap(__sq_map, __sq_bytes);
+        if (__cq_map) ::munmap(__cq_map, __cq_bytes);
+        ::close(__ring);
+#endif
+    }
+};
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MyDiskHashIndex is a hash index stored in a file as 4 KB pages, for key sets larger than memory.
+        It has the bucket layout of MyUnorderedMap with a page per bucket: page 1 + b holds the elements of bucket b, and when it is full the chain continues in overflow pages appended to the file.
+        The page directory, the overflow link of every page, is kept in memory, so all pages of a chain are known before any of them is read.
+        multi_get() reads every missing page of a batch of keys at once, with io_uring when the kernel provides it, into buffers aligned for O_DIRECT.
+        Recently used pages are cached in memory, indexed by a MyUnorderedMap from page number to frame and replaced with the clock algorithm; changes are written back on eviction and by flush().
+        Pages are written back in place, so flush() is a durability point but not a rollback point: the first write after it marks the superblock dirty,
+        and opening a dirty file rebuilds the directory and the count from the page headers. The index then holds what was flushed plus whatever later
+        changes reached the file before the crash.
+        Key and T must be trivially copyable.
+ */
+class MyDiskHashIndex{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<T>::value,
+                  "MyDiskHashIndex: keys and values must be trivially copyable");
+
+    static constexpr uint64_t __magic = 0x4d594449534b4958ull;
+
+    struct __superblock{
+        uint64_t magic;
+        uint32_t key_size;
+        uint32_t value_size;
+        uint64_t buckets;
+        uint64_t pages;
+        uint64_t count;
+        uint64_t dir_pages;
+        uint64_t dir_at;        // first page of the directory; 0 in files where it follows the last page
+        uint64_t dirty;         // set before the first page written after flush(), cleared by the next one
+    };
+
+    struct __page_header{
+        uint32_t count;
+        uint32_t reserved;
+        uint64_t overflow;
+    };
+
+    struct __slot{
+        uint64_t hash;
+        Key key;
+        T value;
+    };
+
+    static constexpr size_t __per_page = (__disk_page - sizeof(__page_header)) / sizeof(__slot);
+    static_assert(__per_page > 0, "MyDiskHashIndex: an element does not fit into a page");
+
+    struct __frame{
+        uint64_t page = 0;
+        bool dirty = false;
+        bool ref = false;
+    };
+
+    std::string __path;
+    int __fd = -1;
+    bool __direct = false;
+    Hash hash;
+    Cmp cmp;
+
+    uint64_t __buckets = 0;
+    uint64_t __count = 0;
+    std::vector<uint64_t> __overflow;
+    __superblock __sb{};            // as on disk
+
+    std::unique_ptr<__page_reader> __reader;
+    __page_buffer __pool;
+    std::vector<__frame> __frames;
+    MyUnorderedMap<uint64_t, size_t> __cached;
+    size_t __hand = 0;
+    __page_buffer __batch;
+
+
+    static __page_header* __header(char* page) noexcept{
+        return reinterpret_cast<__page_header*>(page);
+    }
+
+    static __slot* __slots(char* page) noexcept{
+        return reinterpret_cast<__slot*>(page + sizeof(__page_header));
+    }
+
+
+    void __pwrite(uint64_t page, const char* buf, size_t pages = 1){
+        size_t done = 0, n = pages * __disk_page;
+        while (done < n){
+            ssize_t w = ::pwrite(__fd, buf + done, n - done, off_t(page * __disk_page + done));
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0)
+                throw std::system_error(errno, std::generic_category(), "MyDiskHashIndex: pwrite " + __path);
+            done += size_t(w);
+        }
+    }
+
+
+    void __write_superblock(const __superblock& sb){
+        __page_buffer buf(1);
+        memcpy(buf.data, &sb, sizeof(sb));
+        __pwrite(0, buf.data);
+        if (::fdatasync(__fd) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyDiskHashIndex: sync " + __path);
+        __sb = sb;
+    }
+
+
+    // writes a page in place; the first write after flush() marks the superblock dirty before it
+    void __write_back(uint64_t page, const char* data){
+        if (!__sb.dirty){
+            __superblock sb = __sb;
+            sb.dirty = 1;
+            __write_superblock(sb);
+        }
+        __pwrite(page, data);
+    }
+
+
+    void __chain(size_t fh, std::vector<uint64_t>& out) const{
+        out.clear();
+        for (uint64_t p = 1 + __constrain_hash(fh, __buckets); p != 0; p = __overflow[p])
+            out.push_back(p);
+    }
+
+
+    char* __cached_page(uint64_t page) noexcept{
+        auto it = __cached.find(page);
+        if (it == __cached.end()) return nullptr;
+        __frames[it->second].ref = true;
+        return __pool.page(it->second);
+    }
+
+
+    // returns a free frame, writing back and forgetting the page the clock hand stops at
+    size_t __victim(){
+        for (;;){
+            size_t f = __hand;
+            __hand = (__hand + 1) % __frames.size();
+            __frame& fr = __frames[f];
+            if (fr.page == 0) return f;
+            if (fr.ref){
+                fr.ref = false;
+                continue;
+            }
+            if (fr.dirty) __write_back(fr.page, __pool.page(f));
+            __cached.erase(fr.page);
+            fr = __frame();
+            return f;
+        }
+    }
+
+
+    char* __install(uint64_t page, const char* data){
+        size_t f = __victim();
+        if (data) memcpy(__pool.page(f), data, __disk_page);
+        else memset(__pool.page(f), 0, __disk_page);
+        __frames[f].page = page;
+        __frames[f].ref = true;
+        __cached.insert(std::make_pair(page, f));
+        return __pool.page(f);
+    }
+
+
+    char* __fetch(uint64_t page){
+        if (char* p = __cached_page(page)) return p;
+        __batch.resize(1);
+        __reader->read({std::make_pair(page * __disk_page, __batch.page(0))});
+        return __install(page, __batch.page(0));
+    }
+
+
+    void __mark_dirty(uint64_t page) noexcept{
+        __frames[__cached.find(page)->second].dirty = true;
+    }
+
+
+    // numbers a new overflow page. The pages of the directory on disk are skipped: an eviction may write the new page before flush() moves the superblock.
+    uint64_t __new_page(){
+        uint64_t p = __overflow.size();
+        if (p >= __sb.dir_at && p < __sb.dir_at + __sb.dir_pages)
+            __overflow.resize(__sb.dir_at + __sb.dir_pages, 0);
+        __overflow.push_back(0);
+        return __overflow.size() - 1;
+    }
+
+
+    bool __put(const Key& key, const T& value, bool assign){
+        size_t fh = hash(key);
+        std::vector<uint64_t> chain;
+        __chain(fh, chain);
+        uint64_t room = 0;
+        for (uint64_t p : chain){
+            char* page = __fetch(p);
+            __page_header* h = __header(page);
+            __slot* s = __slots(page);
+            for (uint32_t i = 0; i < h->count; ++i){
+                if (s[i].hash == fh && cmp(s[i].key, key)){
+                    if (assign){
+                        s[i].value = value;
+                        __mark_dirty(p);
+                    }
+                    return false;
+                }
+            }
+            if (room == 0 && h->count < __per_page) room = p;
+        }
+        if (room == 0){
+            room = __new_page();
+            __overflow[chain.back()] = room;
+            __header(__fetch(chain.back()))->overflow = room;
+            __mark_dirty(chain.back());
+            // the new page reaches the file empty before any link to it can, so a crash never leaves a link to stale bytes
+            __write_back(room, __install(room, nullptr));
+        }
+        char* page = __fetch(room);
+        __page_header* h = __header(page);
+        __slot& s = __slots(page)[h->count++];
+        s.hash = fh;
+        s.key = key;
+        s.value = value;
+        __mark_dirty(room);
+        ++__count;
+        return true;
+    }
+
+
+    void __create(size_t buckets){
+        __buckets = std::max<size_t>(1, buckets);
+        __overflow.assign(1 + __buckets, 0);
+        __count = 0;
+        __page_buffer zero(64);
+        for (uint64_t p = 1; p < 1 + __buckets; p += 64)
+            __pwrite(p, zero.data, size_t(std::min<uint64_t>(64, 1 + __buckets - p)));
+        flush();
+    }
+
+
+    void __load(const __superblock& sb){
+        if (sb.buckets == 0 || sb.buckets + 1 > sb.pages || sb.pages * sizeof(uint64_t) > sb.dir_pages * __disk_page)
+            throw std::invalid_argument("MyDiskHashIndex: " + __path + " has a corrupt superblock");
+        __buckets = sb.buckets;
+        __count = sb.count;
+        __sb = sb;
+        __overflow.assign(sb.pages, 0);
+        __page_buffer dir(sb.dir_pages);
+        for (uint64_t i = 0; i < sb.dir_pages; ++i)
+            __reader->read({std::make_pair((sb.dir_at + i) * __disk_page, dir.page(i))});
+        memcpy(__overflow.data(), dir.data, sb.pages * sizeof(uint64_t));
+        for (uint64_t link : __overflow)
+            if (link >= sb.pages)
+                throw std::invalid_argument("MyDiskHashIndex: " + __path + " has a corrupt page directory");
+    }
+
+
+    // rebuilds the directory and the count of a dirty file from the page headers, a level of every chain per batch of reads.
+    // An overflow link ends its chain when it leaves the file, points into the directory, a primary or an already seen page, or reaches a page with an impossible count.
+    void __recover(uint64_t file_pages){
+        __buckets = __sb.buckets;
+        __count = 0;
+        __overflow.assign(1 + __buckets, 0);
+        std::vector<char> seen(file_pages, 0);
+        std::vector<std::pair<uint64_t, uint64_t> > level, next;        // page and the page that links to it, 0 for primaries
+        for (uint64_t b = 0; b < __buckets; ++b)
+            level.emplace_back(1 + b, 0);
+
+        const size_t batch = 256;
+        __page_buffer buf(batch);
+        std::vector<std::pair<uint64_t, char*> > reads;
+        while (!level.empty()){
+            next.clear();
+            for (size_t first = 0; first < level.size(); first += batch){
+                size_t n = std::min(batch, level.size() - first);
+                reads.clear();
+                for (size_t i = 0; i < n; ++i)
+                    reads.emplace_back(level[first + i].first * __disk_page, buf.page(i));
+                __reader->read(reads);
+                for (size_t i = 0; i < n; ++i){
+                    auto [p, from] = level[first + i];
+                    const __page_header* h = __header(buf.page(i));
+                    if (h->count > __per_page){
+                        if (from == 0)
+                            throw std::invalid_argument("MyDiskHashIndex: " + __path + " has a corrupt primary page");
+                        __overflow[from] = 0;
+                        continue;
+                    }
+                    __count += h->count;
+                    uint64_t link = h->overflow;
+                    if (link < 1 + __buckets || link >= file_pages || seen[link] ||
+                        (link >= __sb.dir_at && link < __sb.dir_at + __sb.dir_pages))
+                        continue;
+                    seen[link] = 1;
+                    if (__overflow.size() <= link) __overflow.resize(link + 1, 0);
+                    __overflow[p] = link;
+                    next.emplace_back(link, p);
+                }
+            }
+            level.swap(next);
+        }
+    }
+
+public:
+
+    /**
+     @brief opens the index in the file path, or creates it with the given number of bucket pages when the file is empty or missing
+     @param const std::string& path
+     @param size_t buckets, the number of primary pages of a new index; about count / (0.7 * elements per page) keeps chains short
+     @param size_t cache_pages, the number of pages cached in memory
+     @exception std::system_error, std::invalid_argument when the file holds no index of this Key and T
+     */
+    MyDiskHashIndex(const std::string& path, size_t buckets, size_t cache_pages = 1024):
+        __path(path), __pool(std::max<size_t>(4, cache_pages)), __frames(std::max<size_t>(4, cache_pages)), __batch(1){
+        __fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_DIRECT, 0644);
+        __direct = __fd >= 0;
+        if (__fd < 0 && errno == EINVAL)
+            __fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (__fd < 0)
+            throw std::system_error(errno, std::generic_category(), "MyDiskHashIndex: open " + path);
+        try{
+            __reader.reset(new __page_reader(__fd));
+            struct stat st;
+            if (::fstat(__fd, &st) < 0)
+                throw std::system_error(errno, std::generic_category(), "MyDiskHashIndex: fstat " + path);
+            if (st.st_size == 0){
+                __create(buckets);
+                return;
+            }
+            __page_buffer first(1);
+            __reader->read({std::make_pair(uint64_t(0), first.data)});
+            __superblock sb;
+            memcpy(&sb, first.data, sizeof(sb));
+            if (sb.dir_at == 0) sb.dir_at = sb.pages;
+            if (sb.magic != __magic || sb.key_size != sizeof(Key) || sb.value_size != sizeof(T) || sb.dir_at < sb.pages ||
+                uint64_t(st.st_size) < (sb.dir_at + sb.dir_pages) * __disk_page)
+                throw std::invalid_argument("MyDiskHashIndex: " + path + " holds no index of this type");
+            __load(sb);
+            if (sb.dirty){
+                __recover(uint64_t(st.st_size) / __disk_page);
+                flush();
+            }
+        }catch(...){
+            ::close(__fd);
+            throw;
+        }
+    }
+
+
+    MyDiskHashIndex(const MyDiskHashIndex&) = delete;
+    MyDiskHashIndex& operator=(const MyDiskHashIndex&) = delete;
+
+
+    /**
+     @brief inserts the element if there is no element with an equivalent key
+     @returns bool, true if inserted
+     @exception std::system_error, std::bad_alloc()
+     */
+    bool insert(const Key& key, const T& value){
+        return __put(key, value, false);
+    }
+
+
+    /**
+     @brief inserts the element or assigns value to the existing one
+     @returns bool, true if inserted
+     @exception std::system_error, std::bad_alloc()
+     */
+    bool insert_or_assign(const Key& key, const T& value){
+        return __put(key, value, true);
+    }
+
+
+    /**
+     @brief erases key. The last element of its page takes its place; emptied overflow pages stay in the chain.
+     @returns bool
+     @exception std::system_error, std::bad_alloc()
+     */
+    bool erase(const Key& key){
+        size_t fh = hash(key);
+        std::vector<uint64_t> chain;
+        __chain(fh, chain);
+        for (uint64_t p : chain){
+            char* page = __fetch(p);
+            __page_header* h = __header(page);
+            __slot* s = __slots(page);
+            for (uint32_t i = 0; i < h->count; ++i){
+                if (s[i].hash == fh && cmp(s[i].key, key)){
+                    s[i] = s[--h->count];
+                    __mark_dirty(p);
+                    --__count;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+
+    /**
+     @brief looks up a batch of keys. The chains of all keys come from the page directory; the pages that are not cached are read in one batch
+        of asynchronous reads, then every key is searched and the pages read are added to the cache.
+     @param const std::vector<Key>& keys
+     @returns std::vector<std::optional<T>>, in the order of keys
+     @exception std::system_error, std::bad_alloc()
+     */
+    std::vector<std::optional<T> > multi_get(const std::vector<Key>& keys){
+        std::vector<std::optional<T> > res(keys.size());
+        std::vector<size_t> hashes(keys.size());
+        MyUnorderedMap<uint64_t, size_t> missing;
+        std::vector<std::pair<uint64_t, char*> > reads;
+        std::vector<uint64_t> chain;
+
+        for (size_t i = 0; i < keys.size(); ++i){
+            hashes[i] = hash(keys[i]);
+            __chain(hashes[i], chain);
+            for (uint64_t p : chain){
+                if (__cached.find(p) == __cached.end() && missing.find(p) == missing.end()){
+                    missing.insert(std::make_pair(p, reads.size()));
+                    reads.emplace_back(p * __disk_page, nullptr);
+                }
+            }
+        }
+        __batch.resize(reads.size());
+        for (size_t i = 0; i < reads.size(); ++i)
+            reads[i].second = __batch.page(i);
+        __reader->read(reads);
+
+        for (size_t i = 0; i < keys.size(); ++i){
+            __chain(hashes[i], chain);
+            for (uint64_t p : chain){
+                auto it = missing.find(p);
+                char* page = it != missing.end() ? __batch.page(it->second) : __cached_page(p);
+                __page_header* h = __header(page);
+                __slot* s = __slots(page);
+                uint32_t j = 0;
+                while (j < h->count && !(s[j].hash == hashes[i] && cmp(s[j].key, keys[i])))
+                    ++j;
+                if (j < h->count){
+                    res[i] = s[j].value;
+                    break;
+                }
+            }
+        }
+        size_t keep = std::min(reads.size(), __frames.size() / 2);
+        for (size_t i = 0; i < keep; ++i)
+            __install(reads[i].first / __disk_page, reads[i].second);
+        return res;
+    }
+
+
+    std::optional<T> get(const Key& key){
+        return multi_get(std::vector<Key>{key})[0];
+    }
+
+
+    bool contains(const Key& key){
+        return get(key).has_value();
+    }
+
+
+    /**
+     @brief writes the changed pages and the page directory, waits for the device, then writes the clean superblock that points to the new directory and waits again.
+        Changes after it are not undone by a crash, see the class description.
+     @exception std::system_error, std::bad_alloc()
+     */
+    void flush(){
+        for (size_t f = 0; f < __frames.size(); ++f){
+            if (__frames[f].page != 0 && __frames[f].dirty){
+                __write_back(__frames[f].page, __pool.page(f));
+                __frames[f].dirty = false;
+            }
+        }
+        // the new directory never overwrites the one the superblock on disk points to: it goes right after the last page when it fits
+        // before the old one, else after both, so two directory slots alternate while the index does not grow
+        uint64_t pages = __overflow.size();
+        uint64_t dir_pages = (pages * sizeof(uint64_t) + __disk_page - 1) / __disk_page;
+        uint64_t dir_at = pages + dir_pages <= __sb.dir_at ? pages : std::max(pages, __sb.dir_at + __sb.dir_pages);
+        __page_buffer buf(dir_pages);
+        memcpy(buf.data, __overflow.data(), pages * sizeof(uint64_t));
+        __pwrite(dir_at, buf.data, dir_pages);
+        if (::fdatasync(__fd) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyDiskHashIndex: sync " + __path);
+
+        __write_superblock(__superblock{__magic, uint32_t(sizeof(Key)), uint32_t(sizeof(T)), __buckets, pages, __count, dir_pages, dir_at, 0});
+        if (::ftruncate(__fd, off_t((dir_at + dir_pages) * __disk_page)) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyDiskHashIndex: truncate " + __path);
+    }
+
+
+    /**
+     @brief returns the number of elements
+     */
+    size_t count() const noexcept{
+        return __count;
+    }
+
+
+    /**
+     @brief returns the number of pages, the superblock, primary and overflow pages, and the pages skipped because an older directory held them
+     */
+    size_t pages() const noexcept{
+        return __overflow.size();
+    }
+
+
+    /**
+     @brief returns whether the file is open with O_DIRECT and whether reads go through io_uring
+     */
+    bool direct() const noexcept{
+        return __direct;
+    }
+
+
+    bool uses_io_uring() const noexcept{
+        return __reader->uses_io_uring();
+    }
+
+
+    /**
+     @brief flushes and closes the file
+     */
+    ~MyDiskHashIndex(){
+        try{
+            flush();
+        }catch(...){}
+        ::close(__fd);
+    }
+};
+
+#endif /* MyDiskHashIndex_hpp */
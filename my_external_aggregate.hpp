@@ -0,0 +1,255 @@
+//
+//  my_external_aggregate.hpp
+//  MySpace
+//
+
+#ifndef MyExternalAggregate_hpp
+#define MyExternalAggregate_hpp
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "my_unordered_map.hpp"
+#include "my_radix_partitioner.hpp"
+
+
+/**!
+ @brief __spill_file is an anonymous temporary file written and then read back sequentially in large blocks.
+        The file is unlinked right after creation, so it disappears with the descriptor even if the process dies.
+        It uses plain write() and read(): every request is a 1 MiB sequential block, which kernel write-back and readahead already overlap with
+        the aggregation, so batching them through an io_uring ring like the one of my_disk_hash_index.hpp would save little.
+ */
+class __spill_file{
+    int __fd = -1;
+    std::vector<char> __buf;
+    size_t __fill = 0;
+    size_t __bytes = 0;
+
+    void __write_all(const char* p, size_t n){
+        while (n > 0){
+            ssize_t w = ::write(__fd, p, n);
+            if (w < 0){
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "__spill_file: write");
+            }
+            p += w;
+            n -= size_t(w);
+        }
+    }
+
+public:
+    __spill_file(const std::string& dir, size_t block): __buf(block){
+        std::string path = dir + "/my_unordered_map_spill_XXXXXX";
+        __fd = ::mkstemp(&path[0]);
+        if (__fd < 0)
+            throw std::system_error(errno, std::generic_category(), "__spill_file: mkstemp " + path);
+        ::unlink(path.c_str());
+    }
+
+    __spill_file(const __spill_file&) = delete;
+    __spill_file& operator=(const __spill_file&) = delete;
+
+    void append(const void* p, size_t n){
+        if (__fill + n > __buf.size()){
+            __write_all(__buf.data(), __fill);
+            __fill = 0;
+        }
+        if (n > __buf.size()){
+            __write_all(static_cast<const char*>(p), n);
+        }else{
+            memcpy(__buf.data() + __fill, p, n);
+            __fill += n;
+        }
+        __bytes += n;
+    }
+
+    size_t bytes() const noexcept{
+        return __bytes;
+    }
+
+    /*
+     flushes the tail and calls f(data, size) for consecutive blocks of the file.
+     Blocks are a multiple of record bytes long.
+     */
+    template<typename F>
+    void read_back(size_t record, F f){
+        __write_all(__buf.data(), __fill);
+        __fill = 0;
+        if (::lseek(__fd, 0, SEEK_SET) < 0)
+            throw std::system_error(errno, std::generic_category(), "__spill_file: lseek");
+        size_t block = __buf.size() / record * record;
+        size_t left = __bytes;
+        while (left > 0){
+            size_t want = std::min(block, left), got = 0;
+            while (got < want){
+                ssize_t r = ::read(__fd, __buf.data() + got, want - got);
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0)
+                    throw std::system_error(r < 0 ? errno : EIO, std::generic_category(), "__spill_file: read");
+                got += size_t(r);
+            }
+            f(__buf.data(), want);
+            left -= want;
+        }
+    }
+
+    ~__spill_file(){
+        if (__fd >= 0) ::close(__fd);
+    }
+};
+
+
+template <typename Key,
+            typename Value,
+            typename Acc,
+            typename Combine,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief ExternalAggregator folds a stream of (key, value) rows into one Acc per key when the distinct keys may not fit in memory (grace hash aggregation).
+        Groups are kept in a MyUnorderedMap until it reaches the memory budget. After that, rows of keys already in memory are still folded in place,
+        and rows of new keys are hash-partitioned into temporary files on local disk, written in large sequential blocks.
+        finish() emits the in-memory groups and then aggregates every spilled partition recursively, with the next hash bits, under the same budget.
+        Key and Value are spilled as raw bytes and must be trivially copyable.
+ */
+class ExternalAggregator{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "ExternalAggregator: spilled keys and values must be trivially copyable");
+
+    static constexpr size_t __fanout_bits = 4;
+    static constexpr size_t __max_level = sizeof(size_t) * 8 / __fanout_bits;
+    static constexpr size_t __record = sizeof(Key) + sizeof(Value);
+
+    Acc __init;
+    Combine __combine;
+    Hash hash;
+    size_t __budget;
+    std::string __dir;
+    size_t __block;
+    size_t __level;
+
+    MyUnorderedMap<Key, Acc, Hash, Cmp> __groups;
+    size_t __max_groups;
+    std::vector<std::unique_ptr<__spill_file> > __parts;
+    size_t __spilled = 0;
+
+
+    size_t __part_of(size_t h) const noexcept{
+        return (__mix_hash(h) >> (sizeof(size_t) * 8 - __fanout_bits * (__level + 1))) & ((size_t(1) << __fanout_bits) - 1);
+    }
+
+
+    void __spill(const Key& key, const Value& value, size_t h){
+        if (__parts.empty()){
+            for (size_t p = 0; p < (size_t(1) << __fanout_bits); ++p)
+                __parts.emplace_back(new __spill_file(__dir, __block));
+        }
+        char rec[__record];
+        memcpy(rec, &key, sizeof(Key));
+        memcpy(rec + sizeof(Key), &value, sizeof(Value));
+        __parts[__part_of(h)]->append(rec, __record);
+        ++__spilled;
+    }
+
+
+    ExternalAggregator(const Acc& init, const Combine& combine, size_t budget, const std::string& dir, size_t block, size_t level):
+        __init(init), __combine(combine), __budget(budget), __dir(dir), __block(std::max(block, __record)), __level(level){
+        // a group costs roughly its node, the node pointer in the bucket array and allocator overhead
+        __max_groups = std::max<size_t>(1, budget / (sizeof(std::pair<Key, Acc>) + 4 * sizeof(void*)));
+    }
+
+public:
+
+    /**
+     @brief constructs an aggregator
+     @param const Acc& init, the value every group starts from
+     @param const Combine& combine, called as combine(Acc&, const Value&)
+     @param size_t budget, approximate number of bytes the in-memory groups may take
+     @param const std::string& dir, directory for temporary files, preferably on local disk
+     @param size_t block, size of the I/O buffer per partition file
+     */
+    ExternalAggregator(const Acc& init, const Combine& combine, size_t budget, const std::string& dir = "/tmp", size_t block = size_t(1) << 20):
+        ExternalAggregator(init, combine, budget, dir, block, 0){}
+
+
+    /**
+     @brief folds one row into the group of key, or spills it when the group is not in memory and the budget is exhausted
+     @param const Key& key
+     @param const Value& value
+     @exception std::bad_alloc(), std::system_error
+     */
+    void add(const Key& key, const Value& value){
+        auto it = __groups.find(key);
+        if (it == __groups.end()){
+            if (__groups.count() >= __max_groups && __level < __max_level){
+                __spill(key, value, hash(key));
+                return;
+            }
+            it = __groups.insert(std::make_pair(key, __init)).first;
+        }
+        __combine(it->second, value);
+    }
+
+
+    /**
+     @brief returns the number of rows written to disk so far at this level
+     */
+    size_t spilled() const noexcept{
+        return __spilled;
+    }
+
+
+    /**
+     @brief returns the number of groups currently in memory
+     */
+    size_t count() const noexcept{
+        return __groups.count();
+    }
+
+
+    /**
+     @brief emits every group as emit(const Key&, const Acc&), first the in-memory ones, then those of the spilled partitions. The aggregator is empty afterwards.
+     @param F&& emit
+     @exception std::bad_alloc(), std::system_error
+     */
+    template<typename F>
+    void finish(F&& emit){
+        for (auto it = __groups.begin(); it != __groups.end(); ++it)
+            emit(it->first, it->second);
+        __groups.clear();
+
+        std::vector<std::unique_ptr<__spill_file> > parts = std::move(__parts);
+        __parts.clear();
+        __spilled = 0;
+        for (auto& part : parts){
+            if (part->bytes() == 0) continue;
+            ExternalAggregator child(__init, __combine, __budget, __dir, __block, __level + 1);
+            part->read_back(__record, [&](const char* p, size_t n){
+                for (size_t off = 0; off < n; off += __record){
+                    Key key;
+                    Value value;
+                    memcpy(&key, p + off, sizeof(Key));
+                    memcpy(&value, p + off + sizeof(Key), sizeof(Value));
+                    child.add(key, value);
+                }
+            });
+            part.reset();
+            child.finish(emit);
+        }
+    }
+};
+
+#endif /* MyExternalAggregate_hpp */
@@ -0,0 +1,157 @@
+//
+//  my_flight_recorder.hpp
+//  MySpace
+//
+
+#ifndef MyFlightRecorder_hpp
+#define MyFlightRecorder_hpp
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <system_error>
+
+#include "my_unordered_map.hpp"
+
+
+/**
+ @brief a slow call caught by MyFlightRecorder
+ */
+struct MySlowOp{
+    MyMapOp op;
+    uint64_t hash;
+    size_t bucket;
+    size_t chain;
+    size_t count;
+    size_t buckets;
+    uint64_t ticks;
+    uint64_t nanoseconds;
+    uint64_t at;            // steady_clock nanoseconds when the call was recorded
+};
+
+
+/**!
+ @brief MyFlightRecorder is a MyMapRecorder that keeps the last capacity calls slower than a threshold in a ring buffer, for rehash spikes and
+        degenerate chains that are too rare to catch with a profiler. Calls are timed with my_ticks(); the threshold and the durations are converted
+        with my_ticks_per_ns(). Only slow calls take the lock of the ring.
+        One recorder may be attached to several maps. It must outlive its attachment to every map.
+ */
+class MyFlightRecorder: public MyMapRecorder{
+    mutable std::mutex __mutex;
+    std::vector<MySlowOp> __ring;
+    size_t __capacity;
+    uint64_t __recorded = 0;
+
+
+    static uint64_t __now_ns() noexcept{
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+public:
+
+    /**
+     @brief creates a recorder of the calls that take at least threshold
+     @param std::chrono::nanoseconds threshold
+     @param size_t capacity, the number of slow calls kept
+     */
+    explicit MyFlightRecorder(std::chrono::nanoseconds threshold, size_t capacity = 1024): __capacity(std::max<size_t>(1, capacity)){
+        set_threshold(threshold);
+        __ring.reserve(__capacity);
+    }
+
+
+    MyFlightRecorder(const MyFlightRecorder&) = delete;
+    MyFlightRecorder& operator=(const MyFlightRecorder&) = delete;
+
+
+    /**
+     @brief changes the threshold. Calls already running may still be judged by the old one.
+     @param std::chrono::nanoseconds t
+     */
+    void set_threshold(std::chrono::nanoseconds t){
+        threshold.store(uint64_t(double(std::max<int64_t>(0, t.count())) * my_ticks_per_ns()), std::memory_order_relaxed);
+    }
+
+
+    void record(MyMapOp op, size_t hash, size_t bucket, size_t chain, size_t count, size_t buckets, uint64_t ticks) noexcept override{
+        MySlowOp e{op, uint64_t(hash), bucket, chain, count, buckets, ticks, uint64_t(double(ticks) / my_ticks_per_ns()), __now_ns()};
+        // a map call must not terminate for its recorder: if the lock fails the call is not kept
+        std::unique_lock<std::mutex> lock(__mutex, std::defer_lock);
+        try{
+            lock.lock();
+        } catch (...){
+            return;
+        }
+        // the ring was reserved, push_back does not allocate
+        if (__ring.size() < __capacity) __ring.push_back(e);
+        else __ring[__recorded % __capacity] = e;
+        ++__recorded;
+    }
+
+
+    /**
+     @brief returns the slow calls kept, oldest first
+     @returns std::vector<MySlowOp>
+     */
+    std::vector<MySlowOp> events() const{
+        std::lock_guard<std::mutex> lock(__mutex);
+        std::vector<MySlowOp> res;
+        res.reserve(__ring.size());
+        size_t first = __ring.size() < __capacity ? 0 : size_t(__recorded % __capacity);
+        for (size_t i = 0; i < __ring.size(); ++i)
+            res.push_back(__ring[(first + i) % __ring.size()]);
+        return res;
+    }
+
+
+    /**
+     @brief returns the number of slow calls since the last clear(), those overwritten included
+     */
+    uint64_t recorded() const{
+        std::lock_guard<std::mutex> lock(__mutex);
+        return __recorded;
+    }
+
+
+    void clear(){
+        std::lock_guard<std::mutex> lock(__mutex);
+        __ring.clear();
+        __recorded = 0;
+    }
+
+
+    /**
+     @brief writes the slow calls kept, oldest first, to out
+     @param FILE* out
+     */
+    void dump(FILE* out) const{
+        static const char* names[] = {"find", "insert", "erase"};
+        std::vector<MySlowOp> ev = events();
+        fprintf(out, "%llu slow calls, last %zu\n", (unsigned long long)recorded(), ev.size());
+        fprintf(out, "%-16s %-6s %18s %12s %8s %12s %12s %14s\n", "at_ns", "op", "hash", "bucket", "chain", "count", "buckets", "duration_ns");
+        for (const MySlowOp& e : ev)
+            fprintf(out, "%-16llu %-6s %18llx %12zu %8zu %12zu %12zu %14llu\n", (unsigned long long)e.at, names[size_t(e.op) % 3],
+                    (unsigned long long)e.hash, e.bucket, e.chain, e.count, e.buckets, (unsigned long long)e.nanoseconds);
+        fflush(out);
+    }
+
+
+    /**
+     @brief writes the dump to the file path, replacing it
+     @exception std::system_error
+     */
+    void dump(const std::string& path) const{
+        FILE* f = fopen(path.c_str(), "w");
+        if (f == nullptr)
+            throw std::system_error(errno, std::generic_category(), "MyFlightRecorder: open " + path);
+        dump(f);
+        fclose(f);
+    }
+};
+
+#endif /* MyFlightRecorder_hpp */
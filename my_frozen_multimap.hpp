@@ -0,0 +1,515 @@
+//
+//  my_frozen_multimap.hpp
+//  MySpace
+//
+
+#ifndef MyFrozenMultimap_hpp
+#define MyFrozenMultimap_hpp
+
+#include <vector>
+#include <cmath>
+#include <utility>
+#include <functional>
+#include <iterator>
+
+#include "my_unordered_map.hpp"
+#include "my_span.hpp"
+#include "my_parallel.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MyFrozenMultimap is an immutable multimap in compressed sparse row layout.
+        Keys are grouped by bucket in one dense array, and the values of every key occupy one contiguous run of a single value array.
+        A lookup scans the keys of one bucket and returns the run of the found key as a span, so there is no allocation per key and neighbour scans are sequential.
+ */
+class MyFrozenMultimap{
+    using fmmap = MyFrozenMultimap;
+
+    Hash hash;
+    Cmp cmp;
+
+    // __buckets[b] .. __buckets[b + 1] are the positions of bucket b in __keys
+    std::vector<size_t> __buckets;
+    std::vector<Key> __keys;
+    // __offsets[i] .. __offsets[i + 1] are the values of __keys[i] in __values
+    std::vector<size_t> __offsets;
+    std::vector<T> __values;
+
+
+    static size_t __bucket_count_for(size_t keys, float max_load_factor) noexcept{
+        size_t need = std::max<size_t>(1, size_t(ceil(float(keys) / max_load_factor)));
+        size_t size = 1;
+        while (size < need)
+            size <<= 1;
+        return size;
+    }
+
+
+    /*
+     lays out the keys by bucket and reserves the value runs.
+     Returns for every input key its position in __keys.
+     */
+    std::vector<size_t> __layout(std::vector<Key>&& keys, const std::vector<size_t>& counts, float max_load_factor){
+        size_t n = keys.size();
+        size_t size = __bucket_count_for(n, max_load_factor);
+
+        std::vector<size_t> where(n);
+        __buckets.assign(size + 1, 0);
+        for (size_t i = 0; i < n; ++i){
+            where[i] = __constrain_hash(hash(keys[i]), size);
+            ++__buckets[where[i] + 1];
+        }
+        for (size_t b = 0; b < size; ++b)
+            __buckets[b + 1] += __buckets[b];
+
+        std::vector<size_t> cursor(__buckets.begin(), __buckets.end() - 1);
+        for (size_t i = 0; i < n; ++i)
+            where[i] = cursor[where[i]]++;
+
+        __keys.clear();
+        __keys.reserve(n);
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i)
+            order[where[i]] = i;
+        for (size_t i = 0; i < n; ++i)
+            __keys.push_back(std::move(keys[order[i]]));
+
+        __offsets.assign(n + 1, 0);
+        for (size_t i = 0; i < n; ++i)
+            __offsets[where[i] + 1] = counts[i];
+        for (size_t i = 0; i < n; ++i)
+            __offsets[i + 1] += __offsets[i];
+
+        __values.clear();
+        __values.resize(__offsets[n]);
+        return where;
+    }
+
+
+    size_t __find(const Key& key, size_t h) const noexcept{
+        if (__keys.empty()) return npos;
+        size_t b = __constrain_hash(h, __buckets.size() - 1);
+        for (size_t i = __buckets[b]; i < __buckets[b + 1]; ++i){
+            if (cmp(__keys[i], key)) return i;
+        }
+        return npos;
+    }
+
+public:
+
+    static constexpr size_t npos = size_t(-1);
+
+
+    /**!
+     @brief Builder collects a stream of key-value pairs, possibly with repeated keys, and freezes them into a MyFrozenMultimap.
+        Values of one key keep the order in which they were added.
+     */
+    class Builder{
+        std::vector<std::pair<Key, T> > __pairs;
+
+    public:
+
+        /**
+         @brief reserves space for count pairs
+         @param size_t count
+         @exception std::bad_alloc();
+         */
+        void reserve(size_t count){
+            __pairs.reserve(count);
+        }
+
+
+        /**
+         @brief adds one value of key
+         @param const Key& key
+         @param const T& value
+         @exception std::bad_alloc();
+         */
+        void add(const Key& key, const T& value){
+            __pairs.emplace_back(key, value);
+        }
+
+
+        /**
+         @brief adds one value of key
+         @param Key&& key
+         @param T&& value
+         @exception std::bad_alloc();
+         */
+        void add(Key&& key, T&& value){
+            __pairs.emplace_back(std::move(key), std::move(value));
+        }
+
+
+        /**
+         @brief adds every pair of the range [first, last)
+         @param InputIt first
+         @param InputIt last
+         @exception std::bad_alloc();
+         */
+        template<typename InputIt>
+        void add(InputIt first, InputIt last){
+            for (; first != last; ++first)
+                __pairs.emplace_back(first->first, first->second);
+        }
+
+
+        /**
+         @brief returns the number of pairs added so far
+         */
+        size_t count() const noexcept{
+            return __pairs.size();
+        }
+
+
+        /**
+         @brief freezes the collected pairs. The builder is empty afterwards.
+         @param float max_load_factor
+         @returns MyFrozenMultimap
+         @exception std::bad_alloc();
+         */
+        fmmap build(float max_load_factor = 1){
+            fmmap res;
+            MyUnorderedMap<Key, size_t, Hash, Cmp> ids;
+            std::vector<Key> keys;
+            std::vector<size_t> counts;
+            std::vector<size_t> id_of(__pairs.size());
+
+            for (size_t i = 0; i < __pairs.size(); ++i){
+                auto it = ids.find(__pairs[i].first);
+                if (it == ids.end()){
+                    it = ids.insert(std::make_pair(__pairs[i].first, keys.size())).first;
+                    keys.push_back(__pairs[i].first);
+                    counts.push_back(0);
+                }
+                id_of[i] = it->second;
+                ++counts[id_of[i]];
+            }
+
+            std::vector<size_t> where = res.__layout(std::move(keys), counts, fabs(max_load_factor));
+            std::vector<size_t> cursor(where.size());
+            for (size_t k = 0; k < where.size(); ++k)
+                cursor[k] = res.__offsets[where[k]];
+            for (size_t i = 0; i < __pairs.size(); ++i)
+                res.__values[cursor[id_of[i]]++] = std::move(__pairs[i].second);
+
+            __pairs.clear();
+            return res;
+        }
+    };
+
+
+    /**
+     @brief default constructor. Constructs an empty multimap.
+     */
+    MyFrozenMultimap() = default;
+
+
+    /**
+     @brief freezes a map whose mapped values are containers of T, for example MyUnorderedMap<Key, std::vector<T>>.
+     @param const MyUnorderedMap<Key, Container, H, C, A>& map
+     @param float max_load_factor
+     @exception std::bad_alloc();
+     */
+    template<typename Container, typename H, typename C, typename A>
+    explicit MyFrozenMultimap(const MyUnorderedMap<Key, Container, H, C, A>& map, float max_load_factor = 1){
+        std::vector<Key> keys;
+        std::vector<size_t> counts;
+        keys.reserve(map.count());
+        counts.reserve(map.count());
+        for (auto it = map.cbegin(); it != map.cend(); ++it){
+            keys.push_back(it->first);
+            counts.push_back(std::distance(std::begin(it->second), std::end(it->second)));
+        }
+
+        std::vector<size_t> where = __layout(std::move(keys), counts, fabs(max_load_factor));
+        size_t k = 0;
+        for (auto it = map.cbegin(); it != map.cend(); ++it, ++k){
+            size_t pos = __offsets[where[k]];
+            for (auto& value : it->second)
+                __values[pos++] = value;
+        }
+    }
+
+
+    /**
+     @brief builds the multimap from n rows in parallel. Row i has key key_of(i) and value value_of(i); values of one key keep the order of their rows.
+        The bucket array is sized up front for n distinct keys. Rows are split by bucket range into partitions that threads then lay out independently.
+        key_of and value_of are called concurrently. Key and T must be default constructible.
+     @param size_t n
+     @param KeyFn key_of
+     @param ValueFn value_of
+     @param size_t threads
+     @param float max_load_factor
+     @returns MyFrozenMultimap
+     @exception std::bad_alloc(), or anything key_of and value_of throw
+     */
+    template<typename KeyFn, typename ValueFn>
+    static fmmap build_parallel(size_t n, KeyFn key_of, ValueFn value_of, size_t threads, float max_load_factor = 1){
+        fmmap res;
+        threads = std::max<size_t>(1, threads);
+        size_t size = __bucket_count_for(n, fabs(max_load_factor));
+        size_t parts = 1;
+        while (parts < 4 * threads && parts < size)
+            parts <<= 1;
+        size_t shift = 0;
+        while ((parts << shift) < size)
+            ++shift;
+
+        // bucket of every row and per chunk histograms of partitions
+        std::vector<size_t> bucket_of(n);
+        std::vector<size_t> hist(threads * parts, 0);
+        my_parallel_for(threads, threads, [&](size_t chunk, size_t){
+            auto [first, last] = my_chunk(n, threads, chunk);
+            size_t* h = hist.data() + chunk * parts;
+            for (size_t i = first; i < last; ++i){
+                bucket_of[i] = __constrain_hash(res.hash(key_of(i)), size);
+                ++h[bucket_of[i] >> shift];
+            }
+        });
+
+        std::vector<size_t> part_start(parts + 1, 0);
+        for (size_t p = 0, sum = 0; p < parts; ++p){
+            part_start[p] = sum;
+            for (size_t t = 0; t < threads; ++t){
+                size_t c = hist[t * parts + p];
+                hist[t * parts + p] = sum;
+                sum += c;
+            }
+        }
+        part_start[parts] = n;
+
+        std::vector<size_t> order(n);
+        my_parallel_for(threads, threads, [&](size_t chunk, size_t){
+            auto [first, last] = my_chunk(n, threads, chunk);
+            size_t* h = hist.data() + chunk * parts;
+            for (size_t i = first; i < last; ++i)
+                order[h[bucket_of[i] >> shift]++] = i;
+        });
+
+        // every partition groups its rows by bucket and then by key
+        struct Part{
+            std::vector<size_t> rows;         // rows of the partition ordered by bucket, stable
+            std::vector<size_t> key_of_row;   // local key of rows[j]
+            std::vector<size_t> first_row;    // a row of every local key, in layout order
+            std::vector<size_t> key_counts;   // values of every local key
+            std::vector<size_t> bucket_keys;  // local keys per bucket of the range
+        };
+        std::vector<Part> part(parts);
+        size_t width = size_t(1) << shift;
+        my_parallel_for(threads, parts, [&](size_t p, size_t){
+            Part& pt = part[p];
+            size_t b0 = p << shift;
+            std::vector<size_t> start(width + 1, 0);
+            for (size_t j = part_start[p]; j < part_start[p + 1]; ++j)
+                ++start[bucket_of[order[j]] - b0 + 1];
+            for (size_t b = 0; b < width; ++b)
+                start[b + 1] += start[b];
+            pt.rows.resize(part_start[p + 1] - part_start[p]);
+            std::vector<size_t> cursor(start.begin(), start.end() - 1);
+            for (size_t j = part_start[p]; j < part_start[p + 1]; ++j)
+                pt.rows[cursor[bucket_of[order[j]] - b0]++] = order[j];
+
+            pt.key_of_row.resize(pt.rows.size());
+            pt.bucket_keys.assign(width, 0);
+            std::vector<Key> keys;
+            for (size_t b = 0; b < width; ++b){
+                size_t first_key = pt.first_row.size();
+                for (size_t j = start[b]; j < start[b + 1]; ++j){
+                    Key key = key_of(pt.rows[j]);
+                    size_t k = first_key;
+                    while (k < keys.size() && !res.cmp(keys[k], key))
+                        ++k;
+                    if (k == keys.size()){
+                        keys.push_back(std::move(key));
+                        pt.first_row.push_back(pt.rows[j]);
+                        pt.key_counts.push_back(0);
+                    }
+                    pt.key_of_row[j] = k;
+                    ++pt.key_counts[k];
+                }
+                pt.bucket_keys[b] = pt.first_row.size() - first_key;
+            }
+        });
+
+        std::vector<size_t> key_base(parts + 1, 0), value_base(parts + 1, 0);
+        for (size_t p = 0; p < parts; ++p){
+            key_base[p + 1] = key_base[p] + part[p].first_row.size();
+            value_base[p + 1] = value_base[p] + part[p].rows.size();
+        }
+        res.__buckets.resize(size + 1);
+        res.__buckets[size] = key_base[parts];
+        res.__keys.resize(key_base[parts]);
+        res.__offsets.resize(key_base[parts] + 1);
+        res.__offsets[key_base[parts]] = n;
+        res.__values.resize(n);
+
+        my_parallel_for(threads, parts, [&](size_t p, size_t){
+            Part& pt = part[p];
+            size_t b0 = p << shift;
+            for (size_t b = 0, k = key_base[p]; b < width; ++b){
+                res.__buckets[b0 + b] = k;
+                k += pt.bucket_keys[b];
+            }
+            std::vector<size_t> cursor(pt.first_row.size());
+            for (size_t k = 0, v = value_base[p]; k < pt.first_row.size(); ++k){
+                res.__keys[key_base[p] + k] = key_of(pt.first_row[k]);
+                res.__offsets[key_base[p] + k] = v;
+                cursor[k] = v;
+                v += pt.key_counts[k];
+            }
+            // the bucket sort above is stable, so rows of one key are still in input order
+            for (size_t j = 0; j < pt.rows.size(); ++j)
+                res.__values[cursor[pt.key_of_row[j]]++] = value_of(pt.rows[j]);
+        });
+        return res;
+    }
+
+
+    /**
+     @brief Finds the values of key.
+     @param const Key& key
+     @returns MySpan<const T>, empty if there is no such key
+     */
+    MySpan<const T> find(const Key& key) const noexcept{
+        size_t i = __find(key, hash(key));
+        if (i == npos) return MySpan<const T>();
+        return values(i);
+    }
+
+
+    /**
+     @brief Finds the position of key in keys().
+     @param const Key& key
+     @returns size_t, npos if there is no such key
+     */
+    size_t index_of(const Key& key) const noexcept{
+        return __find(key, hash(key));
+    }
+
+
+    /**
+     @brief Finds the position of key in keys() when the hash of key is already known.
+     @param const Key& key
+     @param size_t h, the value of hash_function() for key
+     @returns size_t, npos if there is no such key
+     */
+    size_t index_of(const Key& key, size_t h) const noexcept{
+        return __find(key, h);
+    }
+
+
+    /**
+     @brief prefetches the bucket bounds for a key with hash h. Batched lookups call it for a whole batch before prefetch_keys and index_of.
+     @param size_t h
+     */
+    void prefetch_bucket(size_t h) const noexcept{
+        if (!__keys.empty())
+            my_prefetch(&__buckets[__constrain_hash(h, __buckets.size() - 1)]);
+    }
+
+
+    /**
+     @brief prefetches the first key of the bucket for a key with hash h
+     @param size_t h
+     */
+    void prefetch_keys(size_t h) const noexcept{
+        if (!__keys.empty())
+            my_prefetch(&__keys[__buckets[__constrain_hash(h, __buckets.size() - 1)]]);
+    }
+
+
+    /**
+     @brief returns the hash function
+     */
+    Hash hash_function() const{
+        return hash;
+    }
+
+
+    /**
+     @brief checks whether the multimap contains key
+     @param const Key& key
+     @returns bool
+     */
+    bool contains(const Key& key) const noexcept{
+        return __find(key, hash(key)) != npos;
+    }
+
+
+    /**
+     @brief returns all keys, grouped by bucket
+     @returns MySpan<const Key>
+     */
+    MySpan<const Key> keys() const noexcept{
+        return MySpan<const Key>(__keys.data(), __keys.size());
+    }
+
+
+    /**
+     @brief returns the values of the i-th key of keys()
+     @param size_t i
+     @returns MySpan<const T>
+     */
+    MySpan<const T> values(size_t i) const noexcept{
+        return MySpan<const T>(__values.data() + __offsets[i], __values.data() + __offsets[i + 1]);
+    }
+
+
+    /**
+     @brief returns all values. Values of one key are adjacent.
+     @returns MySpan<const T>
+     */
+    MySpan<const T> values() const noexcept{
+        return MySpan<const T>(__values.data(), __values.size());
+    }
+
+
+    /**
+     @brief returns the number of buckets
+     */
+    size_t size() const noexcept{
+        return __buckets.empty() ? 0 : __buckets.size() - 1;
+    }
+
+
+    /**
+     @brief returns the number of distinct keys
+     */
+    size_t count() const noexcept{
+        return __keys.size();
+    }
+
+
+    /**
+     @brief returns the total number of values
+     */
+    size_t value_count() const noexcept{
+        return __values.size();
+    }
+
+
+    /**
+     @brief checks whether the multimap is empty
+     @returns bool
+     */
+    bool empty() const noexcept{
+        return __keys.empty();
+    }
+
+
+    /**
+     @brief returns the number of bytes owned by the multimap
+     */
+    size_t memory_usage() const noexcept{
+        return __buckets.capacity() * sizeof(size_t) + __offsets.capacity() * sizeof(size_t)
+            + __keys.capacity() * sizeof(Key) + __values.capacity() * sizeof(T);
+    }
+};
+
+#endif /* MyFrozenMultimap_hpp */
@@ -0,0 +1,138 @@
+//
+//  my_hash_join.hpp
+//  MySpace
+//
+
+#ifndef MyHashJoin_hpp
+#define MyHashJoin_hpp
+
+#include <vector>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+
+#include "my_frozen_multimap.hpp"
+#include "my_parallel.hpp"
+
+
+/**
+ @brief kinds of joins HashJoin::probe can perform
+    inner: emits every pair of a probe row and a build row with an equivalent key
+    left_semi: emits every probe row that has at least one build row with an equivalent key, once
+    anti: emits every probe row that has no build row with an equivalent key
+ */
+enum class JoinKind{
+    inner,
+    left_semi,
+    anti
+};
+
+
+template <typename Key,
+            typename BuildRow,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief HashJoin joins two in-memory tables by key.
+        The build phase freezes the build side into a MyFrozenMultimap: the table is sized up front for the number of rows, built in parallel,
+        and build rows with equivalent keys end up adjacent. The probe phase processes probe rows in batches: it hashes the whole batch,
+        prefetches the buckets, then the keys, and only then compares, so the cache misses of a batch overlap.
+ */
+class HashJoin{
+    using table_type = MyFrozenMultimap<Key, BuildRow, Hash, Cmp>;
+
+    static constexpr size_t __batch = 16;
+
+    table_type __table;
+
+public:
+
+    /**
+     @brief builds the hash table from the build rows [first, last). Previous contents are discarded.
+     @param RandomIt first
+     @param RandomIt last
+     @param KeyFn key_fn, returns the join key of a build row; called concurrently
+     @param size_t threads
+     @param float max_load_factor
+     @exception std::bad_alloc();
+     */
+    template<typename RandomIt, typename KeyFn>
+    void build(RandomIt first, RandomIt last, KeyFn key_fn, size_t threads = 1, float max_load_factor = 1){
+        size_t n = std::distance(first, last);
+        __table = table_type::build_parallel(n,
+            [&](size_t i){ return key_fn(first[i]); },
+            [&](size_t i){ return first[i]; },
+            threads, max_load_factor);
+    }
+
+
+    /**
+     @brief probes the hash table with the probe rows [first, last) and streams the result to emit.
+        For JoinKind::inner emit is called as emit(probe_row, build_row), otherwise as emit(probe_row).
+        With more than one thread emit is called concurrently and the output order is unspecified.
+     @param RandomIt first
+     @param RandomIt last
+     @param KeyFn key_fn, returns the join key of a probe row; called concurrently
+     @param F emit
+     @param size_t threads
+     */
+    template<JoinKind kind, typename RandomIt, typename KeyFn, typename F>
+    void probe(RandomIt first, RandomIt last, KeyFn key_fn, F emit, size_t threads = 1) const{
+        size_t n = std::distance(first, last);
+        size_t chunks = threads > 1 ? threads * 8 : 1;
+        Hash hash = __table.hash_function();
+
+        my_parallel_for(threads, chunks, [&](size_t chunk, size_t){
+            auto [lo, hi] = my_chunk(n, chunks, chunk);
+            std::vector<Key> keys;
+            keys.reserve(__batch);
+            size_t hashes[__batch];
+
+            for (size_t b = lo; b < hi; b += __batch){
+                size_t m = std::min(__batch, hi - b);
+                keys.clear();
+                for (size_t i = 0; i < m; ++i){
+                    keys.push_back(key_fn(first[b + i]));
+                    hashes[i] = hash(keys[i]);
+                }
+                for (size_t i = 0; i < m; ++i)
+                    __table.prefetch_bucket(hashes[i]);
+                for (size_t i = 0; i < m; ++i)
+                    __table.prefetch_keys(hashes[i]);
+
+                for (size_t i = 0; i < m; ++i){
+                    size_t k = __table.index_of(keys[i], hashes[i]);
+                    if constexpr (kind == JoinKind::inner){
+                        if (k == table_type::npos) continue;
+                        for (const BuildRow& row : __table.values(k))
+                            emit(first[b + i], row);
+                    }else if constexpr (kind == JoinKind::left_semi){
+                        if (k != table_type::npos) emit(first[b + i]);
+                    }else{
+                        if (k == table_type::npos) emit(first[b + i]);
+                    }
+                }
+            }
+        });
+    }
+
+
+    /**
+     @brief returns the frozen build side
+     */
+    const table_type& table() const noexcept{
+        return __table;
+    }
+
+
+    /**
+     @brief returns the number of build rows
+     */
+    size_t count() const noexcept{
+        return __table.value_count();
+    }
+};
+
+#endif /* MyHashJoin_hpp */
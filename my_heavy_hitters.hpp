@@ -0,0 +1,323 @@
+//
+//  my_heavy_hitters.hpp
+//  MySpace
+//
+
+#ifndef MyHeavyHitters_hpp
+#define MyHeavyHitters_hpp
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include "my_unordered_map.hpp"
+
+
+/**
+ @brief an entry of a HeavyHittersMap: the estimated count of key and its error. The true count is in [count - error, count].
+ */
+template<typename Key>
+struct HeavyHitter{
+    Key key;
+    uint64_t count;
+    uint64_t error;
+
+    uint64_t guaranteed() const noexcept{
+        return count - error;
+    }
+};
+
+
+template <typename Key,
+            size_t K,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief HeavyHittersMap counts the most frequent keys of an unbounded stream in bounded memory with the Space-Saving algorithm.
+        At most K counters are kept, indexed by a MyUnorderedMap. A key without a counter takes over the counter with the minimum count m
+        and starts from m + weight with error m. Counters are grouped by count into a sorted list of buckets (the stream summary),
+        so both an increment and the replacement of the minimum take O(1) for unit weights.
+        Every key with a true count above total() / K has a counter, and no estimate exceeds its true count by more than min_count() <= total() / K.
+        Summaries of several threads or shards are combined with merge(). Not synchronized: use one summary per thread.
+ */
+class HeavyHittersMap{
+    static_assert(K > 0 && K < UINT32_MAX, "HeavyHittersMap: K must be in [1, 2^32 - 1)");
+
+    static constexpr uint32_t __nil = UINT32_MAX;
+
+    struct __counter{
+        Key key;
+        uint64_t count;
+        uint64_t error;
+        uint32_t bucket;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    // all counters with the same count; buckets are linked in increasing order of count
+    struct __bucket{
+        uint64_t count;
+        uint32_t first;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    std::vector<__counter> __counters;
+    std::vector<__bucket> __buckets;
+    std::vector<uint32_t> __free_buckets;
+    uint32_t __min = __nil;
+    uint32_t __max = __nil;
+    uint64_t __total = 0;
+    MyUnorderedMap<Key, uint32_t, Hash, Cmp> __index;
+
+
+    uint32_t __new_bucket(uint64_t count, uint32_t after){
+        uint32_t b = __free_buckets.back();
+        __free_buckets.pop_back();
+        __bucket& nb = __buckets[b];
+        nb.count = count;
+        nb.first = __nil;
+        nb.prev = after;
+        nb.next = after == __nil ? __min : __buckets[after].next;
+        if (nb.prev != __nil) __buckets[nb.prev].next = b;
+        else __min = b;
+        if (nb.next != __nil) __buckets[nb.next].prev = b;
+        else __max = b;
+        return b;
+    }
+
+
+    void __unlink(uint32_t c) noexcept{
+        __counter& x = __counters[c];
+        __bucket& b = __buckets[x.bucket];
+        if (x.prev != __nil) __counters[x.prev].next = x.next;
+        else b.first = x.next;
+        if (x.next != __nil) __counters[x.next].prev = x.prev;
+        if (b.first != __nil) return;
+
+        if (b.prev != __nil) __buckets[b.prev].next = b.next;
+        else __min = b.next;
+        if (b.next != __nil) __buckets[b.next].prev = b.prev;
+        else __max = b.prev;
+        __free_buckets.push_back(x.bucket);
+    }
+
+
+    // returns the bucket of count, creating it; the search goes forward from bucket from, whose count is not larger, or from the minimum when from is __nil
+    uint32_t __bucket_of(uint64_t count, uint32_t from){
+        uint32_t at = from;
+        if (at == __nil && __min != __nil && __buckets[__min].count <= count) at = __min;
+        if (at != __nil)
+            while (__buckets[at].next != __nil && __buckets[__buckets[at].next].count <= count)
+                at = __buckets[at].next;
+        return at != __nil && __buckets[at].count == count ? at : __new_bucket(count, at);
+    }
+
+
+    void __link(uint32_t c, uint32_t b) noexcept{
+        __counter& x = __counters[c];
+        x.bucket = b;
+        x.prev = __nil;
+        x.next = __buckets[b].first;
+        if (x.next != __nil) __counters[x.next].prev = c;
+        __buckets[b].first = c;
+    }
+
+
+    // adds weight to counter c and moves it to the bucket of its new count. The bucket is found before the old one may be freed.
+    void __raise(uint32_t c, uint64_t weight){
+        __counters[c].count += weight;
+        uint32_t b = __bucket_of(__counters[c].count, __counters[c].bucket);
+        __unlink(c);
+        __link(c, b);
+    }
+
+
+    void __reset(){
+        __counters.clear();
+        __buckets.assign(K + 1, __bucket{0, __nil, __nil, __nil});
+        __free_buckets.clear();
+        for (uint32_t b = K + 1; b-- > 0;)
+            __free_buckets.push_back(b);
+        __min = __max = __nil;
+        __total = 0;
+        __index.clear();
+        __index.rehash(K);
+    }
+
+public:
+
+    /**
+     @brief constructs an empty summary with room for K counters
+     @exception std::bad_alloc();
+     */
+    HeavyHittersMap(){
+        __counters.reserve(K);
+        __free_buckets.reserve(K + 1);
+        __reset();
+    }
+
+
+    /**
+     @brief counts weight occurrences of key
+     @param const Key& key
+     @param uint64_t weight
+     @exception std::bad_alloc();
+     */
+    void add(const Key& key, uint64_t weight = 1){
+        if (weight == 0) return;
+        __total += weight;
+        auto it = __index.find(key);
+        if (it != __index.end()){
+            __raise(it->second, weight);
+            return;
+        }
+        if (__counters.size() < K){
+            uint32_t c = uint32_t(__counters.size());
+            __counters.push_back(__counter{key, weight, 0, __nil, __nil, __nil});
+            __index.insert(std::make_pair(key, c));
+            __link(c, __bucket_of(weight, __nil));
+            return;
+        }
+        // Space-Saving: the key takes over a counter with the minimum count, which bounds its error
+        uint32_t c = __buckets[__min].first;
+        __index.erase(__counters[c].key);
+        __counters[c].key = key;
+        __counters[c].error = __counters[c].count;
+        __index.insert(std::make_pair(key, c));
+        __raise(c, weight);
+    }
+
+
+    /**
+     @brief returns the estimate for key. A key without a counter has count min_count() and error min_count(): its true count is at most that.
+     @param const Key& key
+     @returns HeavyHitter<Key>
+     */
+    HeavyHitter<Key> estimate(const Key& key) const{
+        auto it = __index.find(key);
+        if (it != __index.cend()){
+            const __counter& x = __counters[it->second];
+            return HeavyHitter<Key>{key, x.count, x.error};
+        }
+        return HeavyHitter<Key>{key, min_count(), min_count()};
+    }
+
+
+    bool contains(const Key& key) const{
+        return __index.find(key) != __index.cend();
+    }
+
+
+    /**
+     @brief returns up to k entries with the largest counts, in decreasing order of count
+     @param size_t k
+     @returns std::vector<HeavyHitter<Key>>
+     */
+    std::vector<HeavyHitter<Key> > top(size_t k = K) const{
+        std::vector<HeavyHitter<Key> > res;
+        res.reserve(std::min(k, __counters.size()));
+        for (uint32_t b = __max; b != __nil && res.size() < k; b = __buckets[b].prev){
+            size_t from = res.size();
+            for (uint32_t c = __buckets[b].first; c != __nil; c = __counters[c].next){
+                const __counter& x = __counters[c];
+                res.push_back(HeavyHitter<Key>{x.key, x.count, x.error});
+            }
+            // within a count, the entries with smaller error are the surer ones
+            std::sort(res.begin() + from, res.end(), [](const auto& a, const auto& b){ return a.error < b.error; });
+        }
+        if (res.size() > k) res.resize(k);
+        return res;
+    }
+
+
+    /**
+     @brief returns the entries whose true count is guaranteed to be at least threshold, in decreasing order of count
+     @param uint64_t threshold
+     @returns std::vector<HeavyHitter<Key>>
+     */
+    std::vector<HeavyHitter<Key> > guaranteed(uint64_t threshold) const{
+        std::vector<HeavyHitter<Key> > res;
+        for (auto& e : top(K))
+            if (e.guaranteed() >= threshold) res.push_back(e);
+        return res;
+    }
+
+
+    /**
+     @brief adds the counts of other into this summary, as if this summary had seen both streams. The error bounds stay valid:
+        a key missing from one full summary is charged that summary's min_count().
+     @param const HeavyHittersMap& other
+     @exception std::bad_alloc();
+     */
+    void merge(const HeavyHittersMap& other){
+        uint64_t m1 = min_count(), m2 = other.min_count();
+        std::vector<HeavyHitter<Key> > all;
+        all.reserve(__counters.size() + other.__counters.size());
+        for (const __counter& x : __counters){
+            auto it = other.__index.find(x.key);
+            if (it != other.__index.cend()){
+                const __counter& y = other.__counters[it->second];
+                all.push_back(HeavyHitter<Key>{x.key, x.count + y.count, x.error + y.error});
+            }else{
+                all.push_back(HeavyHitter<Key>{x.key, x.count + m2, x.error + m2});
+            }
+        }
+        for (const __counter& y : other.__counters)
+            if (!contains(y.key))
+                all.push_back(HeavyHitter<Key>{y.key, y.count + m1, y.error + m1});
+
+        std::sort(all.begin(), all.end(), [](const auto& a, const auto& b){ return a.count > b.count; });
+        if (all.size() > K) all.resize(K);
+        uint64_t total = __total + other.__total;
+
+        __reset();
+        __total = total;
+        // in increasing order of count every counter goes to the last bucket or a new one after it
+        for (auto it = all.rbegin(); it != all.rend(); ++it){
+            uint32_t c = uint32_t(__counters.size());
+            __counters.push_back(__counter{it->key, it->count, it->error, __nil, __nil, __nil});
+            __index.insert(std::make_pair(it->key, c));
+            __link(c, __bucket_of(it->count, __max));
+        }
+    }
+
+
+    /**
+     @brief returns the smallest count of a counter when all K are taken, else 0. It bounds the error of every estimate.
+     */
+    uint64_t min_count() const noexcept{
+        return __counters.size() < K || __min == __nil ? 0 : __buckets[__min].count;
+    }
+
+
+    /**
+     @brief returns the sum of all weights added
+     */
+    uint64_t total() const noexcept{
+        return __total;
+    }
+
+
+    /**
+     @brief returns the number of counters in use
+     */
+    size_t size() const noexcept{
+        return __counters.size();
+    }
+
+
+    static constexpr size_t capacity() noexcept{
+        return K;
+    }
+
+
+    void clear(){
+        __reset();
+    }
+};
+
+#endif /* MyHeavyHitters_hpp */
@@ -0,0 +1,263 @@
+//
+//  my_indexed_hash_set.hpp
+//  MySpace
+//
+
+#ifndef MyIndexedHashSet_hpp
+#define MyIndexedHashSet_hpp
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+#include "my_unordered_map.hpp"
+
+
+template <typename Record,
+            typename Projection,
+            typename Hash = std::hash<std::decay_t<std::invoke_result_t<const Projection&, const Record&> > >,
+            typename Cmp = std::equal_to<> >
+
+/**!
+ @brief IndexedHashSet is a hash index over a user-owned std::vector<Record>. It stores only 32-bit positions of records in an open-addressed table
+        and hashes and compares records through the projection, so a record costs 4 bytes of slot divided by the load factor instead of a node.
+        Lookup is heterogeneous: find accepts any type that Hash and Cmp accept together with the projected key.
+        The vector may grow between calls, but records that are indexed must not change their projected key or position.
+ */
+class IndexedHashSet{
+    using key_type = std::decay_t<std::invoke_result_t<const Projection&, const Record&> >;
+
+    static constexpr uint32_t __empty = uint32_t(-1);
+
+    const std::vector<Record>* __records;
+    Projection proj;
+    Hash hash;
+    Cmp cmp;
+
+    std::vector<uint32_t> __slots;
+    size_t __count = 0;
+    float __max_load_factor = 0.8f;
+
+
+    decltype(auto) __key(uint32_t index) const{
+        return std::invoke(proj, (*__records)[index]);
+    }
+
+
+    template<typename K>
+    size_t __slot_of(const K& key) const noexcept{
+        size_t mask = __slots.size() - 1;
+        for (size_t s = __constrain_hash(hash(key), __slots.size()); ; s = (s + 1) & mask){
+            if (__slots[s] == __empty || cmp(__key(__slots[s]), key)) return s;
+        }
+    }
+
+
+    void __rehash(size_t new_size){
+        std::vector<uint32_t> old(new_size, __empty);
+        std::swap(old, __slots);
+        size_t mask = new_size - 1;
+        for (uint32_t index : old){
+            if (index == __empty) continue;
+            size_t s = __constrain_hash(hash(__key(index)), new_size);
+            while (__slots[s] != __empty)
+                s = (s + 1) & mask;
+            __slots[s] = index;
+        }
+    }
+
+
+    size_t __size_for(size_t count) const noexcept{
+        size_t size = 8;
+        while (size * __max_load_factor < count)
+            size <<= 1;
+        return size;
+    }
+
+public:
+
+    static constexpr uint32_t npos = __empty;
+
+
+    /**
+     @brief constructs an empty index over records
+     @param const std::vector<Record>& records
+     @param Projection proj
+     */
+    explicit IndexedHashSet(const std::vector<Record>& records, Projection proj = Projection(), Hash hash = Hash(), Cmp cmp = Cmp()):
+        __records(&records), proj(std::move(proj)), hash(std::move(hash)), cmp(std::move(cmp)){}
+
+
+    /**
+     @brief manages maximum ratio of indexed records to slots. Values are clamped to (0, 0.95].
+     @param float f
+     */
+    void max_load_factor(float f) noexcept{
+        f = fabs(f);
+        __max_load_factor = (f > 0.95f || f == 0 ? 0.95f : f);
+    }
+
+
+    float max_load_factor() const noexcept{
+        return __max_load_factor;
+    }
+
+
+    /**
+     @brief returns the number of slots
+     */
+    size_t size() const noexcept{
+        return __slots.size();
+    }
+
+
+    /**
+     @brief returns the number of indexed records
+     */
+    size_t count() const noexcept{
+        return __count;
+    }
+
+
+    bool empty() const noexcept{
+        return __count == 0;
+    }
+
+
+    /**
+     @brief returns the number of bytes owned by the index
+     */
+    size_t memory_usage() const noexcept{
+        return __slots.capacity() * sizeof(uint32_t);
+    }
+
+
+    /**
+     @brief makes room for count records without rehashing
+     @param size_t count
+     @exception std::bad_alloc();
+     */
+    void reserve(size_t count){
+        size_t size = __size_for(count);
+        if (size > __slots.size())
+            __rehash(size);
+    }
+
+
+    /**
+     @brief indexes the record at position index, if no indexed record has an equivalent projected key.
+     @param uint32_t index
+     @returns std::pair<uint32_t, bool>, the position of the equivalent record and whether the insertion took place
+     @exception std::out_of_range, std::bad_alloc();
+     */
+    std::pair<uint32_t, bool> insert(uint32_t index){
+        if (index >= __records->size() || index == __empty)
+            throw std::out_of_range("IndexedHashSet::insert: index is out of the records");
+        if (__slots.size() * __max_load_factor < __count + 1)
+            __rehash(std::max(2 * __slots.size(), __size_for(__count + 1)));
+
+        size_t s = __slot_of(__key(index));
+        if (__slots[s] != __empty)
+            return std::make_pair(__slots[s], false);
+        __slots[s] = index;
+        ++__count;
+        return std::make_pair(index, true);
+    }
+
+
+    /**
+     @brief indexes every record of the array in order. Records whose key is already indexed are skipped.
+     @returns size_t, the number of records inserted
+     @exception std::out_of_range, std::bad_alloc();
+     */
+    size_t insert_all(){
+        if (__records->size() >= __empty)
+            throw std::out_of_range("IndexedHashSet::insert_all: too many records");
+        reserve(__records->size());
+        size_t inserted = 0;
+        for (uint32_t i = 0; i < __records->size(); ++i)
+            inserted += insert(i).second;
+        return inserted;
+    }
+
+
+    /**
+     @brief Finds the record whose projected key is equivalent to key.
+     @param const K& key
+     @returns uint32_t, the position of the record or npos
+     */
+    template<typename K>
+    uint32_t find(const K& key) const{
+        if (__count == 0) return npos;
+        return __slots[__slot_of(key)];
+    }
+
+
+    /**
+     @brief Finds the record whose projected key is equivalent to key.
+     @param const K& key
+     @returns const Record*, nullptr if there is no such record
+     */
+    template<typename K>
+    const Record* find_record(const K& key) const{
+        uint32_t index = find(key);
+        return index == npos ? nullptr : &(*__records)[index];
+    }
+
+
+    template<typename K>
+    bool contains(const K& key) const{
+        return find(key) != npos;
+    }
+
+
+    /**
+     @brief removes the record with key equivalent to key from the index. The record itself is not touched.
+     @param const K& key
+     @returns bool
+     */
+    template<typename K>
+    bool erase(const K& key){
+        if (__count == 0) return false;
+        size_t hole = __slot_of(key);
+        if (__slots[hole] == __empty) return false;
+
+        // backward shift: pull every later record of the run whose home is not between the hole and itself
+        size_t mask = __slots.size() - 1;
+        for (size_t s = (hole + 1) & mask; __slots[s] != __empty; s = (s + 1) & mask){
+            size_t home = __constrain_hash(hash(__key(__slots[s])), __slots.size());
+            if (((s - home) & mask) >= ((s - hole) & mask)){
+                __slots[hole] = __slots[s];
+                hole = s;
+            }
+        }
+        __slots[hole] = __empty;
+        --__count;
+        return true;
+    }
+
+
+    /**
+     @brief points the index at another array, for example after the old one was moved. The records are expected to be at the same positions.
+     @param const std::vector<Record>& records
+     */
+    void rebind(const std::vector<Record>& records) noexcept{
+        __records = &records;
+    }
+
+
+    /**
+     @brief removes all records from the index
+     */
+    void clear() noexcept{
+        __slots.clear();
+        __count = 0;
+    }
+};
+
+#endif /* MyIndexedHashSet_hpp */
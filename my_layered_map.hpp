@@ -0,0 +1,369 @@
+//
+//  my_layered_map.hpp
+//  MySpace
+//
+
+#ifndef MyLayeredMap_hpp
+#define MyLayeredMap_hpp
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <shared_mutex>
+#include <condition_variable>
+
+#include "my_snapshot.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MyLayeredMap is a map made of an immutable base, a full image (my_snapshot.hpp) mapped read-only, and a small MyUnorderedMap overlay
+        with the changes made since: assigned values and tombstones of erased keys. Lookups check the overlay, then decode the one bucket of the base
+        the key belongs to. A merge writes base and overlay into a new full image, replaces the base file atomically and maps it; while it runs,
+        the overlay being merged is frozen and new changes go to a fresh one, so the map stays readable and writable.
+        Merges run on demand or periodically in a background thread. All operations may be called from any thread.
+        Hash must be the hash the image was written with.
+ */
+class MyLayeredMap{
+    using overlay_map = MyUnorderedMap<Key, std::optional<T>, Hash, Cmp>;
+    using overlay_item = std::pair<Key, std::optional<T> >;
+
+    std::string __path;
+    std::shared_ptr<const __image_view> __base;
+    overlay_map __overlay;
+    std::shared_ptr<const overlay_map> __frozen;    // the overlay a running merge is folding into the base
+    size_t __count = 0;
+    size_t __merges = 0;
+    Hash hash;
+    Cmp cmp;
+
+    mutable std::shared_mutex __mutex;
+    std::mutex __merge_mutex;
+
+    std::thread __merger;
+    std::mutex __timer_mutex;
+    std::condition_variable __timer;
+    bool __stop = false;
+
+
+    static std::shared_ptr<const __image_view> __open(const std::string& path){
+        auto img = std::make_shared<const __image_view>(path);
+        if (img->header().kind != uint32_t(__image_kind::full))
+            throw std::invalid_argument("MyLayeredMap: " + path + " is a delta, compact it into a base first");
+        return img;
+    }
+
+
+    static bool __base_find(const __image_view& img, const Cmp& cmp, const Key& key, size_t fh, T* out){
+        const __image_header& h = img.header();
+        if (h.buckets == 0) return false;
+        return __scan_bucket<Key, T>(img, __constrain_hash(fh, size_t(h.buckets)), [&](Key&& k, T&& v){
+            if (!cmp(k, key)) return false;
+            if (out) *out = std::move(v);
+            return true;
+        });
+    }
+
+
+    // looks key up in the overlays, then the base; called with __mutex held
+    bool __find(const Key& key, size_t fh, T* out) const{
+        auto it = __overlay.find(key, fh);
+        if (it != __overlay.cend()){
+            if (it->second && out) *out = *it->second;
+            return it->second.has_value();
+        }
+        if (__frozen){
+            auto f = __frozen->find(key, fh);
+            if (f != __frozen->cend()){
+                if (f->second && out) *out = *f->second;
+                return f->second.has_value();
+            }
+        }
+        return __base_find(*__base, cmp, key, fh, out);
+    }
+
+
+    static void __append_offset(std::string& seg, size_t at, size_t records_begin){
+        uint64_t off = seg.size() - records_begin;
+        if (off > UINT32_MAX)
+            throw std::length_error("image: segment is larger than 4 GB, use smaller segments");
+        uint32_t o = uint32_t(off);
+        memcpy(&seg[at], &o, sizeof(o));
+    }
+
+
+    /*
+     writes base with changes applied as a full image to fd. The bucket count grows by doubling until it holds count elements,
+     so bucket c of the new image takes its base records from bucket c % base buckets.
+     */
+    void __write_merged(int fd, const __image_view& base, const overlay_map& changes, size_t count) const{
+        const __image_header& bh = base.header();
+        uint64_t buckets = std::max<uint64_t>(1, bh.buckets);
+        while (buckets < count) buckets *= 2;
+        uint64_t seg_buckets = bh.segment_buckets;
+        __image_header h{__image_magic, __image_version, uint32_t(__image_kind::full), buckets, seg_buckets,
+                         __image_segments(buckets, seg_buckets), 0};
+        std::vector<__image_segment> dir(h.segments, __image_segment{0, 0, 0});
+
+        // assigned values of the overlay in bucket order of the new image
+        std::vector<std::pair<uint64_t, const overlay_item*> > added;
+        for (auto it = changes.cbegin(); it != changes.cend(); ++it)
+            if (it->second)
+                added.emplace_back(__constrain_hash(hash(it->first), size_t(buckets)), &*it);
+        std::sort(added.begin(), added.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+
+        __image_file out(fd);
+        out.seek(sizeof(h) + dir.size() * sizeof(__image_segment));
+        std::string seg;
+        size_t next = 0;
+        for (uint64_t s = 0; s < h.segments; ++s){
+            uint64_t c0 = s * seg_buckets, c1 = std::min(buckets, c0 + seg_buckets);
+            size_t records_begin = size_t(c1 - c0 + 1) * sizeof(uint32_t);
+            seg.assign(records_begin, '\0');
+            uint64_t records = 0;
+            auto put = [&](const Key& key, const T& value){
+                size_t old = seg.size();
+                seg.resize(old + my_codec<Key>::size(key) + my_codec<T>::size(value));
+                my_codec<T>::encode(value, my_codec<Key>::encode(key, &seg[old]));
+                ++records;
+            };
+            for (uint64_t c = c0; c < c1; ++c){
+                __append_offset(seg, size_t(c - c0) * sizeof(uint32_t), records_begin);
+                if (bh.buckets != 0){
+                    __scan_bucket<Key, T>(base, c % bh.buckets, [&](Key&& key, T&& value){
+                        size_t fh = hash(key);
+                        if (__constrain_hash(fh, size_t(buckets)) == c && changes.find(key, fh) == changes.cend())
+                            put(key, value);
+                        return false;
+                    });
+                }
+                for (; next < added.size() && added[next].first == c; ++next)
+                    put(added[next].second->first, *added[next].second->second);
+            }
+            __append_offset(seg, size_t(c1 - c0) * sizeof(uint32_t), records_begin);
+            dir[s] = __image_segment{out.position(), seg.size(), records};
+            h.count += records;
+            out.append(seg.data(), seg.size());
+        }
+        out.flush();
+        __image_file::write_at(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0);
+        __image_file::write_at(fd, reinterpret_cast<const char*>(dir.data()), dir.size() * sizeof(__image_segment), sizeof(h));
+    }
+
+
+    void __merge(){
+        std::lock_guard<std::mutex> merging(__merge_mutex);
+        std::shared_ptr<const __image_view> base;
+        std::shared_ptr<const overlay_map> changes;
+        size_t count;
+        {
+            std::unique_lock<std::shared_mutex> lock(__mutex);
+            if (__overlay.empty()) return;
+            __frozen = std::make_shared<const overlay_map>(std::move(__overlay));
+            __overlay = overlay_map();
+            base = __base;
+            changes = __frozen;
+            count = __count;
+        }
+        try{
+            __publish_image(__path, [&](int fd){
+                __write_merged(fd, *base, *changes, count);
+            });
+            auto fresh = __open(__path);
+            std::unique_lock<std::shared_mutex> lock(__mutex);
+            __base = std::move(fresh);
+            __frozen.reset();
+            ++__merges;
+        }catch(...){
+            // the frozen changes go back under the newer ones
+            std::unique_lock<std::shared_mutex> lock(__mutex);
+            for (auto it = changes->cbegin(); it != changes->cend(); ++it)
+                __overlay.insert(*it);
+            __frozen.reset();
+            throw;
+        }
+    }
+
+public:
+
+    /**
+     @brief maps the full image path as the base. Merges replace the file path.
+     @param const std::string& path
+     @exception std::system_error, std::invalid_argument when path is not a full image
+     */
+    explicit MyLayeredMap(const std::string& path): __path(path), __base(__open(path)){
+        __count = size_t(__base->header().count);
+    }
+
+
+    MyLayeredMap(const MyLayeredMap&) = delete;
+    MyLayeredMap& operator=(const MyLayeredMap&) = delete;
+
+
+    /**
+     @brief returns a copy of the value of key
+     @param const Key& key
+     @returns std::optional<T>
+     @exception std::out_of_range on a malformed base
+     */
+    std::optional<T> get(const Key& key) const{
+        size_t fh = hash(key);
+        std::shared_lock<std::shared_mutex> lock(__mutex);
+        T value;
+        if (__find(key, fh, &value)) return value;
+        return std::nullopt;
+    }
+
+
+    bool contains(const Key& key) const{
+        size_t fh = hash(key);
+        std::shared_lock<std::shared_mutex> lock(__mutex);
+        return __find(key, fh, nullptr);
+    }
+
+
+    /**
+     @brief inserts the element if there is no element with an equivalent key in any layer
+     @returns bool, true if inserted
+     @exception std::bad_alloc(), std::out_of_range on a malformed base
+     */
+    bool insert(const Key& key, const T& value){
+        size_t fh = hash(key);
+        std::unique_lock<std::shared_mutex> lock(__mutex);
+        if (__find(key, fh, nullptr)) return false;
+        __overlay.insert_or_assign(key, std::optional<T>(value));
+        ++__count;
+        return true;
+    }
+
+
+    /**
+     @brief inserts the element or assigns value to the existing one
+     @returns bool, true if inserted
+     @exception std::bad_alloc(), std::out_of_range on a malformed base
+     */
+    bool insert_or_assign(const Key& key, const T& value){
+        size_t fh = hash(key);
+        std::unique_lock<std::shared_mutex> lock(__mutex);
+        bool fresh = !__find(key, fh, nullptr);
+        __overlay.insert_or_assign(key, std::optional<T>(value));
+        __count += fresh;
+        return fresh;
+    }
+
+
+    /**
+     @brief erases key: a key of the base or of a merging overlay is shadowed by a tombstone, a key only in the overlay is removed from it
+     @returns bool, true if the key was present
+     @exception std::bad_alloc(), std::out_of_range on a malformed base
+     */
+    bool erase(const Key& key){
+        size_t fh = hash(key);
+        std::unique_lock<std::shared_mutex> lock(__mutex);
+        if (!__find(key, fh, nullptr)) return false;
+        bool below = (__frozen && __frozen->find(key, fh) != __frozen->cend()) || __base_find(*__base, cmp, key, fh, nullptr);
+        if (below) __overlay.insert_or_assign(key, std::optional<T>());
+        else __overlay.erase(key);
+        --__count;
+        return true;
+    }
+
+
+    /**
+     @brief returns the number of elements
+     */
+    size_t count() const{
+        std::shared_lock<std::shared_mutex> lock(__mutex);
+        return __count;
+    }
+
+
+    bool empty() const{
+        return count() == 0;
+    }
+
+
+    /**
+     @brief returns the number of overlay entries, tombstones included, not yet merged into the base
+     */
+    size_t overlay_size() const{
+        std::shared_lock<std::shared_mutex> lock(__mutex);
+        return __overlay.count() + (__frozen ? __frozen->count() : 0);
+    }
+
+
+    /**
+     @brief returns the number of completed merges
+     */
+    size_t merges() const{
+        std::shared_lock<std::shared_mutex> lock(__mutex);
+        return __merges;
+    }
+
+
+    /**
+     @brief folds the overlay into a new base file in the calling thread. Changes made meanwhile stay in the overlay.
+        On failure the base and the changes are kept.
+     @exception std::system_error, std::out_of_range on a malformed base, std::bad_alloc()
+     */
+    void merge(){
+        __merge();
+    }
+
+
+    /**
+     @brief starts a background thread that merges every interval when the overlay has at least min_overlay entries.
+        A failed merge is retried at the next interval. Does nothing if the thread is running.
+     @param std::chrono::milliseconds interval
+     @param size_t min_overlay
+     */
+    void start_merging(std::chrono::milliseconds interval, size_t min_overlay = 1){
+        if (__merger.joinable()) return;
+        __stop = false;
+        __merger = std::thread([this, interval, min_overlay]{
+            std::unique_lock<std::mutex> lock(__timer_mutex);
+            while (!__timer.wait_for(lock, interval, [this]{ return __stop; })){
+                lock.unlock();
+                if (overlay_size() >= std::max<size_t>(1, min_overlay)){
+                    try{
+                        __merge();
+                    }catch(...){}
+                }
+                lock.lock();
+            }
+        });
+    }
+
+
+    /**
+     @brief stops the background merges and waits for a running one
+     */
+    void stop_merging() noexcept{
+        {
+            std::lock_guard<std::mutex> lock(__timer_mutex);
+            __stop = true;
+        }
+        __timer.notify_all();
+        if (__merger.joinable()) __merger.join();
+    }
+
+
+    ~MyLayeredMap(){
+        stop_merging();
+    }
+};
+
+#endif /* MyLayeredMap_hpp */
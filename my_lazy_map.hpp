@@ -0,0 +1,273 @@
+//
+//  my_lazy_map.hpp
+//  MySpace
+//
+
+#ifndef MyLazyMap_hpp
+#define MyLazyMap_hpp
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <functional>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "my_snapshot.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MyLazyMap is a read-only map over a full image (my_snapshot.hpp) that is deserialized on demand. Opening reads only the header and
+        the segment directory; the first lookup in a segment reads that segment with pread and decodes it into a MyUnorderedMap of its own,
+        which is published atomically, so later lookups take no lock. An optional background thread loads the remaining segments in order,
+        so the full load is spread out while the map already serves lookups. Lookups may run from any number of threads.
+        Hash must be the hash the image was written with.
+ */
+class MyLazyMap{
+    using segment_map = MyUnorderedMap<Key, T, Hash, Cmp>;
+    static constexpr size_t __stripes = 64;
+
+    std::string __path;
+    int __fd = -1;
+    __image_header __h;
+    std::vector<__image_segment> __dir;
+    std::unique_ptr<std::atomic<segment_map*>[]> __segments;
+    std::unique_ptr<std::mutex[]> __locks;
+    mutable std::atomic<size_t> __loaded{0};
+    Hash hash;
+
+    std::thread __prefetcher;
+    std::atomic<bool> __stop{false};
+
+
+    void __read(char* p, size_t n, uint64_t off) const{
+        while (n > 0){
+            ssize_t r = ::pread(__fd, p, n, off_t(off));
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0)
+                throw std::system_error(errno, std::generic_category(), "MyLazyMap: read " + __path);
+            if (r == 0)
+                throw std::out_of_range("MyLazyMap: " + __path + " is truncated");
+            p += r;
+            n -= size_t(r);
+            off += uint64_t(r);
+        }
+    }
+
+
+    // loads segment s unless it is loaded, and returns it
+    const segment_map* __load(uint64_t s) const{
+        std::lock_guard<std::mutex> lock(__locks[s % __stripes]);
+        if (segment_map* m = __segments[s].load(std::memory_order_relaxed)) return m;
+
+        const __image_segment& e = __dir[s];
+        uint64_t b0 = s * __h.segment_buckets, b1 = std::min(__h.buckets, (s + 1) * __h.segment_buckets);
+        std::string bytes(size_t(e.bytes), '\0');
+        __read(&bytes[0], bytes.size(), e.offset);
+
+        auto m = std::make_unique<segment_map>();
+        if (e.count > 0)
+            m->rehash(size_t(std::max<uint64_t>(1, uint64_t(ceil(float(e.count) / m->max_load_factor())))));
+        __decode_segment<Key, T>(bytes.data(), bytes.size(), b1 - b0, [&](Key&& key, T&& value){
+            m->insert(std::make_pair(std::move(key), std::move(value)));
+        });
+        __segments[s].store(m.get(), std::memory_order_release);
+        __loaded.fetch_add(1, std::memory_order_relaxed);
+        return m.release();
+    }
+
+
+    const segment_map* __segment_of(size_t fh) const{
+        if (__h.buckets == 0) return nullptr;
+        uint64_t s = __constrain_hash(fh, size_t(__h.buckets)) / __h.segment_buckets;
+        const segment_map* m = __segments[s].load(std::memory_order_acquire);
+        return m != nullptr ? m : __load(s);
+    }
+
+public:
+
+    /**
+     @brief opens a full image and reads its directory
+     @param const std::string& path
+     @param bool prefetch, starts a background thread that loads every segment
+     @exception std::system_error, std::invalid_argument when path is not a full image
+     */
+    explicit MyLazyMap(const std::string& path, bool prefetch = false): __path(path){
+        __fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (__fd < 0)
+            throw std::system_error(errno, std::generic_category(), "MyLazyMap: open " + path);
+        try{
+            struct stat st;
+            if (::fstat(__fd, &st) < 0)
+                throw std::system_error(errno, std::generic_category(), "MyLazyMap: fstat " + path);
+            uint64_t size = uint64_t(st.st_size);
+            if (size < sizeof(__h))
+                throw std::invalid_argument("MyLazyMap: " + path + " is not a map image");
+            __read(reinterpret_cast<char*>(&__h), sizeof(__h), 0);
+            if (__h.magic != __image_magic || __h.version != __image_version || __h.segment_buckets == 0 ||
+                __h.segments != __image_segments(__h.buckets, __h.segment_buckets) ||
+                size < sizeof(__h) + __h.segments * sizeof(__image_segment))
+                throw std::invalid_argument("MyLazyMap: " + path + " is not a map image");
+            if (__h.kind != uint32_t(__image_kind::full))
+                throw std::invalid_argument("MyLazyMap: " + path + " is a delta, compact it into a base first");
+
+            __dir.resize(size_t(__h.segments));
+            __read(reinterpret_cast<char*>(__dir.data()), __dir.size() * sizeof(__image_segment), sizeof(__h));
+            for (uint64_t s = 0; s < __h.segments; ++s){
+                uint64_t nb = std::min(__h.buckets, (s + 1) * __h.segment_buckets) - s * __h.segment_buckets;
+                if (__dir[s].offset + __dir[s].bytes > size || __dir[s].bytes < (nb + 1) * sizeof(uint32_t))
+                    throw std::invalid_argument("MyLazyMap: " + path + " is truncated");
+            }
+        }catch(...){
+            ::close(__fd);
+            throw;
+        }
+
+        __segments.reset(new std::atomic<segment_map*>[__dir.size()]);
+        for (size_t s = 0; s < __dir.size(); ++s)
+            __segments[s].store(nullptr, std::memory_order_relaxed);
+        __locks.reset(new std::mutex[__stripes]);
+        if (prefetch) start_prefetch();
+    }
+
+
+    MyLazyMap(const MyLazyMap&) = delete;
+    MyLazyMap& operator=(const MyLazyMap&) = delete;
+
+
+    /**
+     @brief starts the background thread that loads the segments not loaded yet, in file order. Does nothing if it is running.
+        The thread stops at the first segment it fails to load; a lookup in that segment then reports the error.
+     */
+    void start_prefetch(){
+        if (__prefetcher.joinable()) return;
+        __stop.store(false, std::memory_order_relaxed);
+        __prefetcher = std::thread([this]{
+            for (uint64_t s = 0; s < __h.segments && !__stop.load(std::memory_order_relaxed); ++s){
+                if (__segments[s].load(std::memory_order_acquire) != nullptr) continue;
+                try{
+                    __load(s);
+                }catch(...){
+                    return;
+                }
+            }
+        });
+    }
+
+
+    /**
+     @brief stops the background thread and waits for it
+     */
+    void stop_prefetch() noexcept{
+        __stop.store(true, std::memory_order_relaxed);
+        if (__prefetcher.joinable()) __prefetcher.join();
+    }
+
+
+    /**
+     @brief loads every segment not loaded yet in the calling thread
+     @exception std::system_error, std::out_of_range on a malformed image, std::bad_alloc()
+     */
+    void load_all(){
+        for (uint64_t s = 0; s < __h.segments; ++s)
+            if (__segments[s].load(std::memory_order_acquire) == nullptr)
+                __load(s);
+    }
+
+
+    /**
+     @brief returns a pointer to the value of key or nullptr, loading the segment of key on first access. The pointer is valid while the map lives.
+     @param const Key& key
+     @returns const T*
+     @exception std::system_error, std::out_of_range on a malformed image, std::bad_alloc()
+     */
+    const T* find(const Key& key) const{
+        size_t fh = hash(key);
+        const segment_map* m = __segment_of(fh);
+        if (m == nullptr) return nullptr;
+        auto it = m->find(key, fh);
+        return it == m->cend() ? nullptr : &it->second;
+    }
+
+
+    std::optional<T> get(const Key& key) const{
+        const T* p = find(key);
+        if (p) return *p;
+        return std::nullopt;
+    }
+
+
+    bool contains(const Key& key) const{
+        return find(key) != nullptr;
+    }
+
+
+    /**
+     @brief calls f(const std::pair<Key, T>&) for every element, loading every segment
+     */
+    template<typename F>
+    void for_each(F&& f) const{
+        for (uint64_t s = 0; s < __h.segments; ++s){
+            const segment_map* m = __segments[s].load(std::memory_order_acquire);
+            if (m == nullptr) m = __load(s);
+            for (auto it = m->cbegin(); it != m->cend(); ++it)
+                f(*it);
+        }
+    }
+
+
+    /**
+     @brief returns the number of elements in the image, known without loading it
+     */
+    size_t count() const noexcept{
+        return size_t(__h.count);
+    }
+
+
+    bool empty() const noexcept{
+        return __h.count == 0;
+    }
+
+
+    size_t segments() const noexcept{
+        return __dir.size();
+    }
+
+
+    /**
+     @brief returns the number of segments loaded so far
+     */
+    size_t loaded_segments() const noexcept{
+        return __loaded.load(std::memory_order_relaxed);
+    }
+
+
+    bool fully_loaded() const noexcept{
+        return loaded_segments() == segments();
+    }
+
+
+    ~MyLazyMap(){
+        stop_prefetch();
+        for (size_t s = 0; s < __dir.size(); ++s)
+            delete __segments[s].load(std::memory_order_relaxed);
+        ::close(__fd);
+    }
+};
+
+#endif /* MyLazyMap_hpp */
@@ -0,0 +1,125 @@
+//
+//  my_map_diff.hpp
+//  MySpace
+//
+
+#ifndef MyMapDiff_hpp
+#define MyMapDiff_hpp
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+#include "my_unordered_map.hpp"
+#include "my_set_operations.hpp"
+
+
+template <typename Key, typename T>
+
+/**!
+ @brief MapDelta is the difference between two versions of a map: inserted and changed elements with their new values and erased keys.
+        Erased entries carry only the key, so the delta holds nothing for elements that did not change.
+ */
+struct MapDelta{
+    std::vector<std::pair<Key, T> > inserted;
+    std::vector<std::pair<Key, T> > changed;
+    std::vector<Key> erased;
+
+    /**
+     @brief returns the number of entries in the delta
+     */
+    size_t size() const noexcept{
+        return inserted.size() + changed.size() + erased.size();
+    }
+
+    bool empty() const noexcept{
+        return size() == 0;
+    }
+
+    void clear() noexcept{
+        inserted.clear();
+        changed.clear();
+        erased.clear();
+    }
+};
+
+
+/**
+ @brief computes the delta that turns old_map into new_map. Values are compared with operator==.
+        new_map is scanned against old_map for inserted and changed elements, and old_map against new_map for erased keys, both split across threads by bucket ranges.
+        When both maps have the same bucket count and a stateless hash, buckets are compared pairwise without hashing.
+ @param const MyUnorderedMap& old_map
+ @param const MyUnorderedMap& new_map
+ @param size_t threads
+ @returns MapDelta<Key, T>
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+MapDelta<Key, T> diff(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& old_map, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& new_map, size_t threads = 1){
+    using item = std::pair<Key, T>;
+    threads = std::max<size_t>(1, threads);
+
+    std::vector<MapDelta<Key, T> > local(threads);
+    __probe_buckets(new_map, old_map, threads, [&](size_t thread, const item& now, const item* was){
+        if (was == nullptr)
+            local[thread].inserted.push_back(now);
+        else if (!(was->second == now.second))
+            local[thread].changed.push_back(now);
+    });
+    __probe_buckets(old_map, new_map, threads, [&](size_t thread, const item& was, const item* now){
+        if (now == nullptr)
+            local[thread].erased.push_back(was.first);
+    });
+
+    MapDelta<Key, T> res;
+    for (auto& l : local){
+        res.inserted.insert(res.inserted.end(), std::make_move_iterator(l.inserted.begin()), std::make_move_iterator(l.inserted.end()));
+        res.changed.insert(res.changed.end(), std::make_move_iterator(l.changed.begin()), std::make_move_iterator(l.changed.end()));
+        res.erased.insert(res.erased.end(), std::make_move_iterator(l.erased.begin()), std::make_move_iterator(l.erased.end()));
+    }
+    return res;
+}
+
+
+/**
+ @brief applies a delta made by diff to map. The bucket array is grown once up front, then erased keys are removed
+        and inserted and changed elements are written in batches: the keys of a batch are hashed and their buckets prefetched before they are searched.
+        Every change goes through erase and insert_or_assign, so a listener attached to map sees all of them.
+ @param MyUnorderedMap& map
+ @param const MapDelta<Key, T>& delta
+ @param size_t batch
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+void apply(MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, const MapDelta<Key, T>& delta, size_t batch = 64){
+    batch = std::max<size_t>(1, batch);
+    for (auto& key : delta.erased)
+        map.erase(key);
+
+    size_t need = map.count() + delta.inserted.size();
+    if (map.size() * map.max_load_factor() < need)
+        map.rehash(std::max<size_t>(2 * map.size(), size_t(ceil(float(need) / map.max_load_factor()))));
+
+    Hash hash = map.hash_function();
+    std::vector<size_t> hashes(batch);
+    auto upsert = [&](const std::vector<std::pair<Key, T> >& items){
+        for (size_t b = 0; b < items.size(); b += batch){
+            size_t m = std::min(batch, items.size() - b);
+            for (size_t i = 0; i < m; ++i){
+                hashes[i] = hash(items[b + i].first);
+                map.prefetch_bucket(hashes[i]);
+            }
+            for (size_t i = 0; i < m; ++i)
+                map.prefetch_node(hashes[i]);
+            // insert_or_assign, unlike an assignment through an iterator, reports changed values to the listener
+            for (size_t i = 0; i < m; ++i)
+                map.insert_or_assign(items[b + i].first, items[b + i].second);
+        }
+    };
+    upsert(delta.changed);
+    upsert(delta.inserted);
+}
+
+#endif /* MyMapDiff_hpp */
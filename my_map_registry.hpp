@@ -0,0 +1,308 @@
+//
+//  my_map_registry.hpp
+//  MySpace
+//
+
+#ifndef MyMapRegistry_hpp
+#define MyMapRegistry_hpp
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+#include <system_error>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "my_unordered_map.hpp"
+
+
+/**
+ @brief the name a MyUnorderedMap joins MyMapRegistry with, e.g. MyUnorderedMap<int, int> sessions(MyMapName("sessions"))
+ */
+struct MyMapName{
+    std::string value;
+
+    explicit MyMapName(std::string name): value(std::move(name)){}
+};
+
+
+/**
+ @brief a line of a registry dump
+ */
+struct MyMapStats{
+    std::string name;
+    size_t count = 0;
+    size_t buckets = 0;
+    size_t memory = 0;          // bytes of the nodes and the bucket array, without memory owned by keys and values
+    float load_factor = 0;
+    size_t rehashes = 0;
+    size_t max_chain = 0;       // 0 when the chains were not walked
+};
+
+
+/*
+ the entry of a registered map, linked into the registry list; deleting it leaves the registry
+ */
+struct __map_registration: MyMapRegistration{
+    __map_registration* prev = nullptr;
+    __map_registration* next = nullptr;
+    std::string name;
+    const void* map = nullptr;
+    void (*stats)(const void* map, MyMapStats& out, bool walk_chains) = nullptr;
+
+    ~__map_registration() override;
+};
+
+
+template<typename Map>
+void __map_registry_stats(const void* p, MyMapStats& out, bool walk_chains){
+    const Map& map = *static_cast<const Map*>(p);
+    out.count = map.count();
+    out.buckets = map.size();
+    out.memory = map.memory_usage();
+    out.load_factor = map.size() == 0 ? 0 : float(map.count()) / float(map.size());
+    out.rehashes = map.rehash_count();
+    out.max_chain = walk_chains ? map.max_chain_length() : 0;
+}
+
+
+/**!
+ @brief MyMapRegistry lists the MyUnorderedMap instances that were given a name, so a process with many maps can tell which ones hold the memory.
+        A map joins on construction with MyMapName or register_as() and leaves when destroyed; unnamed maps never touch the registry.
+        dump() is called directly or by a signal: watch_signal() installs a handler that only writes to a pipe, and a background thread
+        writes the dump to a file. The dump reads the maps without synchronizing with the threads that change them, so take it while they are
+        quiescent, or without walk_chains, when only counters are read and may be slightly stale. A signal comes at any time, so its dump
+        never walks the chains.
+ */
+class MyMapRegistry{
+    std::mutex __mutex;
+    __map_registration __head;
+
+    std::mutex __watch_mutex;
+    std::thread __watcher;
+    std::string __path;
+    int __signal = 0;
+    struct sigaction __previous;
+
+    static std::atomic<int>& __pipe_write() noexcept{
+        static std::atomic<int> fd{-1};
+        return fd;
+    }
+
+    static void __on_signal(int) noexcept{
+        int saved = errno;
+        int fd = __pipe_write().load(std::memory_order_relaxed);
+        if (fd >= 0){
+            char c = 'd';
+            ssize_t r = ::write(fd, &c, 1);
+            (void)r;
+        }
+        errno = saved;
+    }
+
+
+    MyMapRegistry(){
+        __head.prev = __head.next = &__head;
+    }
+
+    ~MyMapRegistry(){
+        stop_watching();
+        __head.prev = __head.next = nullptr;        // the head is no map to take out
+    }
+
+public:
+
+    MyMapRegistry(const MyMapRegistry&) = delete;
+    MyMapRegistry& operator=(const MyMapRegistry&) = delete;
+
+
+    static MyMapRegistry& instance(){
+        static MyMapRegistry registry;
+        return registry;
+    }
+
+
+    void join(__map_registration* r){
+        std::lock_guard<std::mutex> lock(__mutex);
+        r->prev = __head.prev;
+        r->next = &__head;
+        __head.prev->next = r;
+        __head.prev = r;
+    }
+
+
+    void leave(__map_registration* r){
+        std::lock_guard<std::mutex> lock(__mutex);
+        r->prev->next = r->next;
+        r->next->prev = r->prev;
+        r->prev = r->next = nullptr;
+    }
+
+
+    /**
+     @brief returns the statistics of every registered map, largest memory first
+     @param bool walk_chains, also find the longest chain of every map, which reads every node
+     @returns std::vector<MyMapStats>
+     */
+    std::vector<MyMapStats> snapshot(bool walk_chains = false){
+        std::vector<MyMapStats> res;
+        {
+            std::lock_guard<std::mutex> lock(__mutex);
+            for (__map_registration* r = __head.next; r != &__head; r = r->next){
+                res.emplace_back();
+                res.back().name = r->name;
+                r->stats(r->map, res.back(), walk_chains);
+            }
+        }
+        std::sort(res.begin(), res.end(), [](const MyMapStats& a, const MyMapStats& b){ return a.memory > b.memory; });
+        return res;
+    }
+
+
+    /**
+     @brief returns the number of registered maps
+     */
+    size_t size(){
+        std::lock_guard<std::mutex> lock(__mutex);
+        size_t n = 0;
+        for (__map_registration* r = __head.next; r != &__head; r = r->next) ++n;
+        return n;
+    }
+
+
+    /**
+     @brief writes a table of the registered maps, largest memory first, to out
+     @param FILE* out
+     @param bool walk_chains
+     */
+    void dump(FILE* out, bool walk_chains = false){
+        std::vector<MyMapStats> maps = snapshot(walk_chains);
+        size_t memory = 0;
+        for (auto& m : maps) memory += m.memory;
+        fprintf(out, "%zu maps, %zu bytes\n", maps.size(), memory);
+        fprintf(out, "%-32s %12s %12s %14s %8s %9s %9s\n", "name", "count", "buckets", "memory", "load", "rehashes", "max_chain");
+        for (auto& m : maps)
+            fprintf(out, "%-32s %12zu %12zu %14zu %8.3f %9zu %9zu\n", m.name.c_str(), m.count, m.buckets, m.memory,
+                    double(m.load_factor), m.rehashes, m.max_chain);
+        fflush(out);
+    }
+
+
+    /**
+     @brief writes the dump to the file path, replacing it
+     @exception std::system_error
+     */
+    void dump(const std::string& path, bool walk_chains = false){
+        FILE* f = fopen(path.c_str(), "w");
+        if (f == nullptr)
+            throw std::system_error(errno, std::generic_category(), "MyMapRegistry: open " + path);
+        dump(f, walk_chains);
+        fclose(f);
+    }
+
+
+    /**
+     @brief makes signal signo, e.g. SIGUSR1, write a dump to path. The handler only wakes a background thread, so it is async-signal-safe.
+        The dump reads only counters: walking the chains while other threads rehash or erase would follow freed nodes.
+        Replaces a previous watch_signal().
+     @param int signo
+     @param const std::string& path
+     @exception std::system_error
+     */
+    void watch_signal(int signo, const std::string& path){
+        stop_watching();
+        std::lock_guard<std::mutex> lock(__watch_mutex);
+        int fds[2];
+        if (::pipe(fds) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyMapRegistry: pipe");
+        ::fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        ::fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+        struct sigaction sa = {};
+        sa.sa_handler = &MyMapRegistry::__on_signal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        __pipe_write().store(fds[1], std::memory_order_relaxed);
+        if (::sigaction(signo, &sa, &__previous) < 0){
+            int err = errno;
+            __pipe_write().store(-1, std::memory_order_relaxed);
+            ::close(fds[0]);
+            ::close(fds[1]);
+            throw std::system_error(err, std::generic_category(), "MyMapRegistry: sigaction");
+        }
+        __signal = signo;
+        __path = path;
+
+        int in = fds[0];
+        __watcher = std::thread([this, in]{
+            char buf[64];
+            for (;;){
+                ssize_t r = ::read(in, buf, sizeof(buf));
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) break;
+                // the byte 'q' comes from stop_watching, every other one from the signal
+                if (std::find(buf, buf + r, 'q') != buf + r) break;
+                try{
+                    dump(__path, false);
+                }catch(...){}
+            }
+            ::close(in);
+        });
+    }
+
+
+    /**
+     @brief restores the previous handler of the watched signal and stops the background thread
+     */
+    void stop_watching() noexcept{
+        std::lock_guard<std::mutex> lock(__watch_mutex);
+        if (!__watcher.joinable()) return;
+        ::sigaction(__signal, &__previous, nullptr);
+        int fd = __pipe_write().exchange(-1, std::memory_order_relaxed);
+        ::fcntl(fd, F_SETFL, 0);
+        char c = 'q';
+        while (::write(fd, &c, 1) < 0 && errno == EINTR){}
+        __watcher.join();
+        ::close(fd);
+    }
+};
+
+
+
+inline __map_registration::~__map_registration(){
+    if (next != nullptr) MyMapRegistry::instance().leave(this);
+}
+
+
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+void MyUnorderedMap<Key, T, Hash, Cmp, Allocator>::register_as(const std::string& name){
+    auto* r = static_cast<__map_registration*>(__registration);
+    if (r != nullptr){
+        MyMapRegistry::instance().leave(r);
+        r->name = name;
+    }else{
+        r = new __map_registration;
+        r->name = name;
+        r->map = this;
+        r->stats = &__map_registry_stats<MyUnorderedMap>;
+        __registration = r;
+    }
+    MyMapRegistry::instance().join(r);
+}
+
+
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+MyUnorderedMap<Key, T, Hash, Cmp, Allocator>::MyUnorderedMap(const MyMapName& name): MyUnorderedMap(){
+    register_as(name.value);
+}
+
+#endif /* MyMapRegistry_hpp */
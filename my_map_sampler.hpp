@@ -0,0 +1,273 @@
+//
+//  my_map_sampler.hpp
+//  MySpace
+//
+
+#ifndef MyMapSampler_hpp
+#define MyMapSampler_hpp
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "my_unordered_map.hpp"
+#include "my_heavy_hitters.hpp"
+
+
+/**
+ @brief the aggregate of the samples a MyHotKeySampler collected
+ */
+struct MySamplerReport{
+    struct bucket_stats{
+        uint64_t bucket;
+        uint64_t samples;
+        uint64_t max_position;
+        double mean_position;
+    };
+
+    uint64_t samples = 0;
+    uint64_t finds = 0;
+    uint64_t inserts = 0;
+    uint64_t hits = 0;
+    uint64_t dropped = 0;           // samples lost because a thread buffer was full
+    double mean_position = 0;
+    std::vector<HeavyHitter<uint64_t> > hot_keys;       // by full hash of the key, most sampled first
+    std::vector<bucket_stats> hot_buckets;              // most sampled first
+};
+
+
+/*
+ a sampled call, as stored in the buffer of a thread
+ */
+struct __map_sample{
+    uint64_t hash;
+    uint32_t bucket;
+    uint16_t position;
+    uint8_t op;
+    uint8_t hit;
+};
+
+
+template <size_t HotKeys = 1024>
+
+/**!
+ @brief MyHotKeySampler is a MyMapSampler that samples about one call in period, at random intervals so that periodic access patterns do not alias,
+        and finds the hot keys and the long or busy buckets of the maps it is attached to.
+        Each thread writes its samples into its own single-producer ring buffer without locks; report() drains all of them into the aggregate,
+        where key hashes are counted by a HeavyHittersMap of HotKeys counters and buckets by an exact table. Bucket numbers are those at sampling time,
+        so a rehash mixes old and new numbers until reset(). The sampler must outlive its attachment to every map.
+ */
+class MyHotKeySampler: public MyMapSampler{
+    struct __buffer{
+        std::thread::id owner;
+        uint64_t rng;
+        uint32_t countdown;
+        alignas(64) std::atomic<uint64_t> head{0};      // written by the owner
+        alignas(64) std::atomic<uint64_t> tail{0};      // written by report()
+        std::atomic<uint64_t> dropped{0};
+        std::unique_ptr<__map_sample[]> ring;
+    };
+
+    struct __bucket_acc{
+        uint64_t samples = 0;
+        uint64_t position_sum = 0;
+        uint64_t max_position = 0;
+    };
+
+    struct __cache_entry{
+        uint64_t id;
+        __buffer* buffer;
+    };
+
+    static constexpr size_t __cache_size = 4;
+
+    const uint64_t __id;
+    const uint32_t __period;
+    const size_t __capacity;
+
+    std::mutex __threads_mutex;
+    std::vector<std::unique_ptr<__buffer> > __buffers;
+
+    std::mutex __report_mutex;
+    HeavyHittersMap<uint64_t, HotKeys> __keys;
+    MyUnorderedMap<uint64_t, __bucket_acc> __buckets;
+    MySamplerReport __totals;
+    uint64_t __position_sum = 0;
+
+
+    static uint64_t __next_id() noexcept{
+        static std::atomic<uint64_t> id{1};
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+
+    uint32_t __interval(__buffer& b) noexcept{
+        if (__period <= 1) return 0;
+        b.rng ^= b.rng << 13;
+        b.rng ^= b.rng >> 7;
+        b.rng ^= b.rng << 17;
+        return uint32_t(b.rng % (2 * uint64_t(__period) - 1));
+    }
+
+
+    // the buffer of the calling thread; a few recently used samplers are cached per thread, so a thread using several maps stays off the lock
+    __buffer& __local(){
+        static thread_local __cache_entry cache[__cache_size] = {};
+        static thread_local size_t victim = 0;
+        for (auto& e : cache)
+            if (e.id == __id) return *e.buffer;
+
+        __buffer* b = nullptr;
+        std::thread::id self = std::this_thread::get_id();
+        {
+            std::lock_guard<std::mutex> lock(__threads_mutex);
+            for (auto& p : __buffers)
+                if (p->owner == self) b = p.get();
+            if (b == nullptr){
+                auto fresh = std::make_unique<__buffer>();
+                fresh->owner = self;
+                fresh->rng = std::hash<std::thread::id>()(self) | 1;
+                fresh->ring.reset(new __map_sample[__capacity]);
+                b = fresh.get();
+                b->countdown = __interval(*b);
+                __buffers.push_back(std::move(fresh));
+            }
+        }
+        cache[victim] = __cache_entry{__id, b};
+        victim = (victim + 1) % __cache_size;
+        return *b;
+    }
+
+public:
+
+    /**
+     @brief creates a sampler of about one call in period
+     @param uint32_t period, 1 samples every call
+     @param size_t buffer, samples a thread buffer holds between two report() calls
+     */
+    explicit MyHotKeySampler(uint32_t period = 1024, size_t buffer = 4096):
+        __id(__next_id()), __period(std::max<uint32_t>(1, period)), __capacity(std::max<size_t>(1, buffer)){}
+
+
+    MyHotKeySampler(const MyHotKeySampler&) = delete;
+    MyHotKeySampler& operator=(const MyHotKeySampler&) = delete;
+
+
+    bool sample() noexcept override{
+        __buffer* b;
+        try{
+            b = &__local();
+        }catch(...){
+            return false;
+        }
+        if (b->countdown-- > 0) return false;
+        b->countdown = __interval(*b);
+        return true;
+    }
+
+
+    void record(MyMapOp op, size_t hash, size_t bucket, size_t position, bool hit) noexcept override{
+        __buffer* pb;       // resolved by sample() just before; if it cannot be, the sample is dropped as there
+        try{
+            pb = &__local();
+        }catch(...){
+            return;
+        }
+        __buffer& b = *pb;
+        uint64_t head = b.head.load(std::memory_order_relaxed);
+        if (head - b.tail.load(std::memory_order_acquire) >= __capacity){
+            b.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        b.ring[head % __capacity] = __map_sample{uint64_t(hash), uint32_t(std::min<size_t>(bucket, UINT32_MAX)),
+                                                 uint16_t(std::min<size_t>(position, UINT16_MAX)), uint8_t(op), uint8_t(hit)};
+        b.head.store(head + 1, std::memory_order_release);
+    }
+
+
+    /**
+     @brief drains the thread buffers and returns the aggregate of every sample since the last reset()
+     @param size_t top_keys
+     @param size_t top_buckets
+     @returns MySamplerReport
+     @exception std::bad_alloc();
+     */
+    MySamplerReport report(size_t top_keys = 20, size_t top_buckets = 20){
+        std::lock_guard<std::mutex> lock(__report_mutex);
+        std::vector<__buffer*> buffers;
+        {
+            std::lock_guard<std::mutex> threads(__threads_mutex);
+            for (auto& p : __buffers)
+                buffers.push_back(p.get());
+        }
+
+        MySamplerReport r = __totals;
+        r.dropped = 0;
+        for (__buffer* b : buffers){
+            uint64_t tail = b->tail.load(std::memory_order_relaxed);
+            uint64_t head = b->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail){
+                const __map_sample& s = b->ring[tail % __capacity];
+                ++r.samples;
+                if (s.op == uint8_t(MyMapOp::find)) ++r.finds;
+                else ++r.inserts;
+                r.hits += s.hit;
+                __position_sum += s.position;
+                __keys.add(s.hash);
+                __bucket_acc& acc = __buckets[s.bucket];
+                ++acc.samples;
+                acc.position_sum += s.position;
+                acc.max_position = std::max<uint64_t>(acc.max_position, s.position);
+            }
+            b->tail.store(tail, std::memory_order_release);
+            r.dropped += b->dropped.load(std::memory_order_relaxed);
+        }
+        __totals = r;
+        r.mean_position = r.samples ? double(__position_sum) / double(r.samples) : 0;
+        r.hot_keys = __keys.top(top_keys);
+
+        for (auto it = __buckets.cbegin(); it != __buckets.cend(); ++it){
+            const __bucket_acc& acc = it->second;
+            r.hot_buckets.push_back(MySamplerReport::bucket_stats{it->first, acc.samples, acc.max_position,
+                                                                  double(acc.position_sum) / double(acc.samples)});
+        }
+        auto hotter = [](const auto& a, const auto& b){
+            return a.samples != b.samples ? a.samples > b.samples : a.max_position > b.max_position;
+        };
+        if (r.hot_buckets.size() > top_buckets){
+            std::partial_sort(r.hot_buckets.begin(), r.hot_buckets.begin() + top_buckets, r.hot_buckets.end(), hotter);
+            r.hot_buckets.resize(top_buckets);
+        }else{
+            std::sort(r.hot_buckets.begin(), r.hot_buckets.end(), hotter);
+        }
+        return r;
+    }
+
+
+    /**
+     @brief discards the aggregate and the samples not reported yet
+     */
+    void reset(){
+        std::lock_guard<std::mutex> lock(__report_mutex);
+        std::lock_guard<std::mutex> threads(__threads_mutex);
+        for (auto& p : __buffers){
+            p->tail.store(p->head.load(std::memory_order_acquire), std::memory_order_release);
+            p->dropped.store(0, std::memory_order_relaxed);
+        }
+        __keys.clear();
+        __buckets.clear();
+        __totals = MySamplerReport();
+        __position_sum = 0;
+    }
+
+
+    uint32_t period() const noexcept{
+        return __period;
+    }
+};
+
+#endif /* MyMapSampler_hpp */
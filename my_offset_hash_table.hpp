@@ -0,0 +1,344 @@
+//
+//  my_offset_hash_table.hpp
+//  MySpace
+//
+
+#ifndef MyOffsetHashTable_hpp
+#define MyOffsetHashTable_hpp
+
+#include <new>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "my_unordered_map.hpp"
+
+
+/*
+ state of an __offset_hash_table, stored inside the region it manages. All links are byte offsets from the start of the region, 0 is null.
+ */
+struct __offset_table_header{
+    uint64_t magic;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint64_t bytes;         // end of the arena
+    uint64_t top;           // bump pointer
+    uint64_t free_nodes;    // singly linked through __offset_node::next
+    uint64_t free_blocks;   // released bucket arrays, first fit
+    uint64_t array;         // bucket array: buckets offsets of the first node of every chain
+    uint64_t buckets;
+    uint64_t count;
+    float max_load_factor;
+};
+
+
+template<typename Key, typename T>
+struct __offset_node{
+    uint64_t next;
+    uint64_t hash;
+    std::pair<Key, T> item;
+};
+
+
+struct __offset_block{
+    uint64_t next;
+    uint64_t size;
+};
+
+
+/*
+ __offset_hash_table is the core of the maps whose state lives in a mapped region (shared memory, a file): the same chained table as MyUnorderedMap,
+ with chains per bucket, full hashes in the nodes and offsets instead of pointers, so the region may be mapped at any address.
+ Nodes and bucket arrays come from an arena at the end of the region: nodes are recycled through a free list, old bucket arrays through a first-fit list
+ whose blocks are split, so a request takes only the bytes it needs.
+ Region provides char* base(), size_t mapped() and grow(size_t bytes), which makes at least bytes usable or throws std::bad_alloc and may move base(),
+ and changing(uint64_t off, size_t bytes), which the table calls before it writes those bytes.
+ Keys and values are stored as raw bytes and must be trivially copyable.
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Region>
+class __offset_hash_table{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<T>::value,
+                  "__offset_hash_table: keys and values must be trivially copyable to live in a mapped region");
+
+public:
+    using node = __offset_node<Key, T>;
+    static constexpr uint64_t magic = 0x4d594f4646534554ull;
+
+private:
+    Region& __region;
+    size_t __header_at;
+    Hash hash;
+    Cmp cmp;
+
+
+    static uint64_t __align(uint64_t n) noexcept{
+        return (n + 7) & ~uint64_t(7);
+    }
+
+
+    uint64_t* __slots() const noexcept{
+        return reinterpret_cast<uint64_t*>(__region.base() + table()->array);
+    }
+
+
+    // announces a write of n bytes at p to the region
+    void __changing(const void* p, size_t n) const noexcept{
+        __region.changing(uint64_t(static_cast<const char*>(p) - __region.base()), n);
+    }
+
+
+    uint64_t __alloc_block(uint64_t size){
+        size = __align(std::max<uint64_t>(size, sizeof(__offset_block)));
+        uint64_t* link = &table()->free_blocks;
+        while (*link != 0){
+            auto* b = reinterpret_cast<__offset_block*>(__region.base() + *link);
+            if (b->size >= size){
+                uint64_t off = *link;
+                __changing(link, sizeof(*link));
+                if (b->size - size >= sizeof(__offset_block)){
+                    // the rest stays on the list, so an old bucket array is carved into nodes instead of serving one
+                    auto* rest = reinterpret_cast<__offset_block*>(__region.base() + off + size);
+                    __changing(rest, sizeof(*rest));
+                    rest->next = b->next;
+                    rest->size = b->size - size;
+                    *link = off + size;
+                }else{
+                    *link = b->next;
+                }
+                return off;
+            }
+            link = &b->next;
+        }
+        uint64_t off = table()->top;
+        __changing(table(), sizeof(__offset_table_header));
+        if (off + size > table()->bytes){
+            __region.grow(off + size);
+            table()->bytes = __region.mapped();
+        }
+        table()->top = off + size;
+        return off;
+    }
+
+
+    void __free_block(uint64_t off, uint64_t size) noexcept{
+        auto* b = reinterpret_cast<__offset_block*>(__region.base() + off);
+        __changing(b, sizeof(*b));
+        __changing(table(), sizeof(__offset_table_header));
+        b->size = __align(std::max<uint64_t>(size, sizeof(__offset_block)));
+        b->next = table()->free_blocks;
+        table()->free_blocks = off;
+    }
+
+
+    uint64_t __alloc_node(){
+        uint64_t off = table()->free_nodes;
+        if (off != 0){
+            __changing(table(), sizeof(__offset_table_header));
+            table()->free_nodes = at(off)->next;
+            return off;
+        }
+        return __alloc_block(sizeof(node));
+    }
+
+
+    void __link(uint64_t off, size_t fh) noexcept{
+        uint64_t b = __constrain_hash(fh, table()->buckets);
+        node* n = at(off);
+        __changing(&n->next, sizeof(n->next));
+        __changing(&__slots()[b], sizeof(uint64_t));
+        n->next = __slots()[b];
+        __slots()[b] = off;
+    }
+
+public:
+
+    __offset_hash_table(Region& region, size_t header_at, const Hash& hash = Hash(), const Cmp& cmp = Cmp()):
+        __region(region), __header_at(header_at), hash(hash), cmp(cmp){}
+
+
+    /*
+     initializes a table whose header is at header_at and whose arena spans [top, bytes) of the region
+     */
+    static void init(__offset_table_header* t, uint64_t top, uint64_t bytes) noexcept{
+        t->magic = magic;
+        t->key_size = sizeof(Key);
+        t->value_size = sizeof(T);
+        t->bytes = bytes;
+        t->top = __align(top);
+        t->free_nodes = 0;
+        t->free_blocks = 0;
+        t->array = 0;
+        t->buckets = 0;
+        t->count = 0;
+        t->max_load_factor = 1;
+    }
+
+
+    /*
+     checks that a region holds a table of this Key and T
+     */
+    static bool valid(const __offset_table_header* t) noexcept{
+        return t->magic == magic && t->key_size == sizeof(Key) && t->value_size == sizeof(T);
+    }
+
+
+    __offset_table_header* table() const noexcept{
+        return reinterpret_cast<__offset_table_header*>(__region.base() + __header_at);
+    }
+
+
+    node* at(uint64_t off) const noexcept{
+        return reinterpret_cast<node*>(__region.base() + off);
+    }
+
+
+    size_t hash_of(const Key& key) const{
+        return hash(key);
+    }
+
+
+    uint64_t find(const Key& key, size_t fh) const noexcept{
+        const __offset_table_header* t = table();
+        if (t->buckets == 0) return 0;
+        for (uint64_t off = __slots()[__constrain_hash(fh, t->buckets)]; off != 0; off = at(off)->next){
+            const node* n = at(off);
+            if (n->hash == fh && cmp(n->item.first, key)) return off;
+        }
+        return 0;
+    }
+
+
+    /*
+     lookup for readers that run concurrently with a writer: every offset is checked against the mapped size and the walk is bounded,
+     so a torn state can produce a wrong answer but never a wild read. The caller validates the answer with its own protocol.
+     */
+    bool read(const Key& key, size_t fh, T& out) const noexcept{
+        const __offset_table_header* t = table();
+        uint64_t mapped = __region.mapped();
+        uint64_t buckets = t->buckets, array = t->array, steps = t->count + 1;
+        if (buckets == 0 || array == 0 || array + buckets * sizeof(uint64_t) > mapped) return false;
+        uint64_t off;
+        memcpy(&off, __region.base() + array + __constrain_hash(fh, buckets) * sizeof(uint64_t), sizeof(off));
+        for (; off != 0 && steps-- > 0; off = at(off)->next){
+            if (off % 8 != 0 || off + sizeof(node) > mapped) return false;
+            const node* n = at(off);
+            if (n->hash == fh && cmp(n->item.first, key)){
+                memcpy(static_cast<void*>(&out), &n->item.second, sizeof(T));
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    void rehash(size_t buckets){
+        buckets = std::max<size_t>(1, buckets);
+        uint64_t fresh = __alloc_block(buckets * sizeof(uint64_t));
+        __changing(__region.base() + fresh, buckets * sizeof(uint64_t));
+        memset(__region.base() + fresh, 0, buckets * sizeof(uint64_t));
+
+        __offset_table_header* t = table();
+        __changing(t, sizeof(*t));
+        uint64_t old = t->array, old_buckets = t->buckets;
+        t->array = fresh;
+        t->buckets = buckets;
+        for (uint64_t b = 0; b < old_buckets; ++b){
+            uint64_t off = reinterpret_cast<uint64_t*>(__region.base() + old)[b];
+            while (off != 0){
+                uint64_t next = at(off)->next;
+                __link(off, at(off)->hash);
+                off = next;
+            }
+        }
+        if (old != 0)
+            __free_block(old, old_buckets * sizeof(uint64_t));
+    }
+
+
+    /*
+     inserts key with value, or assigns value when assign is set and the key is present. Returns the offset of the node and whether it was inserted.
+     */
+    std::pair<uint64_t, bool> insert(const Key& key, const T& value, bool assign){
+        size_t fh = hash(key);
+        if (uint64_t off = find(key, fh)){
+            if (assign){
+                __changing(&at(off)->item.second, sizeof(T));
+                at(off)->item.second = value;
+            }
+            return std::make_pair(off, false);
+        }
+        __offset_table_header* t = table();
+        if (t->buckets * t->max_load_factor < t->count + 1)
+            rehash(std::max<size_t>(2 * t->buckets, size_t(ceil(float(t->count + 1) / t->max_load_factor))));
+        uint64_t off = __alloc_node();
+        node* n = at(off);
+        __changing(n, sizeof(node));
+        n->hash = fh;
+        new (&n->item) std::pair<Key, T>(key, value);
+        __link(off, fh);
+        __changing(table(), sizeof(__offset_table_header));
+        ++table()->count;
+        return std::make_pair(off, true);
+    }
+
+
+    bool erase(const Key& key) noexcept{
+        size_t fh = hash(key);
+        __offset_table_header* t = table();
+        if (t->buckets == 0) return false;
+        uint64_t* link = &__slots()[__constrain_hash(fh, t->buckets)];
+        while (*link != 0){
+            node* n = at(*link);
+            if (n->hash == fh && cmp(n->item.first, key)){
+                uint64_t off = *link;
+                __changing(link, sizeof(*link));
+                __changing(&n->next, sizeof(n->next));
+                __changing(t, sizeof(*t));
+                *link = n->next;
+                n->next = t->free_nodes;
+                t->free_nodes = off;
+                --t->count;
+                return true;
+            }
+            link = &n->next;
+        }
+        return false;
+    }
+
+
+    void clear() noexcept{
+        __offset_table_header* t = table();
+        __changing(t, sizeof(*t));
+        if (t->buckets != 0) __changing(__slots(), t->buckets * sizeof(uint64_t));
+        for (uint64_t b = 0; b < t->buckets; ++b){
+            uint64_t off = __slots()[b];
+            while (off != 0){
+                uint64_t next = at(off)->next;
+                __changing(&at(off)->next, sizeof(uint64_t));
+                at(off)->next = t->free_nodes;
+                t->free_nodes = off;
+                off = next;
+            }
+            __slots()[b] = 0;
+        }
+        t->count = 0;
+    }
+
+
+    /*
+     calls f(const std::pair<Key, T>&) for every element
+     */
+    template<typename F>
+    void for_each(F&& f) const{
+        const __offset_table_header* t = table();
+        for (uint64_t b = 0; b < t->buckets; ++b)
+            for (uint64_t off = __slots()[b]; off != 0; off = at(off)->next)
+                f(at(off)->item);
+    }
+};
+
+#endif /* MyOffsetHashTable_hpp */
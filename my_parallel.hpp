@@ -0,0 +1,89 @@
+//
+//  my_parallel.hpp
+//  MySpace
+//
+
+#ifndef MyParallel_hpp
+#define MyParallel_hpp
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <exception>
+
+
+/**
+ @brief runs f(task, thread) for every task in [0, tasks) on up to threads threads. Tasks are handed out dynamically,
+        the calling thread takes part as thread 0, and the first exception thrown by a task is rethrown after all threads have joined.
+ @param size_t threads
+ @param size_t tasks
+ @param F f
+ */
+template<typename F>
+void my_parallel_for(size_t threads, size_t tasks, F f){
+    threads = std::max<size_t>(1, std::min(threads, tasks));
+    if (threads == 1){
+        for (size_t task = 0; task < tasks; ++task)
+            f(task, size_t(0));
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    auto worker = [&](size_t thread){
+        try{
+            for (size_t task = next++; task < tasks && !failed; task = next++)
+                f(task, thread);
+        }catch(...){
+            if (!failed.exchange(true))
+                error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    try{
+        for (size_t t = 1; t < threads; ++t)
+            pool.emplace_back(worker, t);
+    }catch(...){
+        failed = true;
+        for (auto& th : pool)
+            th.join();
+        throw;
+    }
+    worker(0);
+    for (auto& th : pool)
+        th.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+
+/**
+ @brief splits [0, n) into up to parts contiguous chunks of almost equal size and returns the bounds of chunk i
+ @param size_t n
+ @param size_t parts
+ @param size_t i
+ @returns std::pair<size_t, size_t>
+ */
+inline std::pair<size_t, size_t> my_chunk(size_t n, size_t parts, size_t i) noexcept{
+    return std::make_pair(n * i / parts, n * (i + 1) / parts);
+}
+
+
+/**
+ @brief prefetches the cache line holding p for reading
+ */
+inline void my_prefetch(const void* p) noexcept{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p, 0, 3);
+#else
+    (void)p;
+#endif
+}
+
+#endif /* MyParallel_hpp */
@@ -0,0 +1,580 @@
+//
+//  my_partitioned_map.hpp
+//  MySpace
+//
+
+#ifndef MyPartitionedMap_hpp
+#define MyPartitionedMap_hpp
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "my_unordered_map.hpp"
+#include "my_serialization.hpp"
+#include "my_radix_partitioner.hpp"
+
+
+/*
+ Wire format shared by PartitionServer and PartitionedMapClient. Every message is a frame: a 4-byte length in host byte order and the payload.
+ A request is an op byte, a varint count and count keys (get, erase) or key-value pairs (put), all in my_codec encoding.
+ The response to get is a varint count and for every key a byte 1 followed by the value, or a byte 0; put and erase answer with the varint number of inserted or erased keys.
+ Requests on one connection are answered in order, so a client may send several before reading the responses.
+ */
+enum class __partition_op : uint8_t{
+    get = 1,
+    put = 2,
+    erase = 3
+};
+
+constexpr size_t __max_frame = size_t(1) << 26;
+
+
+inline void __fd_write_all(int fd, const char* p, size_t n){
+    while (n > 0){
+        ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0){
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), "partitioned map: send");
+        }
+        p += w;
+        n -= size_t(w);
+    }
+}
+
+
+inline void __fd_read_all(int fd, char* p, size_t n){
+    while (n > 0){
+        ssize_t r = ::recv(fd, p, n, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0)
+            throw std::system_error(r < 0 ? errno : ECONNRESET, std::generic_category(), "partitioned map: recv");
+        p += r;
+        n -= size_t(r);
+    }
+}
+
+
+inline sockaddr_un __uds_address(const std::string& path){
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("partitioned map: socket path is too long: " + path);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+
+template<typename V>
+void __append_encoded(std::string& out, const V& v){
+    size_t old = out.size();
+    out.resize(old + my_codec<V>::size(v));
+    my_codec<V>::encode(v, &out[old]);
+}
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief PartitionServer hosts one shard of a partitioned map in a MyUnorderedMap and answers PartitionedMapClient requests on a Unix domain socket.
+        serve() is a single-threaded poll() loop over non-blocking connections: it reads whatever has arrived, answers every complete request frame
+        and buffers responses, so a client that pipelines requests never blocks the server. stop() may be called from another thread or a signal handler.
+ */
+class PartitionServer{
+    struct __connection{
+        int fd;
+        std::string in;
+        std::string out;
+        size_t sent = 0;
+    };
+
+    std::string __path;
+    int __listen = -1;
+    int __wake[2] = {-1, -1};
+    std::atomic<bool> __stopped{false};
+    MyUnorderedMap<Key, T, Hash, Cmp> __map;
+
+
+    void __handle(const char* p, const char* end, std::string& out){
+        uint64_t count;
+        __partition_op op = __partition_op(uint8_t(*p++));
+        p = my_varint_decode(p, end, count);
+
+        size_t at = out.size();
+        out.resize(at + 4);
+        uint64_t done = 0;
+        Key key;
+        switch (op){
+            case __partition_op::get:
+                __append_encoded(out, count);
+                for (uint64_t i = 0; i < count; ++i){
+                    p = my_codec<Key>::decode(p, end, key);
+                    auto it = __map.find(key);
+                    out.push_back(it != __map.end());
+                    if (it != __map.end())
+                        __append_encoded(out, it->second);
+                }
+                break;
+            case __partition_op::put:
+                for (uint64_t i = 0; i < count; ++i){
+                    T value;
+                    p = my_codec<Key>::decode(p, end, key);
+                    p = my_codec<T>::decode(p, end, value);
+                    done += __map.insert_or_assign(key, std::move(value)).second;
+                }
+                __append_encoded(out, done);
+                break;
+            case __partition_op::erase:
+                for (uint64_t i = 0; i < count; ++i){
+                    p = my_codec<Key>::decode(p, end, key);
+                    done += __map.erase(key);
+                }
+                __append_encoded(out, done);
+                break;
+            default:
+                throw std::out_of_range("PartitionServer: unknown request");
+        }
+        uint32_t len = uint32_t(out.size() - at - 4);
+        memcpy(&out[at], &len, 4);
+    }
+
+
+    // returns false when the connection has to be closed
+    bool __read(__connection& c){
+        char buf[1 << 16];
+        for (;;){
+            ssize_t r = ::recv(c.fd, buf, sizeof(buf), 0);
+            if (r > 0){
+                c.in.append(buf, size_t(r));
+                continue;
+            }
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        size_t pos = 0;
+        while (c.in.size() - pos >= 4){
+            uint32_t len;
+            memcpy(&len, c.in.data() + pos, 4);
+            if (len == 0 || len > __max_frame) return false;
+            if (c.in.size() - pos - 4 < len) break;
+            try{
+                __handle(c.in.data() + pos + 4, c.in.data() + pos + 4 + len, c.out);
+            }catch(const std::out_of_range&){
+                return false;
+            }
+            pos += 4 + len;
+        }
+        c.in.erase(0, pos);
+        return true;
+    }
+
+
+    bool __write(__connection& c){
+        while (c.sent < c.out.size()){
+            ssize_t w = ::send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+            if (w < 0){
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+                return false;
+            }
+            c.sent += size_t(w);
+        }
+        c.out.clear();
+        c.sent = 0;
+        return true;
+    }
+
+public:
+
+    /**
+     @brief creates the socket at path, replacing a stale one, and starts listening
+     @param const std::string& path
+     @exception std::system_error, std::invalid_argument
+     */
+    explicit PartitionServer(const std::string& path): __path(path){
+        sockaddr_un addr = __uds_address(path);
+        __listen = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (__listen < 0)
+            throw std::system_error(errno, std::generic_category(), "PartitionServer: socket");
+        ::unlink(path.c_str());
+        if (::bind(__listen, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(__listen, 64) < 0 ||
+            ::pipe2(__wake, O_CLOEXEC | O_NONBLOCK) < 0){
+            int err = errno;
+            ::close(__listen);
+            throw std::system_error(err, std::generic_category(), "PartitionServer: bind " + path);
+        }
+    }
+
+
+    PartitionServer(const PartitionServer&) = delete;
+    PartitionServer& operator=(const PartitionServer&) = delete;
+
+
+    /**
+     @brief returns the shard. Not synchronized with serve().
+     */
+    MyUnorderedMap<Key, T, Hash, Cmp>& map() noexcept{
+        return __map;
+    }
+
+
+    /**
+     @brief answers requests until stop() is called. Connections that send malformed frames are closed.
+     @exception std::system_error, std::bad_alloc()
+     */
+    void serve(){
+        std::vector<__connection> conns;
+        std::vector<pollfd> fds;
+        while (!__stopped.load(std::memory_order_acquire)){
+            fds.clear();
+            fds.push_back({__listen, POLLIN, 0});
+            fds.push_back({__wake[0], POLLIN, 0});
+            for (auto& c : conns)
+                fds.push_back({c.fd, short(POLLIN | (c.out.empty() ? 0 : POLLOUT)), 0});
+            if (::poll(fds.data(), fds.size(), -1) < 0){
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "PartitionServer: poll");
+            }
+
+            std::vector<__connection> alive;
+            alive.reserve(conns.size());
+            for (size_t i = 0; i < conns.size(); ++i){
+                short ev = fds[i + 2].revents;
+                bool ok = true;
+                if (ev & (POLLIN | POLLHUP | POLLERR)) ok = __read(conns[i]);
+                if (ok) ok = __write(conns[i]);
+                if (ok) alive.push_back(std::move(conns[i]));
+                else ::close(conns[i].fd);
+            }
+            conns.swap(alive);
+
+            if (fds[0].revents & POLLIN){
+                int fd;
+                while ((fd = ::accept4(__listen, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0)
+                    conns.push_back(__connection{fd, std::string(), std::string()});
+            }
+        }
+        for (auto& c : conns)
+            ::close(c.fd);
+    }
+
+
+    /**
+     @brief makes serve() return. Safe to call from another thread or a signal handler.
+     */
+    void stop() noexcept{
+        __stopped.store(true, std::memory_order_release);
+        char b = 1;
+        ssize_t r = ::write(__wake[1], &b, 1);
+        (void)r;
+    }
+
+
+    ~PartitionServer(){
+        ::close(__listen);
+        ::close(__wake[0]);
+        ::close(__wake[1]);
+        ::unlink(__path.c_str());
+    }
+};
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key> >
+
+/**!
+ @brief PartitionedMapClient routes keys to PartitionServer processes with rendezvous hashing: a key goes to the server with the highest mixed hash of
+        the key's hash and the server's id, which is derived from its socket path. Adding or removing a server moves only the keys that it wins or loses.
+        Multi-key operations group keys by server, cut each group into batches of one request frame and keep up to window requests in flight per connection.
+        A call that fails leaves responses in flight, so it drops every connection and the next call connects again; the requests of the failed call
+        may or may not have been applied. A client is not thread-safe; use one per thread.
+ */
+class PartitionedMapClient{
+    std::vector<std::string> __paths;
+    std::vector<int> __fds;         // -1 after a failed call
+    std::vector<uint64_t> __ids;
+    Hash hash;
+    size_t __batch;
+    size_t __window;
+
+
+    static uint64_t __server_id(const std::string& path) noexcept{
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (unsigned char c : path){
+            h ^= c;
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+
+    static int __connect(const std::string& path){
+        sockaddr_un addr = __uds_address(path);
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0){
+            int err = errno;
+            if (fd >= 0) ::close(fd);
+            throw std::system_error(err, std::generic_category(), "PartitionedMapClient: connect " + path);
+        }
+        return fd;
+    }
+
+
+    /*
+     sends the items of every server in batches, with at most __window batches in flight per server.
+     encode(server, first, last, out) appends the request payload for group[first, last); decode(server, first, last, p, end) reads its response.
+     */
+    template<typename Encode, typename Decode>
+    void __exchange(const std::vector<std::vector<size_t> >& groups, Encode encode, Decode decode){
+        size_t servers = __fds.size();
+        std::vector<size_t> sent(servers, 0), received(servers, 0), batches(servers);
+        for (size_t s = 0; s < servers; ++s){
+            batches[s] = (groups[s].size() + __batch - 1) / __batch;
+            if (__fds[s] < 0 && batches[s] > 0) __fds[s] = __connect(__paths[s]);
+        }
+
+        try{
+            __exchange_batches(groups, encode, decode, sent, received, batches);
+        }catch(...){
+            // the streams may be in the middle of a frame or hold responses to this call, which the next call would take for its own
+            for (int& fd : __fds){
+                if (fd >= 0) ::close(fd);
+                fd = -1;
+            }
+            throw;
+        }
+    }
+
+
+    template<typename Encode, typename Decode>
+    void __exchange_batches(const std::vector<std::vector<size_t> >& groups, Encode& encode, Decode& decode,
+                            std::vector<size_t>& sent, std::vector<size_t>& received, const std::vector<size_t>& batches){
+        size_t servers = __fds.size();
+        std::string frame, response;
+        for (;;){
+            for (size_t s = 0; s < servers; ++s){
+                for (; sent[s] < batches[s] && sent[s] - received[s] < __window; ++sent[s]){
+                    size_t first = sent[s] * __batch, last = std::min(groups[s].size(), first + __batch);
+                    frame.assign(4, '\0');
+                    encode(s, first, last, frame);
+                    uint32_t len = uint32_t(frame.size() - 4);
+                    memcpy(&frame[0], &len, 4);
+                    __fd_write_all(__fds[s], frame.data(), frame.size());
+                }
+            }
+            bool waiting = false;
+            for (size_t s = 0; s < servers; ++s){
+                if (received[s] == sent[s]) continue;
+                waiting = true;
+                uint32_t len;
+                __fd_read_all(__fds[s], reinterpret_cast<char*>(&len), 4);
+                if (len > __max_frame)
+                    throw std::out_of_range("PartitionedMapClient: response frame is too large");
+                response.resize(len);
+                __fd_read_all(__fds[s], &response[0], len);
+                size_t first = received[s] * __batch, last = std::min(groups[s].size(), first + __batch);
+                decode(s, first, last, response.data(), response.data() + len);
+                ++received[s];
+            }
+            if (!waiting) break;
+        }
+    }
+
+
+    template<typename KeyOf>
+    std::vector<std::vector<size_t> > __group(size_t n, KeyOf key_of) const{
+        std::vector<std::vector<size_t> > groups(__fds.size());
+        for (size_t i = 0; i < n; ++i)
+            groups[server_of(key_of(i))].push_back(i);
+        return groups;
+    }
+
+
+    static void __header(std::string& out, __partition_op op, size_t count){
+        out.push_back(char(op));
+        __append_encoded(out, uint64_t(count));
+    }
+
+
+    // the number of keys of a put or erase request of requested keys that changed something
+    static size_t __count_response(const char* p, const char* end, size_t requested){
+        uint64_t n;
+        p = my_varint_decode(p, end, n);
+        if (n > requested || p != end)
+            throw std::out_of_range("PartitionedMapClient: response does not match the request");
+        return size_t(n);
+    }
+
+public:
+
+    /**
+     @brief connects to the servers listening on paths
+     @param const std::vector<std::string>& paths
+     @param size_t batch, keys per request frame
+     @param size_t window, requests in flight per server
+     @exception std::system_error, std::invalid_argument
+     */
+    explicit PartitionedMapClient(const std::vector<std::string>& paths, size_t batch = 512, size_t window = 8):
+        __batch(std::max<size_t>(1, batch)), __window(std::max<size_t>(1, window)){
+        if (paths.empty())
+            throw std::invalid_argument("PartitionedMapClient: no servers");
+        for (auto& path : paths){
+            try{
+                __fds.push_back(__connect(path));
+            }catch(...){
+                for (int f : __fds) ::close(f);
+                throw;
+            }
+            __paths.push_back(path);
+            __ids.push_back(__server_id(path));
+        }
+    }
+
+
+    PartitionedMapClient(const PartitionedMapClient&) = delete;
+    PartitionedMapClient& operator=(const PartitionedMapClient&) = delete;
+
+
+    /**
+     @brief returns the index of the server that owns key
+     @param const Key& key
+     @returns size_t
+     */
+    size_t server_of(const Key& key) const{
+        size_t h = hash(key), best = 0, best_score = 0;
+        for (size_t s = 0; s < __ids.size(); ++s){
+            size_t score = __mix_hash(h ^ size_t(__ids[s]));
+            if (s == 0 || score > best_score){
+                best = s;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+
+
+    /**
+     @brief looks up keys on their servers
+     @param const std::vector<Key>& keys
+     @returns std::vector<std::optional<T>>, in the order of keys
+     @exception std::system_error, std::out_of_range on a malformed response, std::bad_alloc()
+     */
+    std::vector<std::optional<T> > multi_get(const std::vector<Key>& keys){
+        std::vector<std::optional<T> > res(keys.size());
+        auto groups = __group(keys.size(), [&](size_t i) -> const Key& { return keys[i]; });
+        __exchange(groups, [&](size_t s, size_t first, size_t last, std::string& out){
+            __header(out, __partition_op::get, last - first);
+            for (size_t i = first; i < last; ++i)
+                __append_encoded(out, keys[groups[s][i]]);
+        }, [&](size_t s, size_t first, size_t last, const char* p, const char* end){
+            uint64_t n;
+            p = my_varint_decode(p, end, n);
+            if (n != last - first)
+                throw std::out_of_range("PartitionedMapClient: response does not match the request");
+            for (size_t i = first; i < last; ++i){
+                if (p == end)
+                    throw std::out_of_range("PartitionedMapClient: truncated response");
+                if (*p++ == 0) continue;
+                T value;
+                p = my_codec<T>::decode(p, end, value);
+                res[groups[s][i]] = std::move(value);
+            }
+            if (p != end)
+                throw std::out_of_range("PartitionedMapClient: response does not match the request");
+        });
+        return res;
+    }
+
+
+    /**
+     @brief inserts or assigns items on their servers
+     @param const std::vector<std::pair<Key, T>>& items
+     @returns size_t, the number of keys that were not present before
+     @exception std::system_error, std::out_of_range, std::bad_alloc()
+     */
+    size_t multi_put(const std::vector<std::pair<Key, T> >& items){
+        size_t inserted = 0;
+        auto groups = __group(items.size(), [&](size_t i) -> const Key& { return items[i].first; });
+        __exchange(groups, [&](size_t s, size_t first, size_t last, std::string& out){
+            __header(out, __partition_op::put, last - first);
+            for (size_t i = first; i < last; ++i){
+                __append_encoded(out, items[groups[s][i]].first);
+                __append_encoded(out, items[groups[s][i]].second);
+            }
+        }, [&](size_t, size_t first, size_t last, const char* p, const char* end){
+            inserted += __count_response(p, end, last - first);
+        });
+        return inserted;
+    }
+
+
+    /**
+     @brief erases keys on their servers
+     @param const std::vector<Key>& keys
+     @returns size_t, the number of erased keys
+     @exception std::system_error, std::out_of_range, std::bad_alloc()
+     */
+    size_t multi_erase(const std::vector<Key>& keys){
+        size_t erased = 0;
+        auto groups = __group(keys.size(), [&](size_t i) -> const Key& { return keys[i]; });
+        __exchange(groups, [&](size_t s, size_t first, size_t last, std::string& out){
+            __header(out, __partition_op::erase, last - first);
+            for (size_t i = first; i < last; ++i)
+                __append_encoded(out, keys[groups[s][i]]);
+        }, [&](size_t, size_t first, size_t last, const char* p, const char* end){
+            erased += __count_response(p, end, last - first);
+        });
+        return erased;
+    }
+
+
+    std::optional<T> get(const Key& key){
+        return multi_get(std::vector<Key>{key})[0];
+    }
+
+
+    bool put(const Key& key, const T& value){
+        return multi_put(std::vector<std::pair<Key, T> >{std::make_pair(key, value)}) == 1;
+    }
+
+
+    bool erase(const Key& key){
+        return multi_erase(std::vector<Key>{key}) == 1;
+    }
+
+
+    /**
+     @brief returns the number of servers
+     */
+    size_t servers() const noexcept{
+        return __fds.size();
+    }
+
+
+    ~PartitionedMapClient(){
+        for (int fd : __fds)
+            if (fd >= 0) ::close(fd);
+    }
+};
+
+#endif /* MyPartitionedMap_hpp */
@@ -0,0 +1,440 @@
+//
+//  my_persistent_map.hpp
+//  MySpace
+//
+
+#ifndef MyPersistentMap_hpp
+#define MyPersistentMap_hpp
+
+#include <new>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "my_offset_hash_table.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MyPersistentMap is a hash map whose live state is a memory-mapped file: nodes and the bucket array are allocated from an arena in the file
+        and linked by offsets, so reopening the file maps it and is ready, with no load phase. The file grows by doubling when the arena is full.
+        The mapping is private, so changes stay in memory, page by page, until sync() writes the changed pages to a redo log next to the file
+        (path + ".log"), commits it and only then copies them into the file. The file therefore always holds the state of the last sync():
+        opening it replays a committed log, and a crash before the commit loses the changes since that sync(), which opening reports with was_clean() false.
+        The file is locked, so only one MyPersistentMap uses it at a time. Hash must not change between runs, and Key and T must be trivially copyable.
+ */
+class MyPersistentMap{
+    struct __region{
+        int __fd = -1;
+        char* __base = nullptr;
+        size_t __size = 0;
+        std::vector<uint64_t> __changed;        // a bit for every page written since the last sync()
+
+        char* base() const noexcept{
+            return __base;
+        }
+
+        size_t mapped() const noexcept{
+            return __size;
+        }
+
+        void changing(uint64_t off, size_t bytes) noexcept{
+            for (uint64_t page = off / 4096, last = (off + bytes - 1) / 4096; page <= last; ++page)
+                __changed[page / 64] |= uint64_t(1) << (page % 64);
+        }
+
+        void grow(size_t bytes){
+            size_t size = std::max(bytes, 2 * __size);
+            size = (size + 4095) & ~size_t(4095);
+            __changed.resize((size / 4096 + 63) / 64, 0);
+            if (::ftruncate(__fd, off_t(size)) < 0)
+                throw std::bad_alloc();
+#ifdef __linux__
+            void* p = ::mremap(__base, __size, size, MREMAP_MAYMOVE);
+#else
+            // a new private mapping shows the file, so the changed pages move over by hand
+            void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, __fd, 0);
+            if (p != MAP_FAILED){
+                for (size_t page = 0; page < __size / 4096; ++page)
+                    if (__changed[page / 64] >> (page % 64) & 1)
+                        memcpy(static_cast<char*>(p) + page * 4096, __base + page * 4096, 4096);
+                ::munmap(__base, __size);
+            }
+#endif
+            if (p == MAP_FAILED)
+                throw std::bad_alloc();
+            __base = static_cast<char*>(p);
+            __size = size;
+        }
+    };
+
+    struct __header{
+        uint64_t clean;         // 0 in the file from the first change after a sync() until the next one
+        __offset_table_header table;
+    };
+
+    // the redo log holds this header, written last, then count records of a page number and the page
+    struct __log_header{
+        uint64_t magic;
+        uint64_t count;
+        uint64_t file_size;
+    };
+
+    static constexpr uint64_t __log_magic = 0x4d59504d41504c47ull;
+    static constexpr size_t __log_record = sizeof(uint64_t) + 4096;
+
+    using table_type = __offset_hash_table<Key, T, Hash, Cmp, __region>;
+
+    std::string __path;
+    __region __r;
+    int __log = -1;
+    table_type __table;
+    bool __was_clean = true;
+
+
+    __header* __h() const noexcept{
+        return reinterpret_cast<__header*>(__r.__base);
+    }
+
+
+    // the first change after a sync() clears the flag in the file, so a crash that loses the changes is reported on the next open
+    void __touch(){
+        if (!__h()->clean) return;
+        __r.changing(0, sizeof(uint64_t));
+        __h()->clean = 0;
+        uint64_t zero = 0;
+        if (::pwrite(__r.__fd, &zero, sizeof(zero), 0) != ssize_t(sizeof(zero)) || ::fdatasync(__r.__fd) < 0){
+            int err = errno;
+            __h()->clean = 1;
+            throw std::system_error(err, std::generic_category(), "MyPersistentMap: mark dirty " + __path);
+        }
+    }
+
+
+    static void __write_all(int fd, const void* data, size_t n, uint64_t at, const std::string& what){
+        const char* p = static_cast<const char*>(data);
+        while (n > 0){
+            ssize_t w = ::pwrite(fd, p, n, off_t(at));
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0)
+                throw std::system_error(errno, std::generic_category(), "MyPersistentMap: write " + what);
+            p += w;
+            n -= size_t(w);
+            at += uint64_t(w);
+        }
+    }
+
+
+    static bool __read_all(int fd, void* data, size_t n, uint64_t at){
+        char* p = static_cast<char*>(data);
+        while (n > 0){
+            ssize_t r = ::pread(fd, p, n, off_t(at));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            n -= size_t(r);
+            at += uint64_t(r);
+        }
+        return true;
+    }
+
+
+    // copies the pages of a committed log into the file, which then holds the state of the sync() that wrote the log
+    void __replay(){
+        __log_header lh;
+        if (!__read_all(__log, &lh, sizeof(lh), 0) || lh.magic != __log_magic) return;
+        struct stat st;
+        if (::fstat(__r.__fd, &st) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: fstat " + __path);
+        if (uint64_t(st.st_size) < lh.file_size && ::ftruncate(__r.__fd, off_t(lh.file_size)) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: size " + __path);
+        std::vector<char> record(__log_record);
+        for (uint64_t i = 0; i < lh.count; ++i){
+            uint64_t page = 0;
+            if (__read_all(__log, record.data(), __log_record, 4096 + i * __log_record))
+                memcpy(&page, record.data(), sizeof(page));
+            else
+                page = lh.file_size;
+            if ((page + 1) * 4096 > lh.file_size)
+                throw std::invalid_argument("MyPersistentMap: " + __path + ".log is corrupt");
+            __write_all(__r.__fd, record.data() + sizeof(page), 4096, page * 4096, __path);
+        }
+        if (::fdatasync(__r.__fd) < 0 || ::ftruncate(__log, 0) < 0 || ::fdatasync(__log) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: replay " + __path + ".log");
+    }
+
+
+    void __close() noexcept{
+        if (__r.__base) ::munmap(__r.__base, __r.__size);
+        if (__log >= 0) ::close(__log);
+        if (__r.__fd >= 0) ::close(__r.__fd);
+        __r.__base = nullptr;
+        __r.__fd = __log = -1;
+    }
+
+public:
+
+    /**
+     @brief opens the map in the file path, or creates the file with an empty map
+     @param const std::string& path
+     @param size_t initial, the size of a new file
+     @exception std::system_error, also when another MyPersistentMap has the file open, std::invalid_argument when the file holds no map of this Key and T
+     */
+    explicit MyPersistentMap(const std::string& path, size_t initial = size_t(1) << 20): __path(path), __table(__r, offsetof(__header, table)){
+        __r.__fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (__r.__fd < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: open " + path);
+        struct stat st;
+        if (::flock(__r.__fd, LOCK_EX | LOCK_NB) < 0){
+            int err = errno;
+            __close();
+            throw std::system_error(err, std::generic_category(), "MyPersistentMap: lock " + path);
+        }
+        __log = ::open((path + ".log").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        try{
+            if (__log < 0)
+                throw std::system_error(errno, std::generic_category(), "MyPersistentMap: open " + path + ".log");
+            __replay();
+            if (::fstat(__r.__fd, &st) < 0)
+                throw std::system_error(errno, std::generic_category(), "MyPersistentMap: fstat " + path);
+        }catch(...){
+            __close();
+            throw;
+        }
+
+        bool fresh = st.st_size == 0;
+        size_t size = fresh ? std::max<size_t>((initial + 4095) & ~size_t(4095), 4096) : size_t(st.st_size);
+        if ((fresh && ::ftruncate(__r.__fd, off_t(size)) < 0) || size < sizeof(__header)){
+            int err = fresh ? errno : EINVAL;
+            __close();
+            throw std::system_error(err, std::generic_category(), "MyPersistentMap: size " + path);
+        }
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, __r.__fd, 0);
+        if (p == MAP_FAILED){
+            int err = errno;
+            __close();
+            throw std::system_error(err, std::generic_category(), "MyPersistentMap: mmap " + path);
+        }
+        __r.__base = static_cast<char*>(p);
+        __r.__size = size;
+        __r.__changed.assign((size / 4096 + 63) / 64, 0);
+
+        if (fresh){
+            __r.changing(0, sizeof(__header));
+            __h()->clean = 1;
+            table_type::init(&__h()->table, sizeof(__header), size);
+            try{
+                sync();
+            }catch(...){
+                __close();
+                throw;
+            }
+        }else if (!table_type::valid(&__h()->table) || __h()->table.bytes > size){
+            __close();
+            throw std::invalid_argument("MyPersistentMap: " + path + " holds no map of this type");
+        }
+        __was_clean = __h()->clean != 0;
+    }
+
+
+    MyPersistentMap(const MyPersistentMap&) = delete;
+    MyPersistentMap& operator=(const MyPersistentMap&) = delete;
+
+
+    /**
+     @brief returns false if the map was changed after the last sync() of the file and never synced or closed, so those changes were lost on opening
+     */
+    bool was_clean() const noexcept{
+        return __was_clean;
+    }
+
+
+    /**
+     @brief inserts the element if there is no element with an equivalent key
+     @returns bool, true if inserted
+     @exception std::bad_alloc() when the file cannot grow, std::system_error when the file cannot be marked changed
+     */
+    bool insert(const Key& key, const T& value){
+        __touch();
+        return __table.insert(key, value, false).second;
+    }
+
+
+    /**
+     @brief inserts the element or assigns value to the existing one
+     @returns bool, true if inserted
+     @exception std::bad_alloc() when the file cannot grow, std::system_error when the file cannot be marked changed
+     */
+    bool insert_or_assign(const Key& key, const T& value){
+        __touch();
+        return __table.insert(key, value, true).second;
+    }
+
+
+    /**
+     @brief erases the element with key
+     @returns bool, true if erased
+     @exception std::system_error when the file cannot be marked changed
+     */
+    bool erase(const Key& key){
+        __touch();
+        return __table.erase(key);
+    }
+
+
+    /**
+     @brief erases all elements
+     @exception std::system_error when the file cannot be marked changed
+     */
+    void clear(){
+        __touch();
+        __table.clear();
+    }
+
+
+    /**
+     @brief makes room for count elements without rehashing
+     @param size_t count
+     @exception std::bad_alloc(), std::system_error
+     */
+    void reserve(size_t count){
+        const __offset_table_header* t = __table.table();
+        if (t->buckets * t->max_load_factor < count){
+            __touch();
+            __table.rehash(size_t(ceil(float(count) / t->max_load_factor)));
+        }
+    }
+
+
+    /**
+     @brief returns a pointer to the value of key or nullptr. The pointer is valid until the next change of the map.
+     @param const Key& key
+     @returns const T*
+     */
+    const T* find(const Key& key) const noexcept{
+        uint64_t off = __table.find(key, __table.hash_of(key));
+        return off ? &__table.at(off)->item.second : nullptr;
+    }
+
+
+    std::optional<T> get(const Key& key) const{
+        const T* p = find(key);
+        if (p) return *p;
+        return std::nullopt;
+    }
+
+
+    bool contains(const Key& key) const noexcept{
+        return find(key) != nullptr;
+    }
+
+
+    /**
+     @brief calls f(const std::pair<Key, T>&) for every element
+     */
+    template<typename F>
+    void for_each(F&& f) const{
+        __table.for_each(f);
+    }
+
+
+    /**
+     @brief returns the number of elements
+     */
+    size_t count() const noexcept{
+        return size_t(__h()->table.count);
+    }
+
+
+    bool empty() const noexcept{
+        return count() == 0;
+    }
+
+
+    /**
+     @brief returns the size of the file
+     */
+    size_t file_size() const noexcept{
+        return __r.__size;
+    }
+
+
+    /**
+     @brief makes the current state the one the file is opened with: writes the pages changed since the last sync() to the log and waits for the device,
+        commits the log, copies the pages into the file and waits again. Pointers returned by find() stay valid.
+     @exception std::system_error, std::bad_alloc()
+     */
+    void sync(){
+        if (!__h()->clean){
+            __r.changing(0, sizeof(uint64_t));
+            __h()->clean = 1;
+        }
+        std::vector<uint64_t> pages;
+        for (size_t w = 0; w < __r.__changed.size(); ++w)
+            for (uint64_t bits = __r.__changed[w]; bits != 0; bits &= bits - 1)
+                pages.push_back(w * 64 + uint64_t(__builtin_ctzll(bits)));
+        if (pages.empty()) return;
+
+        std::string log = __path + ".log";
+        std::vector<char> buf;
+        for (size_t i = 0; i < pages.size(); ++i){
+            size_t at = buf.size();
+            buf.resize(at + __log_record);
+            memcpy(&buf[at], &pages[i], sizeof(uint64_t));
+            memcpy(&buf[at + sizeof(uint64_t)], __r.__base + pages[i] * 4096, 4096);
+            if (buf.size() >= (size_t(1) << 20) || i + 1 == pages.size()){
+                __write_all(__log, buf.data(), buf.size(), 4096 + (i + 1) * __log_record - buf.size(), log);
+                buf.clear();
+            }
+        }
+        if (::fdatasync(__log) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: sync " + log);
+        __log_header lh{__log_magic, pages.size(), __r.__size};
+        __write_all(__log, &lh, sizeof(lh), 0, log);
+        if (::fdatasync(__log) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: sync " + log);
+
+        for (uint64_t page : pages)
+            __write_all(__r.__fd, __r.__base + page * 4096, 4096, page * 4096, __path);
+        if (::fdatasync(__r.__fd) < 0 || ::ftruncate(__log, 0) < 0)
+            throw std::system_error(errno, std::generic_category(), "MyPersistentMap: sync " + __path);
+        std::fill(__r.__changed.begin(), __r.__changed.end(), 0);
+#ifdef __linux__
+        // the file now matches memory, so the private copies can go: the pages are read from the file again when touched
+        for (uint64_t page : pages)
+            ::madvise(__r.__base + page * 4096, 4096, MADV_DONTNEED);
+#endif
+    }
+
+
+    /**
+     @brief syncs and closes the file; the empty log is removed
+     */
+    ~MyPersistentMap(){
+        try{
+            sync();
+            ::unlink((__path + ".log").c_str());
+        }catch(...){}
+        __close();
+    }
+};
+
+#endif /* MyPersistentMap_hpp */
@@ -0,0 +1,246 @@
+//
+//  my_radix_partitioner.hpp
+//  MySpace
+//
+
+#ifndef MyRadixPartitioner_hpp
+#define MyRadixPartitioner_hpp
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#include "my_unordered_map.hpp"
+#include "my_parallel.hpp"
+
+
+/**
+ @brief scrambles a hash so that its high bits depend on all input bits. Identity hashes such as std::hash<int> keep every high bit zero for small keys.
+ @param size_t h
+ @returns size_t
+ */
+inline size_t __mix_hash(size_t h) noexcept{
+    uint64_t x = h;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return size_t(x);
+}
+
+
+/**!
+ @brief MyRadixPartitioner splits n elements into 2^bits partitions by their hash with a two-pass histogram and scatter.
+        In bucket-aligned mode partition p holds exactly the elements that a map with the given number of buckets puts into the bucket range bucket_range(p),
+        using the same reduction as MyUnorderedMap, so a partition can be merged into, compared with or built as a contiguous range of buckets.
+        Without a bucket count partitions are taken from the high bits of the mixed hash.
+        The scatter goes through one cache line of write-combining buffer per partition and thread, and full lines of trivially copyable elements
+        are written with non-temporal stores where the target supports them, so the output does not evict the working set.
+        Only whole, aligned cache lines of the output are streamed; the first and last partial line of each partition and thread get normal stores.
+ */
+class MyRadixPartitioner{
+    size_t __bits;
+    size_t __threads;
+    size_t __buckets;
+    size_t __width;
+
+
+    /*
+     copies count elements to dst. Only the cache lines that lie wholly inside the destination are written with non-temporal stores:
+     the partial lines at either end may be shared with the range of another partition or thread and are written with normal stores
+     */
+    template<typename T>
+    static void __flush(T* dst, const T* src, size_t count) noexcept{
+        if constexpr (std::is_trivially_copyable<T>::value){
+#if defined(__SSE2__) && defined(__x86_64__)
+            char* d = reinterpret_cast<char*>(dst);
+            const char* s = reinterpret_cast<const char*>(src);
+            size_t bytes = count * sizeof(T);
+            size_t head = std::min(bytes, size_t(-reinterpret_cast<uintptr_t>(d) & 63));
+            size_t lines = (bytes - head) / 64;
+            memcpy(d, s, head);
+            for (size_t i = 0; i < lines * 8; ++i){
+                long long w;
+                memcpy(&w, s + head + i * 8, 8);
+                _mm_stream_si64(reinterpret_cast<long long*>(d + head) + i, w);
+            }
+            memcpy(d + head + lines * 64, s + head + lines * 64, bytes - head - lines * 64);
+#else
+            memcpy(static_cast<void*>(dst), src, count * sizeof(T));
+#endif
+        }else{
+            for (size_t i = 0; i < count; ++i)
+                dst[i] = src[i];
+        }
+    }
+
+
+    // the number of elements to buffer before the next flush to dst: fewer than a line when that brings dst to a cache line boundary, so the lines after it are streamed whole
+    template<typename T>
+    static size_t __line_fill(const T* dst, size_t wc) noexcept{
+        size_t gap = size_t(-reinterpret_cast<uintptr_t>(dst) & 63);
+        return gap != 0 && gap % sizeof(T) == 0 && gap / sizeof(T) < wc ? gap / sizeof(T) : wc;
+    }
+
+
+    static void __fence() noexcept{
+#if defined(__SSE2__) && defined(__x86_64__)
+        _mm_sfence();
+#endif
+    }
+
+public:
+
+    /**
+     @brief constructs a partitioner into 2^bits partitions
+     @param size_t bits, at most 16
+     @param size_t threads
+     @param size_t buckets, the bucket count to align partitions with, or 0 to use the high bits of the mixed hash
+     @exception std::out_of_range
+     */
+    explicit MyRadixPartitioner(size_t bits, size_t threads = 1, size_t buckets = 0):
+        __bits(bits), __threads(std::max<size_t>(1, threads)), __buckets(buckets){
+        if (bits > 16)
+            throw std::out_of_range("MyRadixPartitioner: at most 2^16 partitions are supported");
+        __width = buckets == 0 ? 0 : (buckets + partitions() - 1) / partitions();
+    }
+
+
+    /**
+     @brief constructs a partitioner whose partitions are ranges of the buckets of map
+     @param const MyUnorderedMap<Key, T, H, C, A>& map
+     @param size_t bits
+     @param size_t threads
+     @returns MyRadixPartitioner
+     */
+    template<typename Key, typename T, typename H, typename C, typename A>
+    static MyRadixPartitioner for_map(const MyUnorderedMap<Key, T, H, C, A>& map, size_t bits, size_t threads = 1){
+        return MyRadixPartitioner(bits, threads, std::max<size_t>(1, map.size()));
+    }
+
+
+    /**
+     @brief returns the number of partitions
+     */
+    size_t partitions() const noexcept{
+        return size_t(1) << __bits;
+    }
+
+
+    /**
+     @brief returns the partition of an element with full hash h
+     @param size_t h
+     @returns size_t
+     */
+    size_t partition_of(size_t h) const noexcept{
+        if (__buckets != 0)
+            return __constrain_hash(h, __buckets) / __width;
+        return __bits == 0 ? 0 : __mix_hash(h) >> (sizeof(size_t) * 8 - __bits);
+    }
+
+
+    /**
+     @brief returns the range of buckets covered by partition p in bucket-aligned mode
+     @param size_t p
+     @returns std::pair<size_t, size_t>
+     */
+    std::pair<size_t, size_t> bucket_range(size_t p) const noexcept{
+        return std::make_pair(std::min(p * __width, __buckets), std::min((p + 1) * __width, __buckets));
+    }
+
+
+    /**
+     @brief partitions the elements elem_of(0) .. elem_of(n - 1) into out, which must have room for n elements.
+        The first pass computes hash_of(i) for every element and builds per-thread histograms, the second scatters the elements.
+        Within a partition elements keep their input order.
+     @param size_t n
+     @param ElemFn elem_of, returns the i-th element; called concurrently
+     @param HashFn hash_of, returns the full hash of the i-th element; called concurrently
+     @param T* out
+     @returns std::vector<size_t>, partitions() + 1 offsets of the partitions in out
+     @exception std::bad_alloc();
+     */
+    template<typename T, typename ElemFn, typename HashFn>
+    std::vector<size_t> scatter(size_t n, ElemFn elem_of, HashFn hash_of, T* out) const{
+        size_t parts = partitions();
+        size_t threads = std::max<size_t>(1, std::min(__threads, n));
+        constexpr size_t wc = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+        std::vector<uint16_t> part(n);
+        std::vector<size_t> hist(threads * parts, 0);
+        my_parallel_for(threads, threads, [&](size_t chunk, size_t){
+            auto [lo, hi] = my_chunk(n, threads, chunk);
+            size_t* h = hist.data() + chunk * parts;
+            for (size_t i = lo; i < hi; ++i){
+                part[i] = uint16_t(partition_of(hash_of(i)));
+                ++h[part[i]];
+            }
+        });
+
+        std::vector<size_t> offsets(parts + 1, 0);
+        for (size_t p = 0, sum = 0; p < parts; ++p){
+            offsets[p] = sum;
+            for (size_t t = 0; t < threads; ++t){
+                size_t c = hist[t * parts + p];
+                hist[t * parts + p] = sum;
+                sum += c;
+            }
+        }
+        offsets[parts] = n;
+
+        my_parallel_for(threads, threads, [&](size_t chunk, size_t){
+            auto [lo, hi] = my_chunk(n, threads, chunk);
+            size_t* dst = hist.data() + chunk * parts;
+            struct alignas(64) line{
+                T items[wc];
+            };
+            std::vector<line> buf(parts);
+            std::vector<uint8_t> fill(parts, 0);
+            std::vector<uint8_t> limit(parts);
+            for (size_t p = 0; p < parts; ++p)
+                limit[p] = uint8_t(__line_fill(out + dst[p], wc));
+            for (size_t i = lo; i < hi; ++i){
+                size_t p = part[i];
+                buf[p].items[fill[p]] = elem_of(i);
+                if (++fill[p] == limit[p]){
+                    __flush(out + dst[p], buf[p].items, fill[p]);
+                    dst[p] += fill[p];
+                    fill[p] = 0;
+                    limit[p] = uint8_t(__line_fill(out + dst[p], wc));
+                }
+            }
+            for (size_t p = 0; p < parts; ++p){
+                if (fill[p] == 0) continue;
+                __flush(out + dst[p], buf[p].items, fill[p]);
+                dst[p] += fill[p];
+            }
+            __fence();
+        });
+        return offsets;
+    }
+
+
+    /**
+     @brief partitions the array [in, in + n) into out, which must have room for n elements
+     @param const T* in
+     @param size_t n
+     @param T* out
+     @param HashOf hash_of, returns the full hash of an element; called concurrently
+     @returns std::vector<size_t>, partitions() + 1 offsets of the partitions in out
+     @exception std::bad_alloc();
+     */
+    template<typename T, typename HashOf>
+    std::vector<size_t> partition(const T* in, size_t n, T* out, HashOf hash_of) const{
+        return scatter(n, [in](size_t i) -> const T& { return in[i]; }, [in, &hash_of](size_t i){ return hash_of(in[i]); }, out);
+    }
+};
+
+#endif /* MyRadixPartitioner_hpp */
@@ -0,0 +1,244 @@
+//
+//  my_replication.hpp
+//  MySpace
+//
+
+#ifndef MyReplication_hpp
+#define MyReplication_hpp
+
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "my_unordered_map.hpp"
+#include "my_serialization.hpp"
+#include "my_spsc_ring.hpp"
+
+
+/**
+ @brief kinds of records in a change stream
+ */
+enum class MapEvent : uint8_t{
+    insert = 1,
+    assign = 2,
+    erase = 3,
+    clear = 4
+};
+
+
+template <typename Key, typename T>
+
+/**!
+ @brief MapChangeWriter is a listener that encodes every mutation of the map it is attached to as one record of a MySpscRing:
+        the event kind, a varint sequence number and the key and value in my_codec encoding.
+        The writer never blocks the map. When the ring is full the event is dropped and counted, but its sequence number is still consumed,
+        so the reader sees the gap and knows it has to bootstrap again from a snapshot.
+ */
+class MapChangeWriter: public MyMapListener<Key, T>{
+    MySpscRing& __ring;
+    uint64_t __seq = 0;
+    uint64_t __dropped = 0;
+
+
+    void __emit(MapEvent e, const Key* key, const T* value) noexcept{
+        ++__seq;
+        size_t n = 1 + my_varint_size(__seq);
+        if (key) n += my_codec<Key>::size(*key);
+        if (value) n += my_codec<T>::size(*value);
+        char* p = n <= __ring.max_record() ? __ring.reserve(n) : nullptr;
+        if (p == nullptr){
+            ++__dropped;
+            return;
+        }
+        *p++ = char(e);
+        p = my_varint_encode(__seq, p);
+        if (key) p = my_codec<Key>::encode(*key, p);
+        if (value) my_codec<T>::encode(*value, p);
+        __ring.commit();
+    }
+
+public:
+
+    explicit MapChangeWriter(MySpscRing& ring): __ring(ring){}
+
+
+    void on_insert(const Key& key, const T& value) override{
+        __emit(MapEvent::insert, &key, &value);
+    }
+
+    void on_assign(const Key& key, const T& value) override{
+        __emit(MapEvent::assign, &key, &value);
+    }
+
+    void on_erase(const Key& key) override{
+        __emit(MapEvent::erase, &key, nullptr);
+    }
+
+    void on_clear() override{
+        __emit(MapEvent::clear, nullptr, nullptr);
+    }
+
+
+    /**
+     @brief returns the sequence number of the last event
+     */
+    uint64_t sequence() const noexcept{
+        return __seq;
+    }
+
+
+    /**
+     @brief returns the number of events that did not fit into the ring
+     */
+    uint64_t dropped() const noexcept{
+        return __dropped;
+    }
+
+
+    /**
+     @brief encodes the whole map together with the current sequence number. Must be called in the thread that mutates the map.
+        A reader that loads the snapshot continues with the events that follow it in the ring.
+     @param const MyUnorderedMap& map
+     @returns std::string, the encoded snapshot
+     @exception std::bad_alloc();
+     */
+    template<typename Hash, typename Cmp, typename Allocator>
+    std::string snapshot(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map) const{
+        size_t n = my_varint_size(__seq) + my_varint_size(map.count());
+        for (auto it = map.cbegin(); it != map.cend(); ++it)
+            n += my_codec<Key>::size(it->first) + my_codec<T>::size(it->second);
+        std::string res(n, '\0');
+        char* p = &res[0];
+        p = my_varint_encode(__seq, p);
+        p = my_varint_encode(map.count(), p);
+        for (auto it = map.cbegin(); it != map.cend(); ++it){
+            p = my_codec<Key>::encode(it->first, p);
+            p = my_codec<T>::encode(it->second, p);
+        }
+        return res;
+    }
+};
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key>,
+            typename Allocator = std::allocator<std::pair<Key, T> > >
+
+/**!
+ @brief MapChangeReader keeps a mirror map in sync with the change stream of a MapChangeWriter, possibly in another thread or process.
+        It starts unsynced: load() a snapshot of the source map, then poll() the ring. Events up to the snapshot's sequence number are skipped.
+        A sequence gap, noticed at the first event that reaches the ring after dropped ones, makes the reader unsynced again.
+        An unsynced reader drains and discards the ring, so the writer keeps making progress while a new snapshot is requested;
+        do not poll between requesting a snapshot and loading it.
+ */
+class MapChangeReader{
+    using map_type = MyUnorderedMap<Key, T, Hash, Cmp, Allocator>;
+
+    MySpscRing& __ring;
+    map_type& __mirror;
+    uint64_t __seq = 0;
+    bool __synced = false;
+
+
+    void __apply(const char* p, size_t n){
+        const char* end = p + n;
+        if (n == 0)
+            throw std::out_of_range("MapChangeReader: empty record");
+        MapEvent e = MapEvent(uint8_t(*p++));
+        uint64_t seq;
+        p = my_varint_decode(p, end, seq);
+        if (!__synced || seq <= __seq) return;
+        if (seq != __seq + 1){
+            __synced = false;
+            return;
+        }
+        Key key;
+        T value;
+        switch (e){
+            case MapEvent::insert:
+            case MapEvent::assign:
+                p = my_codec<Key>::decode(p, end, key);
+                my_codec<T>::decode(p, end, value);
+                __mirror.insert_or_assign(key, std::move(value));
+                break;
+            case MapEvent::erase:
+                my_codec<Key>::decode(p, end, key);
+                __mirror.erase(key);
+                break;
+            case MapEvent::clear:
+                __mirror.clear();
+                break;
+            default:
+                throw std::out_of_range("MapChangeReader: unknown event");
+        }
+        __seq = seq;
+    }
+
+public:
+
+    MapChangeReader(MySpscRing& ring, map_type& mirror): __ring(ring), __mirror(mirror){}
+
+
+    /**
+     @brief replaces the content of the mirror with a snapshot made by MapChangeWriter::snapshot and marks the reader synced
+     @param const char* data
+     @param size_t n
+     @exception std::bad_alloc(), std::out_of_range on a malformed snapshot
+     */
+    void load(const char* data, size_t n){
+        const char* end = data + n;
+        uint64_t seq, count;
+        data = my_varint_decode(data, end, seq);
+        data = my_varint_decode(data, end, count);
+        __mirror.clear();
+        if (count > 0)
+            __mirror.rehash(size_t(ceil(float(count) / __mirror.max_load_factor())));
+        for (uint64_t i = 0; i < count; ++i){
+            Key key;
+            T value;
+            data = my_codec<Key>::decode(data, end, key);
+            data = my_codec<T>::decode(data, end, value);
+            __mirror.insert(std::make_pair(std::move(key), std::move(value)));
+        }
+        __seq = seq;
+        __synced = true;
+    }
+
+
+    void load(const std::string& snapshot){
+        load(snapshot.data(), snapshot.size());
+    }
+
+
+    /**
+     @brief applies up to max records from the ring to the mirror
+     @param size_t max
+     @returns size_t, the number of records consumed
+     @exception std::bad_alloc(), std::out_of_range on a malformed record
+     */
+    size_t poll(size_t max = std::numeric_limits<size_t>::max()){
+        return __ring.poll([this](const char* p, size_t n){ __apply(p, n); }, max);
+    }
+
+
+    /**
+     @brief returns false before the first load() and after a gap in the stream
+     */
+    bool synced() const noexcept{
+        return __synced;
+    }
+
+
+    /**
+     @brief returns the sequence number of the last applied event
+     */
+    uint64_t sequence() const noexcept{
+        return __seq;
+    }
+};
+
+#endif /* MyReplication_hpp */
@@ -0,0 +1,147 @@
+//
+//  my_serialization.hpp
+//  MySpace
+//
+
+#ifndef MySerialization_hpp
+#define MySerialization_hpp
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+
+/**
+ @brief returns the number of bytes of v in LEB128 encoding
+ @param uint64_t v
+ @returns size_t
+ */
+inline size_t my_varint_size(uint64_t v) noexcept{
+    size_t n = 1;
+    while (v >= 0x80){
+        v >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+
+/**
+ @brief writes v in LEB128 encoding: seven bits per byte, the high bit set on all bytes but the last
+ @param uint64_t v
+ @param char* out
+ @returns char*, the end of the written bytes
+ */
+inline char* my_varint_encode(uint64_t v, char* out) noexcept{
+    while (v >= 0x80){
+        *out++ = char(uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    *out++ = char(uint8_t(v));
+    return out;
+}
+
+
+/**
+ @brief reads a LEB128 value from [in, end)
+ @param const char* in
+ @param const char* end
+ @param uint64_t& v
+ @returns const char*, the first byte after the value
+ @exception std::out_of_range
+ */
+inline const char* my_varint_decode(const char* in, const char* end, uint64_t& v){
+    v = 0;
+    for (unsigned shift = 0; in < end && shift < 64; shift += 7){
+        uint8_t b = uint8_t(*in++);
+        v |= uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) return in;
+    }
+    throw std::out_of_range("my_varint_decode: truncated or malformed value");
+}
+
+
+/**!
+ @brief my_codec<T> turns values into a compact byte form and back: size(v) bytes are written by encode and read by decode.
+        Integers are varints (signed ones zigzag encoded), other trivially copyable types are copied as raw bytes and std::string is a varint length followed by its bytes.
+        Specialize it to replicate or persist other types.
+ */
+template<typename T, typename = void>
+struct my_codec;
+
+
+template<typename T>
+struct my_codec<T, std::enable_if_t<std::is_integral<T>::value> >{
+    static uint64_t __zigzag(T v) noexcept{
+        if constexpr (std::is_signed<T>::value)
+            return (uint64_t(int64_t(v)) << 1) ^ uint64_t(int64_t(v) >> 63);
+        else
+            return uint64_t(v);
+    }
+
+    static size_t size(const T& v) noexcept{
+        return my_varint_size(__zigzag(v));
+    }
+
+    static char* encode(const T& v, char* out) noexcept{
+        return my_varint_encode(__zigzag(v), out);
+    }
+
+    static const char* decode(const char* in, const char* end, T& v){
+        uint64_t u;
+        in = my_varint_decode(in, end, u);
+        if constexpr (std::is_signed<T>::value)
+            v = T(int64_t(u >> 1) ^ -int64_t(u & 1));
+        else
+            v = T(u);
+        return in;
+    }
+};
+
+
+template<typename T>
+struct my_codec<T, std::enable_if_t<!std::is_integral<T>::value && std::is_trivially_copyable<T>::value> >{
+    static size_t size(const T&) noexcept{
+        return sizeof(T);
+    }
+
+    static char* encode(const T& v, char* out) noexcept{
+        memcpy(out, &v, sizeof(T));
+        return out + sizeof(T);
+    }
+
+    static const char* decode(const char* in, const char* end, T& v){
+        if (size_t(end - in) < sizeof(T))
+            throw std::out_of_range("my_codec::decode: truncated value");
+        memcpy(&v, in, sizeof(T));
+        return in + sizeof(T);
+    }
+};
+
+
+template<>
+struct my_codec<std::string>{
+    static size_t size(const std::string& v) noexcept{
+        return my_varint_size(v.size()) + v.size();
+    }
+
+    static char* encode(const std::string& v, char* out) noexcept{
+        out = my_varint_encode(v.size(), out);
+        memcpy(out, v.data(), v.size());
+        return out + v.size();
+    }
+
+    static const char* decode(const char* in, const char* end, std::string& v){
+        uint64_t n;
+        in = my_varint_decode(in, end, n);
+        if (uint64_t(end - in) < n)
+            throw std::out_of_range("my_codec::decode: truncated string");
+        v.assign(in, size_t(n));
+        return in + n;
+    }
+};
+
+#endif /* MySerialization_hpp */
@@ -0,0 +1,286 @@
+//
+//  my_set_operations.hpp
+//  MySpace
+//
+
+#ifndef MySetOperations_hpp
+#define MySetOperations_hpp
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "my_unordered_map.hpp"
+#include "my_parallel.hpp"
+
+
+/**
+ @brief checks whether two maps place every key into the same bucket: the same number of buckets and a hash function without state.
+        Such maps can be compared bucket by bucket without hashing.
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+bool __same_bucket_layout(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b) noexcept{
+    return std::is_empty<Hash>::value && a.size() == b.size();
+}
+
+
+/*
+ calls f(thread, scan_item, probe_item) for every element of scan, where probe_item is the element of probe with an equivalent key or nullptr.
+ Work is split across threads by ranges of buckets of scan. With the same bucket layout bucket i of scan is compared with bucket i of probe,
+ otherwise lookups are batched: a batch is hashed, its bucket slots and first nodes are prefetched, and only then searched.
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator, typename F>
+void __probe_buckets(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& scan, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& probe, size_t threads, F f){
+    using item = std::pair<Key, T>;
+    constexpr size_t batch = 16;
+
+    size_t buckets = scan.size();
+    size_t chunks = threads > 1 ? threads * 4 : 1;
+    bool merge = __same_bucket_layout(scan, probe);
+    Hash hash = scan.hash_function();
+    Cmp cmp = scan.key_eq();
+
+    my_parallel_for(threads, chunks, [&](size_t chunk, size_t thread){
+        auto [b0, b1] = my_chunk(buckets, chunks, chunk);
+        if (merge){
+            for (size_t b = b0; b < b1; ++b){
+                for (auto it = scan.cbegin(b); it != scan.cend(b); ++it){
+                    const item* found = nullptr;
+                    for (auto jt = probe.cbegin(b); jt != probe.cend(b); ++jt){
+                        if (cmp(it->first, jt->first)){
+                            found = &*jt;
+                            break;
+                        }
+                    }
+                    f(thread, *it, found);
+                }
+            }
+            return;
+        }
+
+        const item* items[batch];
+        size_t hashes[batch];
+        size_t m = 0;
+        auto flush = [&](){
+            for (size_t i = 0; i < m; ++i)
+                probe.prefetch_bucket(hashes[i]);
+            for (size_t i = 0; i < m; ++i)
+                probe.prefetch_node(hashes[i]);
+            for (size_t i = 0; i < m; ++i){
+                auto jt = probe.find(items[i]->first, hashes[i]);
+                f(thread, *items[i], jt == probe.cend() ? nullptr : &*jt);
+            }
+            m = 0;
+        };
+        for (size_t b = b0; b < b1; ++b){
+            for (auto it = scan.cbegin(b); it != scan.cend(b); ++it){
+                items[m] = &*it;
+                hashes[m] = hash(it->first);
+                if (++m == batch) flush();
+            }
+        }
+        flush();
+    });
+}
+
+
+/*
+ collects per thread the elements of scan for which keep(scan_item, probe_item) returns a non-null pointer, and returns them concatenated
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator, typename Keep>
+std::vector<const std::pair<Key, T>*> __select(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& scan, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& probe, size_t threads, Keep keep){
+    using item = std::pair<Key, T>;
+    threads = std::max<size_t>(1, threads);
+    std::vector<std::vector<const item*> > local(threads);
+    __probe_buckets(scan, probe, threads, [&](size_t thread, const item& s, const item* p){
+        if (const item* r = keep(s, p))
+            local[thread].push_back(r);
+    });
+
+    std::vector<const item*> res;
+    size_t total = 0;
+    for (auto& l : local)
+        total += l.size();
+    res.reserve(total);
+    for (auto& l : local)
+        res.insert(res.end(), l.begin(), l.end());
+    return res;
+}
+
+
+template<typename Map, typename Items>
+void __insert_all(Map& res, const Items& items){
+    for (auto* i : items)
+        res.insert(*i);
+}
+
+
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+void __reserve(MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& res, size_t count){
+    if (count > 0 && res.size() * res.max_load_factor() < count)
+        res.rehash(size_t(ceil(float(count) / res.max_load_factor())));
+}
+
+
+template<typename Items>
+auto __keys_of(const Items& items){
+    std::vector<std::remove_const_t<typename std::remove_pointer_t<typename Items::value_type>::first_type> > res;
+    res.reserve(items.size());
+    for (auto* i : items)
+        res.push_back(i->first);
+    return res;
+}
+
+
+/*
+ elements of a whose key is also in b; the smaller map is scanned and the larger probed
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+std::vector<const std::pair<Key, T>*> __intersection(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads){
+    using item = std::pair<Key, T>;
+    if (a.count() <= b.count())
+        return __select(a, b, threads, [](const item& s, const item* p){ return p ? &s : nullptr; });
+    return __select(b, a, threads, [](const item&, const item* p){ return p; });
+}
+
+
+/*
+ elements of a whose key is not in b
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+std::vector<const std::pair<Key, T>*> __difference(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads){
+    using item = std::pair<Key, T>;
+    return __select(a, b, threads, [](const item& s, const item* p){ return p ? nullptr : &s; });
+}
+
+
+/**
+ @brief returns the elements of a whose keys are also in b. Values are taken from a.
+        The smaller map is scanned and the larger one probed; maps with the same bucket layout are compared bucket by bucket.
+ @param const MyUnorderedMap& a
+ @param const MyUnorderedMap& b
+ @param size_t threads
+ @returns MyUnorderedMap
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+MyUnorderedMap<Key, T, Hash, Cmp, Allocator> intersect(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    auto items = __intersection(a, b, threads);
+    MyUnorderedMap<Key, T, Hash, Cmp, Allocator> res;
+    __reserve(res, items.size());
+    __insert_all(res, items);
+    return res;
+}
+
+
+/**
+ @brief returns the elements of a together with the elements of b whose keys are not in a. For keys in both maps the value is taken from a.
+ @param const MyUnorderedMap& a
+ @param const MyUnorderedMap& b
+ @param size_t threads
+ @returns MyUnorderedMap
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+MyUnorderedMap<Key, T, Hash, Cmp, Allocator> unite(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    auto extra = __difference(b, a, threads);
+    MyUnorderedMap<Key, T, Hash, Cmp, Allocator> res;
+    __reserve(res, a.count() + extra.size());
+    for (auto it = a.cbegin(); it != a.cend(); ++it)
+        res.insert(*it);
+    __insert_all(res, extra);
+    return res;
+}
+
+
+/**
+ @brief returns the elements of a whose keys are not in b
+ @param const MyUnorderedMap& a
+ @param const MyUnorderedMap& b
+ @param size_t threads
+ @returns MyUnorderedMap
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+MyUnorderedMap<Key, T, Hash, Cmp, Allocator> subtract(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    auto items = __difference(a, b, threads);
+    MyUnorderedMap<Key, T, Hash, Cmp, Allocator> res;
+    __reserve(res, items.size());
+    __insert_all(res, items);
+    return res;
+}
+
+
+/**
+ @brief returns the elements whose keys are in exactly one of a and b
+ @param const MyUnorderedMap& a
+ @param const MyUnorderedMap& b
+ @param size_t threads
+ @returns MyUnorderedMap
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+MyUnorderedMap<Key, T, Hash, Cmp, Allocator> symmetric_difference(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    auto left = __difference(a, b, threads);
+    auto right = __difference(b, a, threads);
+    MyUnorderedMap<Key, T, Hash, Cmp, Allocator> res;
+    __reserve(res, left.size() + right.size());
+    __insert_all(res, left);
+    __insert_all(res, right);
+    return res;
+}
+
+
+/**
+ @brief returns the keys that are in both a and b
+ @returns std::vector<Key>
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+std::vector<Key> intersect_keys(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    return __keys_of(__intersection(a, b, threads));
+}
+
+
+/**
+ @brief returns the keys that are in a or in b, each once
+ @returns std::vector<Key>
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+std::vector<Key> unite_keys(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    std::vector<Key> res = __keys_of(__difference(b, a, threads));
+    res.reserve(res.size() + a.count());
+    for (auto it = a.cbegin(); it != a.cend(); ++it)
+        res.push_back(it->first);
+    return res;
+}
+
+
+/**
+ @brief returns the keys of a that are not in b
+ @returns std::vector<Key>
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+std::vector<Key> subtract_keys(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    return __keys_of(__difference(a, b, threads));
+}
+
+
+/**
+ @brief returns the keys that are in exactly one of a and b
+ @returns std::vector<Key>
+ @exception std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+std::vector<Key> symmetric_difference_keys(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& a, const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& b, size_t threads = 1){
+    std::vector<Key> res = __keys_of(__difference(a, b, threads));
+    std::vector<Key> right = __keys_of(__difference(b, a, threads));
+    res.insert(res.end(), right.begin(), right.end());
+    return res;
+}
+
+#endif /* MySetOperations_hpp */
@@ -0,0 +1,432 @@
+//
+//  my_sharded_map.hpp
+//  MySpace
+//
+
+#ifndef MyShardedMap_hpp
+#define MyShardedMap_hpp
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+
+#include "my_unordered_map.hpp"
+#include "my_heavy_hitters.hpp"
+#include "my_radix_partitioner.hpp"
+
+
+/**
+ @brief the lock counters of a MyProfiledMutex, summed over the threads
+ */
+struct MyLockStats{
+    uint64_t acquisitions = 0;
+    uint64_t contended = 0;         // acquisitions that found the mutex taken and had to wait
+    uint64_t wait_ns = 0;
+    uint64_t hold_ns = 0;
+
+    double contention() const noexcept{
+        return acquisitions ? double(contended) / double(acquisitions) : 0;
+    }
+};
+
+
+/**!
+ @brief MyProfiledMutex is a std::mutex that counts its acquisitions, the contended ones, the time spent waiting and the time held.
+        A lock first tries try_lock(), so an uncontended acquisition is not timed while waiting; the hold time is measured with my_ticks().
+        Counters are kept in __slots lines of relaxed atomics, a thread always adding to the same line, and are summed by stats().
+        With profiling off a lock costs one extra load.
+ */
+class MyProfiledMutex{
+    static constexpr size_t __slots = 16;
+
+    struct alignas(64) __counters{
+        std::atomic<uint64_t> acquisitions{0};
+        std::atomic<uint64_t> contended{0};
+        std::atomic<uint64_t> wait_ticks{0};
+        std::atomic<uint64_t> hold_ticks{0};
+    };
+
+    std::mutex __mutex;
+    std::atomic<bool> __profiling{true};
+    // written by the holder only
+    bool __timed = false;
+    uint64_t __acquired_at = 0;
+    __counters __counts[__slots];
+
+
+    static size_t __slot() noexcept{
+        static std::atomic<size_t> next{0};
+        static thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % __slots;
+        return slot;
+    }
+
+public:
+
+    MyProfiledMutex() = default;
+    MyProfiledMutex(const MyProfiledMutex&) = delete;
+    MyProfiledMutex& operator=(const MyProfiledMutex&) = delete;
+
+
+    /**
+     @brief locks the mutex
+     @returns bool, true if the mutex was taken by another thread and the call had to wait
+     */
+    bool lock_profiled(){
+        if (!__profiling.load(std::memory_order_relaxed)){
+            __mutex.lock();
+            __timed = false;
+            return false;
+        }
+        __counters& c = __counts[__slot()];
+        bool contended = !__mutex.try_lock();
+        if (contended){
+            uint64_t start = my_ticks();
+            __mutex.lock();
+            c.contended.fetch_add(1, std::memory_order_relaxed);
+            c.wait_ticks.fetch_add(my_ticks() - start, std::memory_order_relaxed);
+        }
+        c.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        __timed = true;
+        __acquired_at = my_ticks();
+        return contended;
+    }
+
+
+    void lock(){
+        lock_profiled();
+    }
+
+
+    bool try_lock(){
+        if (!__mutex.try_lock()) return false;
+        __timed = false;
+        return true;
+    }
+
+
+    void unlock(){
+        if (__timed)
+            __counts[__slot()].hold_ticks.fetch_add(my_ticks() - __acquired_at, std::memory_order_relaxed);
+        __mutex.unlock();
+    }
+
+
+    /**
+     @brief returns the underlying mutex, to lock without being counted
+     */
+    std::mutex& native() noexcept{
+        return __mutex;
+    }
+
+
+    /**
+     @brief turns the counting on or off; acquisitions already holding the mutex are still finished by the old setting
+     @param bool on
+     */
+    void profiling(bool on) noexcept{
+        __profiling.store(on, std::memory_order_relaxed);
+    }
+
+
+    bool profiling() const noexcept{
+        return __profiling.load(std::memory_order_relaxed);
+    }
+
+
+    /**
+     @brief sums the counters of all threads. Counters are read without the mutex, so a concurrent sum may be slightly behind.
+     @returns MyLockStats
+     */
+    MyLockStats stats() const noexcept{
+        MyLockStats s;
+        uint64_t wait = 0, hold = 0;
+        for (const __counters& c : __counts){
+            s.acquisitions += c.acquisitions.load(std::memory_order_relaxed);
+            s.contended += c.contended.load(std::memory_order_relaxed);
+            wait += c.wait_ticks.load(std::memory_order_relaxed);
+            hold += c.hold_ticks.load(std::memory_order_relaxed);
+        }
+        s.wait_ns = uint64_t(double(wait) / my_ticks_per_ns());
+        s.hold_ns = uint64_t(double(hold) / my_ticks_per_ns());
+        return s;
+    }
+
+
+    void reset_stats() noexcept{
+        for (__counters& c : __counts){
+            c.acquisitions.store(0, std::memory_order_relaxed);
+            c.contended.store(0, std::memory_order_relaxed);
+            c.wait_ticks.store(0, std::memory_order_relaxed);
+            c.hold_ticks.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+
+/**
+ @brief the contention of a shard of MyShardedMap
+ */
+struct MyShardStats{
+    size_t shard = 0;
+    MyLockStats lock;
+    size_t count = 0;
+    std::vector<HeavyHitter<uint64_t> > hot_keys;       // by full hash of the key, most contended first
+};
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key>,
+            size_t HotKeys = 16>
+
+/**!
+ @brief MyShardedMap is a concurrent map split into shards, each a MyUnorderedMap behind its own MyProfiledMutex.
+        The shard of a key is taken from its mixed hash, and every call locks exactly one shard. Besides the lock counters of every shard,
+        the full hashes of the keys whose acquisition was contended are counted per shard by a HeavyHittersMap of HotKeys counters,
+        so stats() tells both which shards are contended and which keys drive it: a shard with high contention and one dominant hash
+        is a skewed key that more shards will not help, while contention spread over many hashes calls for more shards.
+        Key hashes are those of hash_function(), a default-constructed Hash, which picks the shard; the shard maps hash with their own
+        default-constructed Hash, as MyUnorderedMap takes no hash object.
+ */
+class MyShardedMap{
+    struct alignas(64) __shard{
+        MyProfiledMutex mutex;
+        MyUnorderedMap<Key, T, Hash, Cmp> map;
+        HeavyHittersMap<uint64_t, HotKeys> contended_keys;      // under mutex
+    };
+
+    size_t __count;
+    Hash __hash;
+    std::unique_ptr<__shard[]> __shards;
+
+
+    __shard& __shard_of(size_t h) const noexcept{
+        return __shards[__mix_hash(h) % __count];
+    }
+
+
+    // runs f on the map of the shard of key under its mutex
+    template <typename F>
+    auto __locked(const Key& key, F&& f) const{
+        size_t h = __hash(key);
+        __shard& s = __shard_of(h);
+        bool contended = s.mutex.lock_profiled();
+        std::lock_guard<MyProfiledMutex> guard(s.mutex, std::adopt_lock);
+        if (contended) s.contended_keys.add(uint64_t(h));
+        return f(s.map);
+    }
+
+public:
+
+    /**
+     @brief creates a map of shards shards
+     @param size_t shards
+     @exception std::invalid_argument, std::bad_alloc();
+     */
+    explicit MyShardedMap(size_t shards = 64): __count(shards){
+        if (shards == 0)
+            throw std::invalid_argument("MyShardedMap: shards must be positive");
+        __shards.reset(new __shard[shards]);
+    }
+
+
+    MyShardedMap(const MyShardedMap&) = delete;
+    MyShardedMap& operator=(const MyShardedMap&) = delete;
+
+
+    /**
+     @brief inserts (key, value) if key is absent
+     @returns bool, true if inserted
+     @exception std::bad_alloc();
+     */
+    bool insert(const Key& key, const T& value){
+        return __locked(key, [&](auto& m){ return m.insert(std::make_pair(key, value)).second; });
+    }
+
+
+    /**
+     @brief inserts (key, value) or replaces the value of key
+     @returns bool, true if inserted
+     @exception std::bad_alloc();
+     */
+    bool insert_or_assign(const Key& key, const T& value){
+        return __locked(key, [&](auto& m){ return m.insert_or_assign(key, value).second; });
+    }
+
+
+    bool erase(const Key& key){
+        return __locked(key, [&](auto& m){ return m.erase(key); });
+    }
+
+
+    /**
+     @brief returns a copy of the value of key
+     @returns std::optional<T>
+     */
+    std::optional<T> get(const Key& key) const{
+        return __locked(key, [&](auto& m) -> std::optional<T>{
+            auto it = m.find(key);
+            if (it == m.end()) return std::nullopt;
+            return it->second;
+        });
+    }
+
+
+    bool contains(const Key& key) const{
+        return __locked(key, [&](auto& m){ return m.find(key) != m.end(); });
+    }
+
+
+    /**
+     @brief calls f(T&) on the value of key under the lock of its shard, inserting T() first if key is absent
+     @param const Key& key
+     @param F f
+     @returns what f returns
+     @exception std::bad_alloc();
+     */
+    template <typename F>
+    auto update(const Key& key, F&& f){
+        return __locked(key, [&](auto& m){ return f(m[key]); });
+    }
+
+
+    /**
+     @brief calls f(const Key&, const T&) on every element, one shard locked at a time, so the pass is not a consistent snapshot
+     @param F f
+     */
+    template <typename F>
+    void for_each(F&& f) const{
+        for (size_t i = 0; i < __count; ++i){
+            std::lock_guard<MyProfiledMutex> guard(__shards[i].mutex);
+            const auto& m = __shards[i].map;
+            for (auto it = m.cbegin(); it != m.cend(); ++it)
+                f(it->first, it->second);
+        }
+    }
+
+
+    /**
+     @brief returns the number of elements, summed shard by shard
+     */
+    size_t count() const{
+        size_t n = 0;
+        for (size_t i = 0; i < __count; ++i){
+            std::lock_guard<std::mutex> guard(__shards[i].mutex.native());
+            n += __shards[i].map.count();
+        }
+        return n;
+    }
+
+
+    bool empty() const{
+        return count() == 0;
+    }
+
+
+    size_t shards() const noexcept{
+        return __count;
+    }
+
+
+    size_t shard_of(const Key& key) const{
+        return __mix_hash(__hash(key)) % __count;
+    }
+
+
+    Hash hash_function() const{
+        return __hash;
+    }
+
+
+    /**
+     @brief turns lock profiling of every shard on or off; it is on after construction
+     @param bool on
+     */
+    void profiling(bool on) noexcept{
+        for (size_t i = 0; i < __count; ++i)
+            __shards[i].mutex.profiling(on);
+    }
+
+
+    /**
+     @brief returns the lock counters, the number of elements and the most contended key hashes of every shard, in shard order.
+        Reading does not count as an acquisition.
+     @param size_t top_keys, hot keys reported per shard
+     @returns std::vector<MyShardStats>
+     @exception std::bad_alloc();
+     */
+    std::vector<MyShardStats> stats(size_t top_keys = 5) const{
+        std::vector<MyShardStats> res(__count);
+        for (size_t i = 0; i < __count; ++i){
+            __shard& s = __shards[i];
+            res[i].shard = i;
+            res[i].lock = s.mutex.stats();
+            std::lock_guard<std::mutex> guard(s.mutex.native());
+            res[i].count = s.map.count();
+            res[i].hot_keys = s.contended_keys.top(top_keys);
+        }
+        return res;
+    }
+
+
+    /**
+     @brief clears the lock counters and the hot keys of every shard
+     */
+    void reset_stats(){
+        for (size_t i = 0; i < __count; ++i){
+            __shard& s = __shards[i];
+            std::lock_guard<std::mutex> guard(s.mutex.native());
+            s.mutex.reset_stats();
+            s.contended_keys.clear();
+        }
+    }
+
+
+    /**
+     @brief writes the totals, the skew of the acquisitions over the shards (the busiest shard against the mean) and the top_shards shards
+        with the longest wait, with their hot keys, to out
+     @param FILE* out
+     @param size_t top_shards
+     @param size_t top_keys
+     */
+    void dump_stats(FILE* out, size_t top_shards = 10, size_t top_keys = 3) const{
+        std::vector<MyShardStats> all = stats(top_keys);
+        MyLockStats total;
+        uint64_t busiest = 0;
+        for (const MyShardStats& s : all){
+            total.acquisitions += s.lock.acquisitions;
+            total.contended += s.lock.contended;
+            total.wait_ns += s.lock.wait_ns;
+            total.hold_ns += s.lock.hold_ns;
+            busiest = std::max(busiest, s.lock.acquisitions);
+        }
+        double mean = double(total.acquisitions) / double(__count);
+        fprintf(out, "%zu shards, %llu acquisitions, %llu contended (%.2f%%), wait %.3f ms, hold %.3f ms, skew %.2f\n", __count,
+                (unsigned long long)total.acquisitions, (unsigned long long)total.contended, 100 * total.contention(),
+                double(total.wait_ns) / 1e6, double(total.hold_ns) / 1e6, mean > 0 ? double(busiest) / mean : 0);
+
+        std::sort(all.begin(), all.end(), [](const MyShardStats& a, const MyShardStats& b){ return a.lock.wait_ns > b.lock.wait_ns; });
+        if (all.size() > top_shards) all.resize(top_shards);
+        fprintf(out, "%-6s %12s %12s %9s %12s %12s %10s  %s\n", "shard", "acquired", "contended", "rate", "wait_ms", "hold_ms", "count",
+                "hot keys (hash:count)");
+        for (const MyShardStats& s : all){
+            fprintf(out, "%-6zu %12llu %12llu %8.2f%% %12.3f %12.3f %10zu ", s.shard, (unsigned long long)s.lock.acquisitions,
+                    (unsigned long long)s.lock.contended, 100 * s.lock.contention(), double(s.lock.wait_ns) / 1e6,
+                    double(s.lock.hold_ns) / 1e6, s.count);
+            for (const auto& k : s.hot_keys)
+                fprintf(out, " %llx:%llu", (unsigned long long)k.key, (unsigned long long)k.count);
+            fprintf(out, "\n");
+        }
+        fflush(out);
+    }
+};
+
+#endif /* MyShardedMap_hpp */
@@ -0,0 +1,361 @@
+//
+//  my_shared_map.hpp
+//  MySpace
+//
+
+#ifndef MySharedMap_hpp
+#define MySharedMap_hpp
+
+#include <new>
+#include <atomic>
+#include <string>
+#include <cerrno>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <functional>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "my_offset_hash_table.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MySharedMap is a hash map that lives in a POSIX shared memory segment of fixed size, so several processes use one copy of it.
+        Nodes and the bucket array are allocated from an arena inside the segment and linked by offsets, so every process may map it at its own address.
+        Writers are serialized by a robust process-shared mutex. Lookups take no lock: they follow a seqlock, retrying when a write overlapped them,
+        and copy the value out, so a reader never holds a pointer into the segment.
+        If a writer dies in the middle of a change the segment is marked broken and every later operation throws std::runtime_error.
+        Hash must give the same result in every process, and Key and T must be trivially copyable.
+ */
+class MySharedMap{
+    struct __region{
+        char* __base = nullptr;
+        size_t __size = 0;
+
+        char* base() const noexcept{
+            return __base;
+        }
+
+        size_t mapped() const noexcept{
+            return __size;
+        }
+
+        void grow(size_t){
+            throw std::bad_alloc();
+        }
+
+        void changing(uint64_t, size_t) noexcept{}
+    };
+
+    struct __header{
+        pthread_mutex_t mutex;
+        alignas(64) std::atomic<uint64_t> seq;
+        std::atomic<uint32_t> broken;
+        __offset_table_header table;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "MySharedMap: atomics in shared memory must be lock-free");
+
+    using table_type = __offset_hash_table<Key, T, Hash, Cmp, __region>;
+
+    std::string __name;
+    __region __r;
+    table_type __table;
+
+
+    __header* __h() const noexcept{
+        return reinterpret_cast<__header*>(__r.__base);
+    }
+
+
+    void __check() const{
+        if (__h()->broken.load(std::memory_order_acquire))
+            throw std::runtime_error("MySharedMap: a writer died while changing the segment " + __name);
+    }
+
+
+    // marks the segment broken when the owner of the mutex died in the middle of a change; called with EOWNERDEAD from a lock attempt
+    static void __owner_died(__header* h) noexcept{
+        pthread_mutex_consistent(&h->mutex);
+        uint64_t s = h->seq.load(std::memory_order_relaxed);
+        if (s & 1){
+            h->broken.store(1, std::memory_order_release);
+            h->seq.store(s + 1, std::memory_order_release);
+        }
+    }
+
+
+    /*
+     holds the writer mutex and keeps the sequence number odd while the table is being changed
+     */
+    class __write_guard{
+        __header* __h;
+
+    public:
+        explicit __write_guard(__header* h): __h(h){
+            int err = pthread_mutex_lock(&h->mutex);
+            if (err == EOWNERDEAD){
+                __owner_died(h);
+            }else if (err != 0){
+                throw std::system_error(err, std::generic_category(), "MySharedMap: pthread_mutex_lock");
+            }
+            if (h->broken.load(std::memory_order_relaxed)){
+                pthread_mutex_unlock(&h->mutex);
+                throw std::runtime_error("MySharedMap: a writer died while changing the segment");
+            }
+            h->seq.store(h->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        __write_guard(const __write_guard&) = delete;
+        __write_guard& operator=(const __write_guard&) = delete;
+
+        ~__write_guard(){
+            __h->seq.store(__h->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            pthread_mutex_unlock(&__h->mutex);
+        }
+    };
+
+
+    void __map(int fd, size_t bytes){
+        void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::system_error(err, std::generic_category(), "MySharedMap: mmap " + __name);
+        __r.__base = static_cast<char*>(p);
+        __r.__size = bytes;
+    }
+
+public:
+
+    /**
+     @brief creates the shared memory segment name of the given size and an empty map in it
+     @param const std::string& name, a shm_open name such as "/lookup"
+     @param size_t bytes, the size of the segment; the map cannot grow beyond it
+     @exception std::system_error, e.g. when the segment already exists, std::invalid_argument
+     */
+    MySharedMap(const std::string& name, size_t bytes): __name(name), __table(__r, offsetof(__header, table)){
+        if (bytes < sizeof(__header) + 4096)
+            throw std::invalid_argument("MySharedMap: segment is too small");
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "MySharedMap: shm_open " + name);
+        if (::ftruncate(fd, off_t(bytes)) < 0){
+            int err = errno;
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::system_error(err, std::generic_category(), "MySharedMap: ftruncate " + name);
+        }
+        try{
+            __map(fd, bytes);
+        }catch(...){
+            ::shm_unlink(name.c_str());
+            throw;
+        }
+
+        __header* h = new (__r.__base) __header;
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&h->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        h->seq.store(0, std::memory_order_relaxed);
+        h->broken.store(0, std::memory_order_relaxed);
+        table_type::init(&h->table, sizeof(__header), bytes);
+    }
+
+
+    /**
+     @brief attaches to the map in the existing segment name
+     @param const std::string& name
+     @exception std::system_error, std::invalid_argument when the segment holds no map of this Key and T
+     */
+    explicit MySharedMap(const std::string& name): __name(name), __table(__r, offsetof(__header, table)){
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "MySharedMap: shm_open " + name);
+        struct stat st;
+        if (::fstat(fd, &st) < 0){
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "MySharedMap: fstat " + name);
+        }
+        if (size_t(st.st_size) < sizeof(__header)){
+            ::close(fd);
+            throw std::system_error(EINVAL, std::generic_category(), "MySharedMap: bad segment " + name);
+        }
+        __map(fd, size_t(st.st_size));
+        // a truncated or foreign segment would let offsets point past the mapping
+        if (!table_type::valid(&__h()->table) || __h()->table.bytes > size_t(st.st_size)){
+            ::munmap(__r.__base, __r.__size);
+            throw std::invalid_argument("MySharedMap: segment " + name + " holds no map of this type");
+        }
+    }
+
+
+    MySharedMap(const MySharedMap&) = delete;
+    MySharedMap& operator=(const MySharedMap&) = delete;
+
+
+    /**
+     @brief removes the segment name. Processes that have it mapped keep using it.
+     @param const std::string& name
+     @returns bool
+     */
+    static bool remove(const std::string& name) noexcept{
+        return ::shm_unlink(name.c_str()) == 0;
+    }
+
+
+    /**
+     @brief inserts the element if there is no element with an equivalent key
+     @returns bool, true if inserted
+     @exception std::bad_alloc() when the segment is full, std::runtime_error
+     */
+    bool insert(const Key& key, const T& value){
+        __write_guard g(__h());
+        return __table.insert(key, value, false).second;
+    }
+
+
+    /**
+     @brief inserts the element or assigns value to the existing one
+     @returns bool, true if inserted
+     @exception std::bad_alloc() when the segment is full, std::runtime_error
+     */
+    bool insert_or_assign(const Key& key, const T& value){
+        __write_guard g(__h());
+        return __table.insert(key, value, true).second;
+    }
+
+
+    bool erase(const Key& key){
+        __write_guard g(__h());
+        return __table.erase(key);
+    }
+
+
+    void clear(){
+        __write_guard g(__h());
+        __table.clear();
+    }
+
+
+    /**
+     @brief makes room for count elements without rehashing
+     @param size_t count
+     @exception std::bad_alloc(), std::runtime_error
+     */
+    void reserve(size_t count){
+        __write_guard g(__h());
+        const __offset_table_header* t = __table.table();
+        if (t->buckets * t->max_load_factor < count)
+            __table.rehash(size_t(ceil(float(count) / t->max_load_factor)));
+    }
+
+
+    /**
+     @brief copies the value of key into out without taking a lock
+     @param const Key& key
+     @param T& out
+     @returns bool, false if there is no such key
+     @exception std::runtime_error
+     */
+    bool find(const Key& key, T& out) const{
+        size_t fh = __table.hash_of(key);
+        const auto& seq = __h()->seq;
+        for (size_t spins = 0;; ++spins){
+            uint64_t s = seq.load(std::memory_order_acquire);
+            if (s & 1){
+                __check();
+                if (spins % 1024 == 1023){
+                    // a write that takes this long may belong to a dead process
+                    int r = pthread_mutex_trylock(&__h()->mutex);
+                    if (r == EOWNERDEAD) __owner_died(__h());
+                    // the write may also have finished in the meantime; either way the lock is ours now
+                    if (r == EOWNERDEAD || r == 0) pthread_mutex_unlock(&__h()->mutex);
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+            T value;
+            bool found = __table.read(key, fh, value);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) != s) continue;
+            __check();
+            if (found) out = value;
+            return found;
+        }
+    }
+
+
+    std::optional<T> get(const Key& key) const{
+        T value;
+        if (find(key, value)) return value;
+        return std::nullopt;
+    }
+
+
+    bool contains(const Key& key) const{
+        T value;
+        return find(key, value);
+    }
+
+
+    /**
+     @brief returns the number of elements
+     */
+    size_t count() const noexcept{
+        return size_t(__h()->table.count);
+    }
+
+
+    /**
+     @brief returns the size of the segment
+     */
+    size_t capacity() const noexcept{
+        return __r.__size;
+    }
+
+
+    /**
+     @brief returns the number of bytes of the segment already taken by the header and the arena
+     */
+    size_t memory_usage() const noexcept{
+        return size_t(__h()->table.top);
+    }
+
+
+    /**
+     @brief calls f(const std::pair<Key, T>&) for every element while holding the writer lock
+     @exception std::runtime_error
+     */
+    template<typename F>
+    void for_each(F&& f){
+        __write_guard g(__h());
+        __table.for_each(f);
+    }
+
+
+    ~MySharedMap(){
+        if (__r.__base) ::munmap(__r.__base, __r.__size);
+    }
+};
+
+#endif /* MySharedMap_hpp */
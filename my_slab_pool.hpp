@@ -0,0 +1,150 @@
+//
+//  my_slab_pool.hpp
+//  MySpace
+//
+
+#ifndef MySlabPool_hpp
+#define MySlabPool_hpp
+
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+
+template <typename T, size_t SlabSize = 256>
+
+/**!
+ @brief MySlabPool hands out storage for single objects of type T carved from slabs of SlabSize objects.
+        Objects never move, freed slots are reused through an intrusive free list, and slabs are released only when the pool is destroyed or cleared.
+        The pool does not track live objects: every object created must be destroyed through the pool before clear() or destruction.
+ */
+class MySlabPool{
+    union __slot{
+        __slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<__slot*> __slabs;
+    __slot* __free = nullptr;
+    size_t __live = 0;
+
+
+    void __grow(){
+        __slot* slab = static_cast<__slot*>(::operator new(sizeof(__slot) * SlabSize, std::align_val_t(alignof(__slot))));
+        try{
+            __slabs.push_back(slab);
+        }catch(...){
+            ::operator delete(slab, std::align_val_t(alignof(__slot)));
+            throw;
+        }
+        for (size_t i = SlabSize; i > 0; --i){
+            slab[i - 1].next = __free;
+            __free = slab + i - 1;
+        }
+    }
+
+public:
+
+    MySlabPool() = default;
+
+    MySlabPool(const MySlabPool&) = delete;
+
+    MySlabPool& operator=(const MySlabPool&) = delete;
+
+    MySlabPool(MySlabPool&& pool) noexcept: __slabs(std::move(pool.__slabs)), __free(pool.__free), __live(pool.__live){
+        pool.__slabs.clear();
+        pool.__free = nullptr;
+        pool.__live = 0;
+    }
+
+
+    /**
+     @brief releases the slabs of this pool and takes over those of pool. Must be called only when no live objects remain in this pool.
+     @param MySlabPool&& pool
+     */
+    MySlabPool& operator=(MySlabPool&& pool) noexcept{
+        if (this != &pool){
+            clear();
+            __slabs = std::move(pool.__slabs);
+            __free = pool.__free;
+            __live = pool.__live;
+            pool.__slabs.clear();
+            pool.__free = nullptr;
+            pool.__live = 0;
+        }
+        return *this;
+    }
+
+
+    /**
+     @brief constructs an object in a free slot
+     @param Args&&... args
+     @returns T*
+     @exception std::bad_alloc(), or anything the constructor of T throws
+     */
+    template<typename ...Args>
+    T* create(Args&&... args){
+        if (__free == nullptr)
+            __grow();
+        __slot* s = __free;
+        __free = s->next;
+        try{
+            T* p = ::new (static_cast<void*>(s->storage)) T(std::forward<Args>(args)...);
+            ++__live;
+            return p;
+        }catch(...){
+            s->next = __free;
+            __free = s;
+            throw;
+        }
+    }
+
+
+    /**
+     @brief destroys an object created by this pool and returns its slot to the free list
+     @param T* p
+     */
+    void destroy(T* p) noexcept{
+        p->~T();
+        __slot* s = reinterpret_cast<__slot*>(p);
+        s->next = __free;
+        __free = s;
+        --__live;
+    }
+
+
+    /**
+     @brief returns the number of live objects
+     */
+    size_t count() const noexcept{
+        return __live;
+    }
+
+
+    /**
+     @brief returns the number of bytes held in slabs
+     */
+    size_t memory_usage() const noexcept{
+        return __slabs.size() * SlabSize * sizeof(__slot);
+    }
+
+
+    /**
+     @brief releases all slabs. Must be called only when no live objects remain.
+     */
+    void clear() noexcept{
+        for (__slot* slab : __slabs)
+            ::operator delete(slab, std::align_val_t(alignof(__slot)));
+        __slabs.clear();
+        __free = nullptr;
+        __live = 0;
+    }
+
+
+    ~MySlabPool(){
+        clear();
+    }
+};
+
+#endif /* MySlabPool_hpp */
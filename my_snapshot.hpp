@@ -0,0 +1,745 @@
+//
+//  my_snapshot.hpp
+//  MySpace
+//
+
+#ifndef MySnapshot_hpp
+#define MySnapshot_hpp
+
+#include <new>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "my_unordered_map.hpp"
+#include "my_serialization.hpp"
+
+
+/*
+ Image format. A header, a directory with an entry per segment, then the segments.
+ A segment is a range of segment_buckets consecutive buckets of the source map: segment_buckets + 1 offsets (uint32, relative to the end of the offsets)
+ of the records of every bucket, then the records, key and value in my_codec encoding. Bucket b of a map with buckets buckets is the one MyUnorderedMap uses,
+ so a key is found in an image by hashing it, reading the offsets of its bucket and decoding that bucket only.
+ A full image has every segment; a delta image has only the segments that changed, and a present segment replaces the whole segment of its base.
+ */
+enum class __image_kind : uint32_t{
+    full = 0,
+    delta = 1
+};
+
+struct __image_header{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint64_t buckets;
+    uint64_t segment_buckets;
+    uint64_t segments;
+    uint64_t count;
+};
+
+struct __image_segment{
+    uint64_t offset;    // 0 when the segment is absent from a delta
+    uint64_t bytes;
+    uint64_t count;
+};
+
+constexpr uint64_t __image_magic = 0x31504e534d4d594dull;
+constexpr uint32_t __image_version = 1;
+
+
+inline uint64_t __image_segments(uint64_t buckets, uint64_t segment_buckets) noexcept{
+    return (buckets + segment_buckets - 1) / segment_buckets;
+}
+
+
+/*
+ buffered sequential writer of an image file
+ */
+class __image_file{
+    int __fd;
+    std::string __buf;
+    uint64_t __pos = 0;
+
+public:
+    explicit __image_file(int fd): __fd(fd){
+        __buf.reserve(size_t(1) << 20);
+    }
+
+    static void write_at(int fd, const char* p, size_t n, uint64_t off){
+        while (n > 0){
+            ssize_t w = ::pwrite(fd, p, n, off_t(off));
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0)
+                throw std::system_error(errno, std::generic_category(), "image: write");
+            p += w;
+            n -= size_t(w);
+            off += uint64_t(w);
+        }
+    }
+
+    uint64_t position() const noexcept{
+        return __pos + __buf.size();
+    }
+
+    void seek(uint64_t pos){
+        flush();
+        __pos = pos;
+    }
+
+    void append(const char* p, size_t n){
+        if (__buf.size() + n > __buf.capacity()) flush();
+        if (n >= __buf.capacity()){
+            write_at(__fd, p, n, __pos);
+            __pos += n;
+            return;
+        }
+        __buf.append(p, n);
+    }
+
+    void flush(){
+        write_at(__fd, __buf.data(), __buf.size(), __pos);
+        __pos += __buf.size();
+        __buf.clear();
+    }
+};
+
+
+/*
+ encodes buckets [b0, b1) of map as a segment into out and returns the number of records
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+uint64_t __encode_segment(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, size_t b0, size_t b1, std::string& out){
+    size_t nb = b1 - b0;
+    out.assign((nb + 1) * sizeof(uint32_t), '\0');
+    uint64_t records = 0;
+    for (size_t b = b0; b < b1; ++b){
+        uint64_t at = out.size() - (nb + 1) * sizeof(uint32_t);
+        if (at > UINT32_MAX)
+            throw std::length_error("image: segment is larger than 4 GB, use smaller segments");
+        uint32_t off = uint32_t(at);
+        memcpy(&out[(b - b0) * sizeof(uint32_t)], &off, sizeof(off));
+        for (auto it = map.cbegin(b); it != map.cend(b); ++it){
+            size_t old = out.size();
+            out.resize(old + my_codec<Key>::size(it->first) + my_codec<T>::size(it->second));
+            char* p = my_codec<Key>::encode(it->first, &out[old]);
+            my_codec<T>::encode(it->second, p);
+            ++records;
+        }
+    }
+    uint64_t at = out.size() - (nb + 1) * sizeof(uint32_t);
+    if (at > UINT32_MAX)
+        throw std::length_error("image: segment is larger than 4 GB, use smaller segments");
+    uint32_t end = uint32_t(at);
+    memcpy(&out[nb * sizeof(uint32_t)], &end, sizeof(end));
+    return records;
+}
+
+
+/*
+ writes an image of map to fd. Only the segments s with keep(s) are written; progress, if given, counts the records written.
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator, typename Keep>
+void __write_image(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, int fd, uint64_t segment_buckets, __image_kind kind,
+                   Keep keep, std::atomic<uint64_t>* progress = nullptr){
+    __image_header h{__image_magic, __image_version, uint32_t(kind), map.size(), segment_buckets,
+                     __image_segments(map.size(), segment_buckets), map.count()};
+    std::vector<__image_segment> dir(h.segments, __image_segment{0, 0, 0});
+
+    __image_file out(fd);
+    out.seek(sizeof(h) + dir.size() * sizeof(__image_segment));
+    std::string seg;
+    for (uint64_t s = 0; s < h.segments; ++s){
+        if (!keep(s)) continue;
+        size_t b0 = size_t(s * segment_buckets), b1 = size_t(std::min(h.buckets, (s + 1) * segment_buckets));
+        dir[s].count = __encode_segment(map, b0, b1, seg);
+        dir[s].offset = out.position();
+        dir[s].bytes = seg.size();
+        out.append(seg.data(), seg.size());
+        if (progress) progress->fetch_add(dir[s].count, std::memory_order_relaxed);
+    }
+    out.flush();
+    __image_file::write_at(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0);
+    __image_file::write_at(fd, reinterpret_cast<const char*>(dir.data()), dir.size() * sizeof(__image_segment), sizeof(h));
+}
+
+
+/*
+ creates path + ".tmp", calls write(fd), syncs and renames it over path, so a reader never sees a partial image
+ */
+template<typename F>
+void __publish_image(const std::string& path, F write){
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "image: open " + tmp);
+    try{
+        write(fd);
+        if (::fsync(fd) < 0)
+            throw std::system_error(errno, std::generic_category(), "image: fsync " + tmp);
+    }catch(...){
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (::rename(tmp.c_str(), path.c_str()) < 0)
+        throw std::system_error(errno, std::generic_category(), "image: rename " + tmp);
+}
+
+
+/*
+ a read-only mapping of an image file
+ */
+class __image_view{
+    const char* __base = nullptr;
+    size_t __size = 0;
+
+public:
+    explicit __image_view(const std::string& path){
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "image: open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) < 0){
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "image: fstat " + path);
+        }
+        __size = size_t(st.st_size);
+        void* p = __size ? ::mmap(nullptr, __size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        int err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::system_error(__size ? err : EINVAL, std::generic_category(), "image: mmap " + path);
+        __base = static_cast<const char*>(p);
+        const __image_header& h = header();
+        if (__size < sizeof(__image_header) || h.magic != __image_magic || h.version != __image_version ||
+            h.segment_buckets == 0 || h.segments != __image_segments(h.buckets, h.segment_buckets) ||
+            __size < sizeof(__image_header) + h.segments * sizeof(__image_segment)){
+            ::munmap(const_cast<char*>(__base), __size);
+            throw std::invalid_argument("image: " + path + " is not a map image");
+        }
+        for (uint64_t s = 0; s < h.segments; ++s){
+            const __image_segment& e = segment(s);
+            if (e.offset != 0 && (e.offset + e.bytes > __size || e.bytes < (segment_range(s).second - segment_range(s).first + 1) * sizeof(uint32_t))){
+                ::munmap(const_cast<char*>(__base), __size);
+                throw std::invalid_argument("image: " + path + " is truncated");
+            }
+        }
+    }
+
+    __image_view(const __image_view&) = delete;
+    __image_view& operator=(const __image_view&) = delete;
+
+    const __image_header& header() const noexcept{
+        return *reinterpret_cast<const __image_header*>(__base);
+    }
+
+    const __image_segment& segment(uint64_t s) const noexcept{
+        return reinterpret_cast<const __image_segment*>(__base + sizeof(__image_header))[s];
+    }
+
+    std::pair<uint64_t, uint64_t> segment_range(uint64_t s) const noexcept{
+        const __image_header& h = header();
+        return std::make_pair(s * h.segment_buckets, std::min(h.buckets, (s + 1) * h.segment_buckets));
+    }
+
+    const char* data(uint64_t off) const noexcept{
+        return __base + off;
+    }
+
+    size_t size() const noexcept{
+        return __size;
+    }
+
+    ~__image_view(){
+        if (__base) ::munmap(const_cast<char*>(__base), __size);
+    }
+};
+
+
+/*
+ decodes the records of segment bytes [p, p + n) covering nb buckets and calls f(Key&&, T&&) for each
+ */
+template<typename Key, typename T, typename F>
+void __decode_segment(const char* p, size_t n, uint64_t nb, F f){
+    const char* end = p + n;
+    uint32_t last;
+    memcpy(&last, p + nb * sizeof(uint32_t), sizeof(last));
+    const char* rec = p + (nb + 1) * sizeof(uint32_t);
+    const char* rec_end = rec + last;
+    if (rec_end > end)
+        throw std::out_of_range("image: malformed segment");
+    while (rec < rec_end){
+        Key key;
+        T value;
+        rec = my_codec<Key>::decode(rec, rec_end, key);
+        rec = my_codec<T>::decode(rec, rec_end, value);
+        f(std::move(key), std::move(value));
+    }
+}
+
+
+/*
+ decodes the records of bucket b of a full image and calls f(Key&&, T&&) for each until f returns true. Returns whether it did.
+ */
+template<typename Key, typename T, typename F>
+bool __scan_bucket(const __image_view& img, uint64_t b, F f){
+    const __image_header& h = img.header();
+    uint64_t s = b / h.segment_buckets;
+    auto [b0, b1] = img.segment_range(s);
+    const __image_segment& e = img.segment(s);
+    const char* p = img.data(e.offset);
+    uint32_t from, to;
+    memcpy(&from, p + (b - b0) * sizeof(uint32_t), sizeof(from));
+    memcpy(&to, p + (b - b0 + 1) * sizeof(uint32_t), sizeof(to));
+    const char* rec = p + (b1 - b0 + 1) * sizeof(uint32_t);
+    if (from > to || rec + to > p + e.bytes)
+        throw std::out_of_range("image: malformed segment");
+    const char* end = rec + to;
+    for (rec += from; rec < end;){
+        Key key;
+        T value;
+        rec = my_codec<Key>::decode(rec, end, key);
+        rec = my_codec<T>::decode(rec, end, value);
+        if (f(std::move(key), std::move(value))) return true;
+    }
+    return false;
+}
+
+
+/**
+ @brief writes a full image of map to path, through a temporary file that is renamed over path when complete
+ @param const MyUnorderedMap& map
+ @param const std::string& path
+ @param size_t segment_buckets, buckets per segment, the unit of incremental and lazy loading
+ @exception std::system_error, std::bad_alloc()
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+void write_image(const MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, const std::string& path, size_t segment_buckets = 4096){
+    __publish_image(path, [&](int fd){
+        __write_image(map, fd, std::max<size_t>(1, segment_buckets), __image_kind::full, [](uint64_t){ return true; });
+    });
+}
+
+
+/**
+ @brief loads a full image into map, replacing its content. The map gets the bucket count of the image, so it has the bucket layout of the source.
+ @param MyUnorderedMap& map
+ @param const std::string& path
+ @exception std::system_error, std::invalid_argument, std::out_of_range on a malformed image, std::bad_alloc()
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+void load_image(MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, const std::string& path){
+    __image_view img(path);
+    const __image_header& h = img.header();
+    if (h.kind != uint32_t(__image_kind::full))
+        throw std::invalid_argument("load_image: " + path + " is a delta, compact it into a base first");
+    map.clear();
+    if (h.buckets > 0)
+        map.rehash(size_t(std::max<uint64_t>(h.buckets, uint64_t(ceil(float(h.count) / map.max_load_factor())))));
+    for (uint64_t s = 0; s < h.segments; ++s){
+        const __image_segment& e = img.segment(s);
+        auto [b0, b1] = img.segment_range(s);
+        __decode_segment<Key, T>(img.data(e.offset), size_t(e.bytes), b1 - b0, [&](Key&& key, T&& value){
+            map.insert(std::make_pair(std::move(key), std::move(value)));
+        });
+    }
+}
+
+
+/**
+ @brief writes the ranges of map that changed since the previous checkpoint to path as a delta image, and marks the map clean.
+        Segments are the dirty ranges of the map. When the bucket layout changed (rehash, clear, the first checkpoint) every key may have moved,
+        so a full image is written instead and it starts a new chain: the images of a chain fold into one full image with compact_images.
+ @param MyUnorderedMap& map, with dirty tracking on
+ @param const std::string& path
+ @returns bool, true if a full image was written
+ @exception std::logic_error when dirty tracking is off, std::system_error, std::bad_alloc()
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+bool checkpoint_incremental(MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, const std::string& path){
+    if (map.dirty_range_buckets() == 0)
+        throw std::logic_error("checkpoint_incremental: dirty tracking is off, call track_dirty() first");
+    bool full = map.layout_changed();
+    __publish_image(path, [&](int fd){
+        __write_image(map, fd, map.dirty_range_buckets(), full ? __image_kind::full : __image_kind::delta,
+                      [&](uint64_t s){ return full || map.range_dirty(size_t(s)); });
+    });
+    map.clear_dirty();
+    return full;
+}
+
+
+/**
+ @brief folds a chain of images, a full image followed by the deltas written after it in order, into one full image at out.
+        Every segment is copied from the newest image that has it, without decoding. A full image inside deltas starts the chain again from it.
+        out may be one of the inputs; it is replaced atomically.
+ @param const std::string& base
+ @param const std::vector<std::string>& deltas
+ @param const std::string& out
+ @exception std::invalid_argument when the chain does not start with a full image or the images have different layouts, std::system_error
+ */
+inline void compact_images(const std::string& base, const std::vector<std::string>& deltas, const std::string& out){
+    std::vector<std::unique_ptr<__image_view> > chain;
+    chain.push_back(std::make_unique<__image_view>(base));
+    if (chain.back()->header().kind != uint32_t(__image_kind::full))
+        throw std::invalid_argument("compact_images: " + base + " is not a full image");
+    for (const std::string& path : deltas){
+        auto img = std::make_unique<__image_view>(path);
+        if (img->header().kind == uint32_t(__image_kind::full)){
+            chain.clear();
+        }else if (img->header().buckets != chain.front()->header().buckets ||
+                  img->header().segment_buckets != chain.front()->header().segment_buckets){
+            throw std::invalid_argument("compact_images: " + path + " does not have the bucket layout of its base");
+        }
+        chain.push_back(std::move(img));
+    }
+
+    __image_header h = chain.back()->header();
+    h.kind = uint32_t(__image_kind::full);
+    std::vector<__image_segment> dir(h.segments);
+    std::vector<const __image_view*> from(h.segments);
+    for (uint64_t s = 0; s < h.segments; ++s){
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+            if ((*it)->segment(s).offset != 0){
+                from[s] = it->get();
+                break;
+            }
+    }
+
+    __publish_image(out, [&](int fd){
+        __image_file file(fd);
+        file.seek(sizeof(h) + dir.size() * sizeof(__image_segment));
+        for (uint64_t s = 0; s < h.segments; ++s){
+            const __image_segment& e = from[s]->segment(s);
+            dir[s] = __image_segment{file.position(), e.bytes, e.count};
+            file.append(from[s]->data(e.offset), size_t(e.bytes));
+        }
+        file.flush();
+        __image_file::write_at(fd, reinterpret_cast<const char*>(&h), sizeof(h), 0);
+        __image_file::write_at(fd, reinterpret_cast<const char*>(dir.data()), dir.size() * sizeof(__image_segment), sizeof(h));
+    });
+}
+
+
+/*
+ writes a full image from a forked child of a process that may have other threads. Those threads may have held the allocator, stdio or any
+ other lock at fork time, so the child must not allocate, lock or throw: the parent opens the temporary file and allocates every buffer,
+ and the child encodes records straight into a fixed block written with pwrite(). A record larger than the block goes through its own mmap().
+ */
+template<typename Map>
+class __fork_image_writer{
+    static constexpr size_t __capacity = size_t(1) << 20;
+
+    std::string __tmp;
+    std::string __path;
+    int __fd = -1;
+    std::unique_ptr<char[]> __block;
+    size_t __fill = 0;
+    uint64_t __pos = 0;                     // file offset of __block
+    uint64_t __segment_buckets;
+    std::vector<uint32_t> __offsets;
+    std::vector<__image_segment> __dir;
+
+
+    static bool __write_at(int fd, const char* p, size_t n, uint64_t off) noexcept{
+        while (n > 0){
+            ssize_t w = ::pwrite(fd, p, n, off_t(off));
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            p += w;
+            n -= size_t(w);
+            off += uint64_t(w);
+        }
+        return true;
+    }
+
+    uint64_t __position() const noexcept{
+        return __pos + __fill;
+    }
+
+    bool __flush() noexcept{
+        if (!__write_at(__fd, __block.get(), __fill, __pos)) return false;
+        __pos += __fill;
+        __fill = 0;
+        return true;
+    }
+
+    template<typename Key, typename T>
+    bool __append(const Key& key, const T& value) noexcept{
+        size_t n = my_codec<Key>::size(key) + my_codec<T>::size(value);
+        if (n > __capacity - __fill && !__flush()) return false;
+        if (n <= __capacity){
+            my_codec<T>::encode(value, my_codec<Key>::encode(key, __block.get() + __fill));
+            __fill += n;
+            return true;
+        }
+        void* big = ::mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (big == MAP_FAILED) return false;
+        my_codec<T>::encode(value, my_codec<Key>::encode(key, static_cast<char*>(big)));
+        bool ok = __write_at(__fd, static_cast<char*>(big), n, __pos);
+        ::munmap(big, n);
+        __pos += n;
+        return ok;
+    }
+
+    bool __write(const Map& map, std::atomic<uint64_t>* progress) noexcept{
+        __image_header h{__image_magic, __image_version, uint32_t(__image_kind::full), map.size(), __segment_buckets,
+                         __image_segments(map.size(), __segment_buckets), map.count()};
+        if (h.segments != __dir.size()) return false;
+        __pos = sizeof(h) + __dir.size() * sizeof(__image_segment);
+        for (uint64_t s = 0; s < h.segments; ++s){
+            size_t b0 = size_t(s * __segment_buckets), b1 = size_t(std::min(h.buckets, (s + 1) * __segment_buckets));
+            size_t nb = b1 - b0;
+            // the offsets of the buckets precede the records, so their place is left empty and written once the segment is done
+            if (!__flush()) return false;
+            uint64_t start = __pos, records = start + (nb + 1) * sizeof(uint32_t);
+            __pos = records;
+            uint64_t count = 0;
+            for (size_t b = b0; b <= b1; ++b){
+                if (__position() - records > UINT32_MAX) return false;
+                __offsets[b - b0] = uint32_t(__position() - records);
+                if (b == b1) break;
+                for (auto it = map.cbegin(b); it != map.cend(b); ++it, ++count)
+                    if (!__append(it->first, it->second)) return false;
+            }
+            if (!__write_at(__fd, reinterpret_cast<const char*>(__offsets.data()), (nb + 1) * sizeof(uint32_t), start)) return false;
+            __dir[s] = __image_segment{start, __position() - start, count};
+            if (progress) progress->fetch_add(count, std::memory_order_relaxed);
+        }
+        return __flush() && __write_at(__fd, reinterpret_cast<const char*>(&h), sizeof(h), 0) &&
+               __write_at(__fd, reinterpret_cast<const char*>(__dir.data()), __dir.size() * sizeof(__image_segment), sizeof(h)) &&
+               ::fsync(__fd) == 0;
+    }
+
+public:
+
+    // in the parent: opens path + ".tmp" and allocates the buffers for the current layout of map
+    __fork_image_writer(const Map& map, const std::string& path, uint64_t segment_buckets):
+        __tmp(path + ".tmp"), __path(path), __block(new char[__capacity]), __segment_buckets(std::max<uint64_t>(1, segment_buckets)),
+        __offsets(size_t(__segment_buckets) + 1), __dir(__image_segments(map.size(), __segment_buckets), __image_segment{0, 0, 0}){
+        __fd = ::open(__tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (__fd < 0)
+            throw std::system_error(errno, std::generic_category(), "image: open " + __tmp);
+    }
+
+    __fork_image_writer(const __fork_image_writer&) = delete;
+    __fork_image_writer& operator=(const __fork_image_writer&) = delete;
+
+    // in the child: writes, syncs and publishes the image, and returns the exit code
+    int run(const Map& map, std::atomic<uint64_t>* progress) noexcept{
+        bool ok = __write(map, progress);
+        ok = ::close(__fd) == 0 && ok;
+        __fd = -1;
+        if (ok && ::rename(__tmp.c_str(), __path.c_str()) == 0) return 0;
+        ::unlink(__tmp.c_str());
+        return 1;
+    }
+
+    // in the parent when no child will write the file
+    void discard() noexcept{
+        ::close(__fd);
+        __fd = -1;
+        ::unlink(__tmp.c_str());
+    }
+
+    ~__fork_image_writer(){
+        if (__fd >= 0) ::close(__fd);
+    }
+};
+
+
+/**!
+ @brief SnapshotHandle follows a snapshot written by a forked child. Progress is shared with the child through an anonymous shared page.
+        The handle must be finished with wait(), or done() returning true, to reap the child; the destructor waits if neither happened.
+        A rehash held back for the snapshot is released at that point too, not when the child exits.
+ */
+class SnapshotHandle{
+    struct __progress{
+        std::atomic<uint64_t> written;
+        uint64_t total;
+    };
+
+    pid_t __pid = -1;
+    __progress* __shared = nullptr;
+    bool __ok = false;
+    std::function<void()> __on_finish;
+
+
+    void __finish(int status){
+        __pid = -1;
+        __ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (__on_finish){
+            auto f = std::move(__on_finish);
+            __on_finish = nullptr;
+            f();
+        }
+    }
+
+public:
+
+    SnapshotHandle(pid_t pid, void* shared, std::function<void()> on_finish):
+        __pid(pid), __shared(static_cast<__progress*>(shared)), __on_finish(std::move(on_finish)){}
+
+
+    SnapshotHandle(SnapshotHandle&& h) noexcept: __pid(h.__pid), __shared(h.__shared), __ok(h.__ok), __on_finish(std::move(h.__on_finish)){
+        h.__pid = -1;
+        h.__shared = nullptr;
+        h.__on_finish = nullptr;
+    }
+
+
+    SnapshotHandle(const SnapshotHandle&) = delete;
+    SnapshotHandle& operator=(const SnapshotHandle&) = delete;
+    SnapshotHandle& operator=(SnapshotHandle&&) = delete;
+
+
+    static void* make_shared_page(uint64_t total){
+        void* p = ::mmap(nullptr, sizeof(__progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "snapshot_async: mmap");
+        auto* pr = new (p) __progress;
+        pr->written.store(0, std::memory_order_relaxed);
+        pr->total = total;
+        return p;
+    }
+
+
+    static void free_shared_page(void* shared) noexcept{
+        ::munmap(shared, sizeof(__progress));
+    }
+
+
+    static std::atomic<uint64_t>* counter(void* shared) noexcept{
+        return &static_cast<__progress*>(shared)->written;
+    }
+
+
+    /**
+     @brief returns the number of records written so far and the number of records in the map at fork time
+     */
+    uint64_t written() const noexcept{
+        return __shared ? __shared->written.load(std::memory_order_relaxed) : 0;
+    }
+
+
+    uint64_t total() const noexcept{
+        return __shared ? __shared->total : 0;
+    }
+
+
+    /**
+     @brief returns the fraction of the records written, in [0, 1]
+     */
+    double progress() const noexcept{
+        uint64_t t = total();
+        return t == 0 ? (__pid < 0 ? 1.0 : 0.0) : std::min(1.0, double(written()) / double(t));
+    }
+
+
+    /**
+     @brief checks without blocking whether the child has exited
+     */
+    bool done(){
+        if (__pid < 0) return true;
+        int status;
+        pid_t r = ::waitpid(__pid, &status, WNOHANG);
+        if (r == 0 || (r < 0 && errno == EINTR)) return false;
+        if (r < 0) status = 1 << 8;
+        __finish(status);
+        return true;
+    }
+
+
+    /**
+     @brief waits for the child and returns whether the image was written and published
+     */
+    bool wait(){
+        while (__pid >= 0){
+            int status;
+            pid_t r = ::waitpid(__pid, &status, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) status = 1 << 8;
+            __finish(status);
+        }
+        return __ok;
+    }
+
+
+    /**
+     @brief returns whether the finished snapshot succeeded
+     */
+    bool succeeded() const noexcept{
+        return __pid < 0 && __ok;
+    }
+
+
+    ~SnapshotHandle(){
+        try{
+            wait();
+        }catch(...){}
+        if (__shared) free_shared_page(__shared);
+    }
+};
+
+
+/**
+ @brief writes a full image of map to path in a forked child, which serializes its copy-on-write view of the map while the caller keeps changing it.
+        Every page the parent writes during the snapshot is duplicated, so with hold_rehash the map defers rehashing, which would rewrite every node,
+        until the handle reports the child finished: rehashing resumes only in done() returning true, wait() or the destructor of the handle,
+        so a caller that never polls must destroy the handle. The map must outlive the handle.
+        Other threads may run during the call: the temporary file and every buffer are prepared before fork(), and the child only reads the map
+        and calls write(), fsync() and rename(), so it takes no lock another thread could have held.
+ @param MyUnorderedMap& map
+ @param const std::string& path
+ @param bool hold_rehash
+ @param size_t segment_buckets
+ @returns SnapshotHandle
+ @exception std::system_error, std::bad_alloc();
+ */
+template<typename Key, typename T, typename Hash, typename Cmp, typename Allocator>
+SnapshotHandle snapshot_async(MyUnorderedMap<Key, T, Hash, Cmp, Allocator>& map, const std::string& path, bool hold_rehash = true, size_t segment_buckets = 4096){
+    using map_type = MyUnorderedMap<Key, T, Hash, Cmp, Allocator>;
+    __fork_image_writer<map_type> writer(map, path, segment_buckets);
+    std::function<void()> release;
+    if (hold_rehash && !map.rehash_deferred())
+        release = [&map]{ map.defer_rehash(false); };
+    void* shared;
+    try{
+        shared = SnapshotHandle::make_shared_page(map.count());
+    }catch(...){
+        writer.discard();
+        throw;
+    }
+
+    pid_t pid = ::fork();
+    if (pid < 0){
+        int err = errno;
+        SnapshotHandle::free_shared_page(shared);
+        writer.discard();
+        throw std::system_error(err, std::generic_category(), "snapshot_async: fork");
+    }
+    if (pid == 0)
+        ::_exit(writer.run(map, SnapshotHandle::counter(shared)));
+
+    if (release) map.defer_rehash(true);
+    return SnapshotHandle(pid, shared, std::move(release));
+}
+
+#endif /* MySnapshot_hpp */
@@ -0,0 +1,410 @@
+//
+//  my_soa_unordered_map.hpp
+//  MySpace
+//
+
+#ifndef MySoAUnorderedMap_hpp
+#define MySoAUnorderedMap_hpp
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+
+#include "my_unordered_map.hpp"
+#include "my_span.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MySoAUnorderedMap is an associative container with unique keys in structure-of-arrays layout.
+        Keys, full hashes and values live in three dense arrays indexed by position, and buckets chain positions through a fourth array.
+        Scans over keys_span() or values_span() touch only the array they read, so reductions over values run at memory bandwidth.
+        Erase moves the last element into the hole, so positions of other elements may change.
+ */
+class MySoAUnorderedMap{
+    using item = std::pair<Key, T>;
+
+    static constexpr uint32_t __nil = uint32_t(-1);
+
+    Hash hash;
+    Cmp cmp;
+
+    std::vector<Key> __keys;
+    std::vector<size_t> __hashes;
+    std::vector<T> __values;
+    std::vector<uint32_t> __next;
+    std::vector<uint32_t> __heads;
+
+    float __max_load_factor = 1;
+
+
+    void __rehash(size_t new_size){
+        __heads.assign(new_size, __nil);
+        for (uint32_t i = 0; i < __keys.size(); ++i){
+            size_t b = __constrain_hash(__hashes[i], new_size);
+            __next[i] = __heads[b];
+            __heads[b] = i;
+        }
+    }
+
+
+    void __grow(){
+        if (__heads.size() * __max_load_factor < __keys.size() + 1)
+            __rehash(std::max<size_t>(2 * __keys.size() + 1, size_t(ceil(float(__keys.size() + 1) / __max_load_factor))));
+    }
+
+
+    uint32_t __find(const Key& key, size_t h) const noexcept{
+        if (__heads.empty()) return __nil;
+        for (uint32_t i = __heads[__constrain_hash(h, __heads.size())]; i != __nil; i = __next[i]){
+            if (__hashes[i] == h && cmp(__keys[i], key)) return i;
+        }
+        return __nil;
+    }
+
+
+    // returns the link that points to position i
+    uint32_t* __link_to(uint32_t i) noexcept{
+        uint32_t* link = &__heads[__constrain_hash(__hashes[i], __heads.size())];
+        while (*link != i)
+            link = &__next[*link];
+        return link;
+    }
+
+
+    // makes room for one more element in every array, so that the appends of __append cannot reallocate
+    void __reserve_one(){
+        size_t n = __keys.size() + 1;
+        if (n <= __keys.capacity() && n <= __hashes.capacity() && n <= __values.capacity() && n <= __next.capacity()) return;
+        size_t cap = std::max<size_t>(n, 2 * __keys.size());
+        __keys.reserve(cap);
+        __hashes.reserve(cap);
+        __values.reserve(cap);
+        __next.reserve(cap);
+    }
+
+
+    // appends an element known to be absent, h being the hash of key. Only the constructors of Key and T may throw, and then the arrays keep equal lengths.
+    template<typename K, typename V>
+    size_t __append(K&& key, V&& value, size_t h){
+        if (__keys.size() >= __nil)
+            throw std::length_error("MySoAUnorderedMap::insert: too many elements");
+        __reserve_one();
+        __grow();
+        __keys.push_back(std::forward<K>(key));
+        try{
+            __values.push_back(std::forward<V>(value));
+        }catch(...){
+            __keys.pop_back();
+            throw;
+        }
+        size_t b = __constrain_hash(h, __heads.size());
+        __hashes.push_back(h);
+        __next.push_back(__heads[b]);
+        __heads[b] = uint32_t(__keys.size() - 1);
+        return __keys.size() - 1;
+    }
+
+
+    template<typename K, typename V>
+    std::pair<size_t, bool> __insert(K&& key, V&& value){
+        size_t h = hash(key);
+        uint32_t i = __find(key, h);
+        if (i != __nil) return std::make_pair(size_t(i), false);
+        return std::make_pair(__append(std::forward<K>(key), std::forward<V>(value), h), true);
+    }
+
+public:
+
+    static constexpr size_t npos = size_t(-1);
+
+
+    /**
+     @brief default constructor. Constructs an empty map.
+     */
+    MySoAUnorderedMap() = default;
+
+
+    /**
+     @brief constructs the map with the contents of an initializer list
+     @param std::initializer_list<item> list
+     @exception std::bad_alloc();
+     */
+    MySoAUnorderedMap(std::initializer_list<item> list){
+        insert(list);
+    }
+
+
+    /**
+     @brief manages maximum average number of elements per bucket
+        Sets the maximum load factor to ml.
+     @param float f
+     */
+    void max_load_factor(float f) noexcept{
+        __max_load_factor = fabs(f);
+    }
+
+
+    float max_load_factor() const noexcept{
+        return __max_load_factor;
+    }
+
+
+    /**
+     @brief returns the number of buckets
+     */
+    size_t size() const noexcept{
+        return __heads.size();
+    }
+
+
+    /**
+     @brief returns the number of elements
+     */
+    size_t count() const noexcept{
+        return __keys.size();
+    }
+
+
+    bool empty() const noexcept{
+        return __keys.empty();
+    }
+
+
+    /**
+     @brief returns average number of elements per bucket
+     @returns float
+     */
+    float load_factor() const noexcept{
+        return __heads.empty() ? 0 : float(__keys.size()) / __heads.size();
+    }
+
+
+    /**
+     @brief Sets the number of buckets to count and rehashes the container. Stored hashes are reused, keys are not hashed again.
+     @param size_t new_size
+     @exception std::out_of_range, std::bad_alloc();
+     */
+    void rehash(size_t new_size){
+        if (new_size * __max_load_factor < __keys.size())
+            throw std::out_of_range("MySoAUnorderedMap::rehash: index is less then the minimum possible");
+        __rehash(new_size);
+    }
+
+
+    /**
+     @brief reserves space for count elements in every array and sets the number of buckets accordingly
+     @param size_t count
+     @exception std::bad_alloc();
+     */
+    void reserve(size_t count){
+        __keys.reserve(count);
+        __hashes.reserve(count);
+        __values.reserve(count);
+        __next.reserve(count);
+        size_t need = size_t(ceil(float(count) / __max_load_factor));
+        if (need > __heads.size())
+            __rehash(need);
+    }
+
+
+    /**
+     @brief Inserts element into the container, if the container doesn't already contain an element with an equivalent key.
+     @param const item& pair
+     @returns std::pair<size_t, bool>, the position of the element and whether the insertion took place
+     @exception std::bad_alloc();
+     */
+    std::pair<size_t, bool> insert(const item& pair){
+        return __insert(pair.first, pair.second);
+    }
+
+
+    /**
+     @brief Inserts element into the container, if the container doesn't already contain an element with an equivalent key.
+     @param item&& pair
+     @returns std::pair<size_t, bool>
+     @exception std::bad_alloc();
+     */
+    std::pair<size_t, bool> insert(item&& pair){
+        return __insert(std::move(pair.first), std::move(pair.second));
+    }
+
+
+    /**
+     @brief Inserts element(s) into the container, if the container doesn't already contain an element with an equivalent key.
+     @param std::initializer_list<item> list
+     @exception std::bad_alloc();
+     */
+    void insert(std::initializer_list<item> list){
+        for (auto& i : list)
+            insert(i);
+    }
+
+
+    /**
+     @brief Inserts a new element constructed from key and value if there is no element with the key in the container.
+     @param K&& key
+     @param V&& value
+     @returns std::pair<size_t, bool>
+     @exception std::bad_alloc();
+     */
+    template<typename K, typename V>
+    std::pair<size_t, bool> emplace(K&& key, V&& value){
+        return __insert(Key(std::forward<K>(key)), T(std::forward<V>(value)));
+    }
+
+
+    /**
+     @brief Returns a reference to the value that is mapped to a key equivalent to key, performing an insertion if such key does not already exist.
+     @param const Key& key
+     @returns T&
+     @exception std::bad_alloc();
+     */
+    T& operator[](const Key& key){
+        size_t h = hash(key);
+        uint32_t i = __find(key, h);
+        if (i != __nil) return __values[i];
+        return __values[__append(key, T(), h)];
+    }
+
+
+    T& operator[](Key&& key){
+        size_t h = hash(key);
+        uint32_t i = __find(key, h);
+        if (i != __nil) return __values[i];
+        return __values[__append(std::move(key), T(), h)];
+    }
+
+
+    /**
+     @brief Returns a reference to the value mapped to key.
+     @param const Key& key
+     @returns T&
+     @exception std::out_of_range
+     */
+    T& at(const Key& key){
+        uint32_t i = __find(key, hash(key));
+        if (i == __nil)
+            throw std::out_of_range("MySoAUnorderedMap::at: no such key");
+        return __values[i];
+    }
+
+
+    const T& at(const Key& key) const{
+        uint32_t i = __find(key, hash(key));
+        if (i == __nil)
+            throw std::out_of_range("MySoAUnorderedMap::at: no such key");
+        return __values[i];
+    }
+
+
+    /**
+     @brief Finds an element with key equivalent to key.
+     @param const Key& key
+     @returns size_t, the position of the element in keys_span() and values_span() or npos
+     */
+    size_t find(const Key& key) const noexcept{
+        uint32_t i = __find(key, hash(key));
+        return i == __nil ? npos : i;
+    }
+
+
+    bool contains(const Key& key) const noexcept{
+        return __find(key, hash(key)) != __nil;
+    }
+
+
+    const Key& key_at(size_t i) const noexcept{
+        return __keys[i];
+    }
+
+
+    T& value_at(size_t i) noexcept{
+        return __values[i];
+    }
+
+
+    const T& value_at(size_t i) const noexcept{
+        return __values[i];
+    }
+
+
+    /**
+     @brief returns all keys as one dense array. Position i of keys_span() corresponds to position i of values_span().
+     @returns MySpan<const Key>
+     */
+    MySpan<const Key> keys_span() const noexcept{
+        return MySpan<const Key>(__keys.data(), __keys.size());
+    }
+
+
+    /**
+     @brief returns all values as one dense array
+     @returns MySpan<T>
+     */
+    MySpan<T> values_span() noexcept{
+        return MySpan<T>(__values.data(), __values.size());
+    }
+
+
+    MySpan<const T> values_span() const noexcept{
+        return MySpan<const T>(__values.data(), __values.size());
+    }
+
+
+    /**
+     @brief returns the full hashes of all keys as one dense array
+     @returns MySpan<const size_t>
+     */
+    MySpan<const size_t> hashes_span() const noexcept{
+        return MySpan<const size_t>(__hashes.data(), __hashes.size());
+    }
+
+
+    /**
+     @brief References and positions of the erased element and of the last element are invalidated: the last element is moved into the hole.
+     @param const Key& key
+     @returns bool
+     */
+    bool erase(const Key& key){
+        uint32_t i = __find(key, hash(key));
+        if (i == __nil) return false;
+
+        *__link_to(i) = __next[i];
+        uint32_t last = uint32_t(__keys.size() - 1);
+        if (i != last){
+            *__link_to(last) = i;
+            __keys[i] = std::move(__keys[last]);
+            __hashes[i] = __hashes[last];
+            __values[i] = std::move(__values[last]);
+            __next[i] = __next[last];
+        }
+        __keys.pop_back();
+        __hashes.pop_back();
+        __values.pop_back();
+        __next.pop_back();
+        return true;
+    }
+
+
+    /**
+     @brief Erases all elements from the container. After this call, count() returns zero.
+     */
+    void clear() noexcept{
+        __keys.clear();
+        __hashes.clear();
+        __values.clear();
+        __next.clear();
+        __heads.clear();
+    }
+};
+
+#endif /* MySoAUnorderedMap_hpp */
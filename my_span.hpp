@@ -0,0 +1,82 @@
+//
+//  my_span.hpp
+//  MySpace
+//
+
+#ifndef MySpan_hpp
+#define MySpan_hpp
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+
+/**!
+ @brief MySpan is a non-owning view over a contiguous sequence of objects. It is returned by containers that keep their elements in dense arrays.
+ */
+template<typename T>
+class MySpan{
+    T* __data = nullptr;
+    size_t __size = 0;
+
+public:
+    using value_type = std::remove_cv_t<T>;
+    using iterator = T*;
+
+    MySpan() = default;
+
+    MySpan(T* data, size_t size) noexcept: __data(data), __size(size){}
+
+    MySpan(T* first, T* last) noexcept: __data(first), __size(last - first){}
+
+
+    iterator begin() const noexcept{
+        return __data;
+    }
+
+    iterator end() const noexcept{
+        return __data + __size;
+    }
+
+    T* data() const noexcept{
+        return __data;
+    }
+
+    /**
+     @brief returns the number of elements in the view
+     */
+    size_t size() const noexcept{
+        return __size;
+    }
+
+    bool empty() const noexcept{
+        return __size == 0;
+    }
+
+    T& operator[](size_t i) const noexcept{
+        return __data[i];
+    }
+
+
+    /**
+     @brief returns a reference to the element at position i with bounds checking
+     @param size_t i
+     @returns T&
+     @exception std::out_of_range
+     */
+    T& at(size_t i) const{
+        if (i >= __size)
+            throw std::out_of_range("MySpan::at: index is out of range");
+        return __data[i];
+    }
+
+    T& front() const noexcept{
+        return *__data;
+    }
+
+    T& back() const noexcept{
+        return __data[__size - 1];
+    }
+};
+
+#endif /* MySpan_hpp */
@@ -0,0 +1,208 @@
+//
+//  my_spsc_ring.hpp
+//  MySpace
+//
+
+#ifndef MySpscRing_hpp
+#define MySpscRing_hpp
+
+#include <new>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+
+
+/**!
+ @brief MySpscRing is a lock-free single-producer single-consumer queue of variable-length byte records laid out in a memory region supplied by the caller.
+        The region holds the whole state, two monotonic byte counters and the data, and no pointers, so it can be a shared memory mapping used by two processes.
+        A record is a 4-byte length followed by its bytes, padded to 8 bytes. A record that does not fit before the end of the data wraps to its start, leaving a wrap marker.
+        The producer writes with reserve() and commit(), the consumer reads with poll(); each side caches the other's counter and reloads it only when it runs out.
+ */
+class MySpscRing{
+    static constexpr uint64_t __magic = 0x4d59535053435247ull;
+    static constexpr uint32_t __wrap = std::numeric_limits<uint32_t>::max();
+
+    struct __header{
+        uint64_t magic;
+        uint64_t capacity;
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "MySpscRing: 64-bit atomics must be lock-free to be shared between processes");
+
+    __header* __h;
+    char* __data;
+    uint64_t __cap;
+
+    // producer side
+    uint64_t __cached_tail = 0;
+    uint64_t __pending = 0;
+
+    // consumer side
+    uint64_t __cached_head = 0;
+
+
+    static size_t __record(size_t n) noexcept{
+        return (4 + n + 7) & ~size_t(7);
+    }
+
+public:
+
+    /**
+     @brief returns the number of bytes a region must have to hold capacity bytes of records
+     @param size_t capacity
+     @returns size_t
+     */
+    static size_t region_size(size_t capacity) noexcept{
+        return sizeof(__header) + (capacity & ~size_t(7));
+    }
+
+
+    /**
+     @brief places a ring into region or attaches to the one already there. Only one side creates the ring, before the other attaches.
+     @param void* region, aligned to 64 bytes
+     @param size_t bytes, the size of region
+     @param bool create
+     @exception std::invalid_argument
+     */
+    MySpscRing(void* region, size_t bytes, bool create){
+        if (region == nullptr || reinterpret_cast<uintptr_t>(region) % alignof(__header) != 0 || bytes < sizeof(__header) + 64)
+            throw std::invalid_argument("MySpscRing: region is too small or misaligned");
+        __data = static_cast<char*>(region) + sizeof(__header);
+        if (create){
+            __h = new (region) __header;
+            __h->magic = __magic;
+            __h->capacity = (bytes - sizeof(__header)) & ~size_t(7);
+            __h->head.store(0, std::memory_order_relaxed);
+            __h->tail.store(0, std::memory_order_relaxed);
+        }else{
+            __h = static_cast<__header*>(region);
+            if (__h->magic != __magic || __h->capacity > bytes - sizeof(__header))
+                throw std::invalid_argument("MySpscRing: region does not contain a ring");
+        }
+        __cap = __h->capacity;
+        __cached_tail = __h->tail.load(std::memory_order_acquire);
+        __cached_head = __h->head.load(std::memory_order_acquire);
+    }
+
+
+    MySpscRing(const MySpscRing&) = delete;
+    MySpscRing& operator=(const MySpscRing&) = delete;
+
+
+    /**
+     @brief returns the number of bytes available for records
+     */
+    size_t capacity() const noexcept{
+        return __cap;
+    }
+
+
+    /**
+     @brief returns the largest record that can ever be reserved
+     */
+    size_t max_record() const noexcept{
+        return __cap / 2 - 8;
+    }
+
+
+    /**
+     @brief returns the number of bytes written and not yet consumed
+     */
+    size_t used() const noexcept{
+        return size_t(__h->head.load(std::memory_order_acquire) - __h->tail.load(std::memory_order_acquire));
+    }
+
+
+    /**
+     @brief producer: returns n writable bytes of the next record, or nullptr when the consumer has not freed enough space.
+        The record becomes visible to the consumer at commit().
+     @param size_t n
+     @returns char*
+     @exception std::length_error, when n exceeds max_record()
+     */
+    char* reserve(size_t n){
+        if (n > max_record())
+            throw std::length_error("MySpscRing::reserve: record is larger than half of the ring");
+        uint64_t head = __h->head.load(std::memory_order_relaxed);
+        size_t total = __record(n);
+        size_t off = size_t(head % __cap);
+        size_t skip = off + total > __cap ? __cap - off : 0;
+        if (head + skip + total - __cached_tail > __cap){
+            __cached_tail = __h->tail.load(std::memory_order_acquire);
+            if (head + skip + total - __cached_tail > __cap)
+                return nullptr;
+        }
+        if (skip){
+            memcpy(__data + off, &__wrap, 4);
+            head += skip;
+            off = 0;
+        }
+        uint32_t len = uint32_t(n);
+        memcpy(__data + off, &len, 4);
+        __pending = head + total;
+        return __data + off + 4;
+    }
+
+
+    /**
+     @brief producer: publishes the record returned by the last reserve()
+     */
+    void commit() noexcept{
+        __h->head.store(__pending, std::memory_order_release);
+    }
+
+
+    /**
+     @brief producer: copies n bytes into a new record
+     @param const void* p
+     @param size_t n
+     @returns bool, false when the ring is full
+     @exception std::length_error
+     */
+    bool try_push(const void* p, size_t n){
+        char* dst = reserve(n);
+        if (dst == nullptr) return false;
+        memcpy(dst, p, n);
+        commit();
+        return true;
+    }
+
+
+    /**
+     @brief consumer: calls f(const char* data, size_t n) for up to max published records in order and releases their space.
+        If f throws, the record it was given stays in the ring.
+     @param F&& f
+     @param size_t max
+     @returns size_t, the number of records consumed
+     */
+    template<typename F>
+    size_t poll(F&& f, size_t max = std::numeric_limits<size_t>::max()){
+        uint64_t tail = __h->tail.load(std::memory_order_relaxed);
+        size_t res = 0;
+        while (res < max){
+            if (tail == __cached_head){
+                __cached_head = __h->head.load(std::memory_order_acquire);
+                if (tail == __cached_head) break;
+            }
+            size_t off = size_t(tail % __cap);
+            uint32_t len;
+            memcpy(&len, __data + off, 4);
+            if (len == __wrap){
+                tail += __cap - off;
+                continue;
+            }
+            f(static_cast<const char*>(__data + off + 4), size_t(len));
+            tail += __record(len);
+            __h->tail.store(tail, std::memory_order_release);
+            ++res;
+        }
+        return res;
+    }
+};
+
+#endif /* MySpscRing_hpp */
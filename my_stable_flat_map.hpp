@@ -0,0 +1,458 @@
+//
+//  my_stable_flat_map.hpp
+//  MySpace
+//
+
+#ifndef MyStableFlatMap_hpp
+#define MyStableFlatMap_hpp
+
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+#include "my_slab_pool.hpp"
+
+
+template <typename Key,
+            typename T,
+            typename Hash = std::hash<Key>,
+            typename Cmp = std::equal_to<Key> >
+
+/**!
+ @brief MyStableFlatMap is an associative container with unique keys that combines an open-addressed table with stable references.
+        The table holds one control byte (a 7-bit tag of the hash, or empty / deleted) and one pointer per slot; elements live in a slab pool and never move.
+        A lookup loads a group of 8 control bytes as one word, compares all tags at once and dereferences only the pointers whose tag matched.
+        References and pointers to elements stay valid across rehash; only erase of the element itself invalidates them.
+ */
+class MyStableFlatMap{
+    using item = std::pair<Key, T>;
+    using sfmap = MyStableFlatMap;
+
+    static constexpr size_t __group = 8;
+    static constexpr uint8_t __ctrl_empty = 0x80;
+    static constexpr uint8_t __ctrl_deleted = 0xFE;
+    static constexpr uint64_t __lsbs = 0x0101010101010101ull;
+    static constexpr uint64_t __msbs = 0x8080808080808080ull;
+
+    Hash hash;
+    Cmp cmp;
+
+    MySlabPool<item> __pool;
+    std::vector<uint8_t> __ctrl;
+    std::vector<item*> __slots;
+
+    size_t __count = 0;
+    size_t __growth_left = 0;
+
+
+    static size_t __mix(size_t h) noexcept{
+        uint64_t x = uint64_t(h) * 0x9E3779B97F4A7C15ull;
+        return size_t(x ^ (x >> 32));
+    }
+
+    static uint8_t __tag(size_t h) noexcept{
+        return uint8_t(h >> (sizeof(size_t) * 8 - 7));
+    }
+
+    uint64_t __load(size_t g) const noexcept{
+        uint64_t word;
+        memcpy(&word, __ctrl.data() + g * __group, sizeof(word));
+        return word;
+    }
+
+    static uint64_t __match(uint64_t word, uint8_t tag) noexcept{
+        uint64_t x = word ^ (__lsbs * tag);
+        return (x - __lsbs) & ~x & __msbs;
+    }
+
+    static uint64_t __match_empty(uint64_t word) noexcept{
+        return word & ~(word << 6) & __msbs;
+    }
+
+    static uint64_t __match_free(uint64_t word) noexcept{
+        return word & __msbs;
+    }
+
+    static size_t __lowest(uint64_t mask) noexcept{
+        return size_t(__builtin_ctzll(mask)) / 8;
+    }
+
+
+    // triangular probing over groups visits every group of a power of two table
+    size_t __find_slot(const Key& key, size_t h) const noexcept{
+        if (__slots.empty()) return npos;
+        size_t groups_mask = __slots.size() / __group - 1;
+        uint8_t tag = __tag(h);
+        for (size_t g = h & groups_mask, step = 1; step <= groups_mask + 1; g = (g + step++) & groups_mask){
+            uint64_t word = __load(g);
+            for (uint64_t m = __match(word, tag); m; m &= m - 1){
+                size_t s = g * __group + __lowest(m);
+                if (__ctrl[s] == tag && cmp(__slots[s]->first, key)) return s;
+            }
+            if (__match_empty(word)) return npos;
+        }
+        return npos;
+    }
+
+
+    size_t __free_slot(size_t h) const noexcept{
+        size_t groups_mask = __slots.size() / __group - 1;
+        for (size_t g = h & groups_mask, step = 1; ; g = (g + step++) & groups_mask){
+            uint64_t m = __match_free(__load(g));
+            if (m) return g * __group + __lowest(m);
+        }
+    }
+
+
+    void __rehash(size_t new_size){
+        std::vector<uint8_t> ctrl(new_size, __ctrl_empty);
+        std::vector<item*> slots(new_size, nullptr);
+        std::swap(ctrl, __ctrl);
+        std::swap(slots, __slots);
+        for (size_t s = 0; s < ctrl.size(); ++s){
+            if (ctrl[s] & 0x80) continue;
+            size_t h = __mix(hash(slots[s]->first));
+            size_t d = __free_slot(h);
+            __ctrl[d] = __tag(h);
+            __slots[d] = slots[s];
+        }
+        __growth_left = new_size - new_size / 8 - __count;
+    }
+
+
+    static size_t __size_for(size_t count) noexcept{
+        size_t size = __group;
+        while (size - size / 8 < count)
+            size <<= 1;
+        return size;
+    }
+
+
+    template<typename K, typename ...Args>
+    std::pair<item*, bool> __insert(K&& key, Args&&... args){
+        size_t h = __mix(hash(key));
+        size_t s = __find_slot(key, h);
+        if (s != npos) return std::make_pair(__slots[s], false);
+
+        if (__growth_left == 0)
+            // a table full of tombstones is cleaned in place, otherwise it doubles
+            __rehash(__count * 2 < __slots.size() - __slots.size() / 8 ? __slots.size() : __size_for(__count + 1) * 2);
+        s = __free_slot(h);
+        item* p = __pool.create(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+        __growth_left -= (__ctrl[s] == __ctrl_empty);
+        __ctrl[s] = __tag(h);
+        __slots[s] = p;
+        ++__count;
+        return std::make_pair(p, true);
+    }
+
+public:
+
+    static constexpr size_t npos = size_t(-1);
+
+
+    template<bool is_const>
+    class Any_iterator{
+        std::conditional_t<is_const, const sfmap, sfmap>* map;
+        size_t s;
+
+        void __skip() noexcept{
+            while (s < map->__ctrl.size() && (map->__ctrl[s] & 0x80))
+                ++s;
+        }
+
+    public:
+        using value_type = item;
+        using iterator_category = std::forward_iterator_tag;
+
+        Any_iterator(std::conditional_t<is_const, const sfmap, sfmap>* map, size_t s): map(map), s(s){
+            __skip();
+        }
+
+        Any_iterator& operator++(){
+            ++s;
+            __skip();
+            return *this;
+        }
+
+        std::conditional_t<is_const, const item, item>* operator->() const{
+            return map->__slots[s];
+        }
+
+        std::conditional_t<is_const, const item, item>& operator*() const{
+            return *map->__slots[s];
+        }
+
+        bool operator==(Any_iterator iter) const{
+            return s == iter.s;
+        }
+
+        bool operator!=(Any_iterator iter) const{
+            return !(*this == iter);
+        }
+    };
+
+    using const_iterator = Any_iterator<true>;
+    using iterator = Any_iterator<false>;
+
+    iterator begin(){
+        return iterator(this, 0);
+    }
+
+    iterator end(){
+        return iterator(this, __ctrl.size());
+    }
+
+    const_iterator cbegin() const{
+        return const_iterator(this, 0);
+    }
+
+    const_iterator cend() const{
+        return const_iterator(this, __ctrl.size());
+    }
+
+
+    /**
+     @brief default constructor. Constructs an empty map.
+     */
+    MyStableFlatMap() = default;
+
+    MyStableFlatMap(const sfmap&) = delete;
+
+    sfmap& operator=(const sfmap&) = delete;
+
+
+    /**
+     @brief move constructor. Elements are not moved, so references into map stay valid and now refer into this container.
+     @param MyStableFlatMap&& map
+     */
+    MyStableFlatMap(sfmap&& map) noexcept: hash(std::move(map.hash)), cmp(std::move(map.cmp)), __pool(std::move(map.__pool)),
+    __ctrl(std::move(map.__ctrl)), __slots(std::move(map.__slots)), __count(map.__count), __growth_left(map.__growth_left){
+        map.__ctrl.clear();
+        map.__slots.clear();
+        map.__count = 0;
+        map.__growth_left = 0;
+    }
+
+
+    /**
+     @brief move assignment. The elements of this container are destroyed; those of map are not moved, so references into map stay valid.
+     @param MyStableFlatMap&& map
+     @returns MyStableFlatMap&
+     */
+    sfmap& operator=(sfmap&& map) noexcept{
+        if (this != &map){
+            clear();
+            hash = std::move(map.hash);
+            cmp = std::move(map.cmp);
+            __pool = std::move(map.__pool);
+            __ctrl = std::move(map.__ctrl);
+            __slots = std::move(map.__slots);
+            __count = map.__count;
+            __growth_left = map.__growth_left;
+            map.__ctrl.clear();
+            map.__slots.clear();
+            map.__count = 0;
+            map.__growth_left = 0;
+        }
+        return *this;
+    }
+
+
+    /**
+     @brief constructs the map with the contents of an initializer list
+     @param std::initializer_list<item> list
+     @exception std::bad_alloc();
+     */
+    MyStableFlatMap(std::initializer_list<item> list){
+        insert(list);
+    }
+
+
+    /**
+     @brief returns the number of slots
+     */
+    size_t size() const noexcept{
+        return __slots.size();
+    }
+
+
+    /**
+     @brief returns the number of elements
+     */
+    size_t count() const noexcept{
+        return __count;
+    }
+
+
+    bool empty() const noexcept{
+        return __count == 0;
+    }
+
+
+    /**
+     @brief returns the ratio of elements to slots
+     @returns float
+     */
+    float load_factor() const noexcept{
+        return __slots.empty() ? 0 : float(__count) / __slots.size();
+    }
+
+
+    /**
+     @brief makes room for count elements without rehashing. Elements are not moved.
+     @param size_t count
+     @exception std::bad_alloc();
+     */
+    void reserve(size_t count){
+        size_t size = __size_for(count);
+        if (size > __slots.size())
+            __rehash(size);
+    }
+
+
+    /**
+     @brief Inserts element into the container, if the container doesn't already contain an element with an equivalent key.
+     @param const item& pair
+     @returns std::pair<item*, bool>, a stable pointer to the element and whether the insertion took place
+     @exception std::bad_alloc();
+     */
+    std::pair<item*, bool> insert(const item& pair){
+        return __insert(pair.first, pair.second);
+    }
+
+
+    std::pair<item*, bool> insert(item&& pair){
+        return __insert(std::move(pair.first), std::move(pair.second));
+    }
+
+
+    void insert(std::initializer_list<item> list){
+        for (auto& i : list)
+            insert(i);
+    }
+
+
+    /**
+     @brief Inserts a new element with the given key and the value constructed in-place from args if there is no element with the key in the container.
+     @param K&& key
+     @param Args&&... args
+     @returns std::pair<item*, bool>, a stable pointer to the element and whether the insertion took place
+     @exception std::bad_alloc();
+     */
+    template<typename K, typename ...Args>
+    std::pair<item*, bool> try_emplace(K&& key, Args&&... args){
+        return __insert(std::forward<K>(key), std::forward<Args>(args)...);
+    }
+
+
+    /**
+     @brief Returns a reference to the value that is mapped to a key equivalent to key, performing an insertion if such key does not already exist.
+        The reference stays valid until the element is erased.
+     @param const Key& key
+     @returns T&
+     @exception std::bad_alloc();
+     */
+    T& operator[](const Key& key){
+        return __insert(key).first->second;
+    }
+
+
+    T& operator[](Key&& key){
+        return __insert(std::move(key)).first->second;
+    }
+
+
+    /**
+     @brief Returns a reference to the value mapped to key.
+     @param const Key& key
+     @returns T&
+     @exception std::out_of_range
+     */
+    T& at(const Key& key){
+        item* p = find(key);
+        if (p == nullptr)
+            throw std::out_of_range("MyStableFlatMap::at: no such key");
+        return p->second;
+    }
+
+
+    /**
+     @brief Finds an element with key equivalent to key.
+     @param const Key& key
+     @returns item*, a stable pointer to the element or nullptr
+     */
+    item* find(const Key& key) noexcept{
+        size_t s = __find_slot(key, __mix(hash(key)));
+        return s == npos ? nullptr : __slots[s];
+    }
+
+
+    const item* find(const Key& key) const noexcept{
+        size_t s = __find_slot(key, __mix(hash(key)));
+        return s == npos ? nullptr : __slots[s];
+    }
+
+
+    bool contains(const Key& key) const noexcept{
+        return find(key) != nullptr;
+    }
+
+
+    /**
+     @brief Erases the element with key equivalent to key. Only references to the erased element are invalidated.
+     @param const Key& key
+     @returns bool
+     */
+    bool erase(const Key& key){
+        size_t s = __find_slot(key, __mix(hash(key)));
+        if (s == npos) return false;
+
+        // no probe sequence ever passed a group that still has an empty byte, so the slot can become empty again
+        if (__match_empty(__load(s / __group))){
+            __ctrl[s] = __ctrl_empty;
+            ++__growth_left;
+        }else __ctrl[s] = __ctrl_deleted;
+        __pool.destroy(__slots[s]);
+        __slots[s] = nullptr;
+        --__count;
+        return true;
+    }
+
+
+    /**
+     @brief returns the number of bytes owned by the map
+     */
+    size_t memory_usage() const noexcept{
+        return __ctrl.capacity() + __slots.capacity() * sizeof(item*) + __pool.memory_usage();
+    }
+
+
+    /**
+     @brief Erases all elements from the container. Invalidates any references, pointers, or iterators referring to contained elements.
+     */
+    void clear() noexcept{
+        for (size_t s = 0; s < __ctrl.size(); ++s){
+            if (!(__ctrl[s] & 0x80))
+                __pool.destroy(__slots[s]);
+        }
+        __pool.clear();
+        __ctrl.clear();
+        __slots.clear();
+        __count = 0;
+        __growth_left = 0;
+    }
+
+
+    ~MyStableFlatMap(){
+        clear();
+    }
+};
+
+#endif /* MyStableFlatMap_hpp */
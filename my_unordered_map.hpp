@@ -15,9 +15,36 @@
 #include <memory>
 #include <algorithm>
 #include <utility>
+#include <vector>
+#include <cstdint>
 #include <type_traits>
+#include <chrono>
+#include <atomic>
+#include <string>
 
-template<typename Key, typename T, typename cmp>
+/**
+ @brief reduces a full hash value to a bucket index in [0, size). Power of two sizes are reduced with a mask.
+ @param size_t hash
+ @param size_t size
+ @returns size_t
+ */
+inline size_t __constrain_hash(size_t hash, size_t size) noexcept{
+    return !(size & (size - 1)) ? hash & (size - 1) :
+        (hash < size ? hash : hash % size);
+}
+
+
+/**
+ @brief decides whether MyUnorderedMap keeps the pair of Key and T inside the node or out of line behind one pointer.
+        By default pairs are stored out of line when an inline node would not fit a cache line, so chain walks, rehash and erase touch only key hash, bucket and next.
+        Specialize for a particular Key and T to override the choice.
+ */
+template<typename Key, typename T>
+struct my_unordered_map_out_of_line: std::integral_constant<bool, (sizeof(std::pair<Key, T>) + 2 * sizeof(size_t) > 64)>{};
+
+
+template<typename Key, typename T, typename cmp, typename Allocator = std::allocator<std::pair<Key, T> >,
+            bool = my_unordered_map_out_of_line<Key, T>::value>
 struct __bucket{
     std::pair<Key, T> item;
     size_t hash = -1;
@@ -25,8 +52,13 @@ struct __bucket{
     
     __bucket() = default;
     
-    __bucket(const std::pair<Key, T>& item, size_t hash, __bucket* next= nullptr): item(item), hash(hash), next(next){}
-    __bucket(std::pair<Key, T>&& item, size_t hash, __bucket* next= nullptr): item(std::move(item)), hash(hash), next(next){}
+    __bucket(const std::pair<Key, T>& item, size_t hash, __bucket* next= nullptr, size_t = 0): item(item), hash(hash), next(next){}
+    __bucket(std::pair<Key, T>&& item, size_t hash, __bucket* next= nullptr, size_t = 0): item(std::move(item)), hash(hash), next(next){}
+    
+    template<typename A>
+    __bucket(A&, const std::pair<Key, T>& item, size_t hash, __bucket* next, size_t full): __bucket(item, hash, next, full){}
+    template<typename A>
+    __bucket(A&, std::pair<Key, T>&& item, size_t hash, __bucket* next, size_t full): __bucket(std::move(item), hash, next, full){}
     
     __bucket(const __bucket& b){
         item = b.item;
@@ -55,6 +87,207 @@ struct __bucket{
         std::swap(next, tmp.next);
         return *this;
     }
+    
+    template<typename A>
+    void release(A&) noexcept{}
+    
+    std::pair<Key, T>& get() noexcept{
+        return item;
+    }
+    
+    const std::pair<Key, T>& get() const noexcept{
+        return item;
+    }
+    
+    // inline nodes do not keep the full hash: the key is in the same cache line anyway
+    size_t stored_hash() const noexcept{
+        return 0;
+    }
+    
+    bool same_hash(size_t) const noexcept{
+        return true;
+    }
+    
+    template<typename H>
+    size_t full_hash(const H& h) const{
+        return h(item.first);
+    }
+};
+
+
+template<typename Key, typename T, typename cmp, typename Allocator>
+struct __bucket<Key, T, cmp, Allocator, true>{
+    std::pair<Key, T>* ptr = nullptr;
+    size_t full = 0;
+    size_t hash = -1;
+    __bucket* next = nullptr;
+    
+    __bucket() = default;
+    
+    // the pair is allocated from alloc, the node allocator of the map, and must be given back with release() before the node is destroyed
+    template<typename A, typename P>
+    __bucket(A& alloc, P&& item, size_t hash, __bucket* next, size_t full): full(full), hash(hash), next(next){
+        ptr = __make(alloc, std::forward<P>(item));
+    }
+    
+    __bucket(const __bucket&) = delete;
+    __bucket& operator=(const __bucket&) = delete;
+    
+    __bucket(__bucket&& b) noexcept: ptr(b.ptr), full(b.full), hash(b.hash), next(b.next){
+        b.ptr = nullptr;
+        b.next = nullptr;
+    }
+    
+    // swaps, so the pair this node held is released together with b
+    __bucket& operator=(__bucket&& b) noexcept{
+        std::swap(ptr, b.ptr);
+        std::swap(full, b.full);
+        std::swap(hash, b.hash);
+        std::swap(next, b.next);
+        return *this;
+    }
+    
+    template<typename A>
+    void release(A& alloc) noexcept{
+        if (ptr == nullptr) return;
+        typename std::allocator_traits<A>::template rebind_alloc<std::pair<Key, T> > a(alloc);
+        using PAllocTraits = std::allocator_traits<decltype(a)>;
+        PAllocTraits::destroy(a, ptr);
+        PAllocTraits::deallocate(a, ptr, 1);
+        ptr = nullptr;
+    }
+    
+    std::pair<Key, T>& get() noexcept{
+        return *ptr;
+    }
+    
+    const std::pair<Key, T>& get() const noexcept{
+        return *ptr;
+    }
+    
+    size_t stored_hash() const noexcept{
+        return full;
+    }
+    
+    // the stored hash filters the chain so only the matching pair is dereferenced
+    bool same_hash(size_t h) const noexcept{
+        return full == h;
+    }
+    
+    template<typename H>
+    size_t full_hash(const H&) const noexcept{
+        return full;
+    }
+    
+private:
+    template<typename A, typename P>
+    static std::pair<Key, T>* __make(A& alloc, P&& item){
+        typename std::allocator_traits<A>::template rebind_alloc<std::pair<Key, T> > a(alloc);
+        using PAllocTraits = std::allocator_traits<decltype(a)>;
+        auto* p = PAllocTraits::allocate(a, 1);
+        try{
+            PAllocTraits::construct(a, p, std::forward<P>(item));
+        }catch(...){
+            PAllocTraits::deallocate(a, p, 1);
+            throw;
+        }
+        return p;
+    }
+};
+
+
+/**!
+ @brief MyMapListener receives the mutations of a MyUnorderedMap it is attached to with set_listener().
+        Events are delivered synchronously in the mutating thread, after the change for inserts and assignments and before it for erasures.
+        Listeners should not throw: the map is already modified when on_insert or on_assign is called, and clear() is noexcept.
+ */
+template<typename Key, typename T>
+struct MyMapListener{
+    virtual void on_insert(const Key& key, const T& value) = 0;
+    virtual void on_assign(const Key& key, const T& value) = 0;
+    virtual void on_erase(const Key& key) = 0;
+    virtual void on_clear() = 0;
+    virtual ~MyMapListener() = default;
+};
+
+
+enum class MyMapOp : uint8_t{
+    find = 0,
+    insert = 1,
+    erase = 2
+};
+
+
+/**
+ @brief returns a cheap timestamp: the time stamp counter on x86, else steady_clock nanoseconds
+ @returns uint64_t
+ */
+inline uint64_t my_ticks() noexcept{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+
+/**
+ @brief returns the rate of my_ticks(), measured on the first call over about a millisecond
+ @returns double
+ */
+inline double my_ticks_per_ns(){
+    static const double rate = []{
+        auto now = []{
+            return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        };
+        uint64_t n0 = now(), t0 = my_ticks(), n1;
+        do{
+            n1 = now();
+        }while (n1 - n0 < 1000000);
+        uint64_t t1 = my_ticks();
+        return std::max(1e-3, double(t1 - t0) / double(n1 - n0));
+    }();
+    return rate;
+}
+
+
+/**!
+ @brief MyMapSampler is asked about every find and insert of a MyUnorderedMap it is attached to with set_sampler(), and told where the key was
+        for the calls it chose to sample. With no sampler attached the map pays one predictable branch per call.
+        Both functions are called concurrently from every thread that uses the map, const lookups included.
+ */
+struct MyMapSampler{
+    // returns whether this call is sampled
+    virtual bool sample() noexcept = 0;
+    // hash is the full hash of the key, position the number of nodes of the chain of bucket before the key, or the chain length on a miss
+    virtual void record(MyMapOp op, size_t hash, size_t bucket, size_t position, bool hit) noexcept = 0;
+    virtual ~MyMapSampler() = default;
+};
+
+
+/**!
+ @brief MyMapRecorder is told about the find, insert and erase calls of a MyUnorderedMap, attached with set_recorder(), that took at least threshold
+        ticks of my_ticks(). With no recorder attached the map pays one predictable branch per call.
+        record() is called concurrently from every thread that uses the map, const lookups included.
+        operator[] and insert_or_assign are recorded once, as a find if the key was present and as an insert otherwise.
+ */
+struct MyMapRecorder{
+    std::atomic<uint64_t> threshold{0};
+
+    // bucket and chain are those of the key after the call, count and buckets the size of the map after the call
+    virtual void record(MyMapOp op, size_t hash, size_t bucket, size_t chain, size_t count, size_t buckets, uint64_t ticks) noexcept = 0;
+    virtual ~MyMapRecorder() = default;
+};
+
+
+struct MyMapName;
+
+/**!
+ @brief MyMapRegistration is the entry of a named MyUnorderedMap in MyMapRegistry. my_map_registry.hpp creates it and defines register_as() and
+        the MyMapName constructor; deleting it takes the map out of the registry, so the map needs nothing else from there.
+ */
+struct MyMapRegistration{
+    virtual ~MyMapRegistration() = default;
 };
 
 
@@ -73,7 +306,7 @@ template <typename Key,
          This allows fast access to individual elements, since once the hash is computed, it refers to the exact bucket the element is placed into.
  */
 class MyUnorderedMap{
-    using bucket = __bucket<Key, T, Cmp>;
+    using bucket = __bucket<Key, T, Cmp, Allocator>;
     using item = std::pair<Key, T>;
     using mumap = MyUnorderedMap;
     using AllocTraits = std::allocator_traits<Allocator>;
@@ -102,11 +335,11 @@ public:
         
         
         std::conditional_t<is_const, const item, item>* operator->(){
-            return &it->item;
+            return &it->get();
         }
         
         std::conditional_t<is_const, const item, item>& operator*(){
-            return it->item;
+            return it->get();
         }
         
         bool operator==(Any_iterator iter){
@@ -140,6 +373,67 @@ public:
         const_iterator it(__end);
         return it;
     }
+    
+    
+    template<bool is_const>
+    class Any_local_iterator{
+        std::conditional_t<is_const, const bucket, bucket>* it;
+        const bucket* last;
+        size_t n;
+        
+    public:
+        using value_type = T;
+        using iterator_category = std::forward_iterator_tag;
+        Any_local_iterator(std::conditional_t<is_const, const bucket, bucket>* p, const bucket* last, size_t n):
+            it(p == last ? nullptr : p), last(last), n(n) {}
+        
+        Any_local_iterator& operator++(){
+            it = it->next;
+            if (it == last || it->hash != n) it = nullptr;
+            return *this;
+        }
+        
+        std::conditional_t<is_const, const item, item>* operator->(){
+            return &it->get();
+        }
+        
+        std::conditional_t<is_const, const item, item>& operator*(){
+            return it->get();
+        }
+        
+        bool operator==(Any_local_iterator iter){
+            return it == iter.it;
+        }
+        
+        bool operator!=(Any_local_iterator iter){
+            return !(*this == iter);
+        }
+    };
+    
+    
+    using const_local_iterator = Any_local_iterator<true>;
+    using local_iterator = Any_local_iterator<false>;
+    
+    /**
+     @brief returns an iterator to the first element of bucket n. Elements of one bucket are adjacent, so the walk stops at the first element of another bucket.
+     @param size_t n
+     @returns local_iterator
+     */
+    local_iterator begin(size_t n){
+        return local_iterator(array == nullptr ? nullptr : array[n].next, __end, n);
+    }
+    
+    local_iterator end(size_t n){
+        return local_iterator(nullptr, __end, n);
+    }
+    
+    const_local_iterator cbegin(size_t n) const{
+        return const_local_iterator(array == nullptr ? nullptr : array[n].next, __end, n);
+    }
+    
+    const_local_iterator cend(size_t n) const{
+        return const_local_iterator(nullptr, __end, n);
+    }
 
     
 private:
@@ -155,17 +449,28 @@ private:
     
     size_t __size = 0;
     size_t __count = 0;
+    size_t __rehashes = 0;
     float __max_load_factor = 1;
+    bool __defer_rehash = false;
+    
+    std::vector<uint64_t> __dirty;      // a bit per range of 1 << __dirty_shift buckets
+    size_t __dirty_shift = 0;
+    bool __track_dirty = false;
+    bool __layout_changed = false;
     
     Buckets* array = nullptr;
     
     bucket __start;
     bucket* __end = B_AllocTraits::allocate(bucket_alloc, 1);
-    
+
+    MyMapListener<Key, T>* __listener = nullptr;
+    MyMapSampler* __sampler = nullptr;
+    MyMapRecorder* __recorder = nullptr;
+    MyMapRegistration* __registration = nullptr;
+
     
     static size_t __constrain_hash(size_t hash, size_t size) noexcept{
-        return !(size & (size - 1)) ? hash & (size - 1) :
-            (hash < size ? hash : hash % size);
+        return ::__constrain_hash(hash, size);
     }
     
     static bool __is_hash_power2(size_t size) noexcept{
@@ -173,57 +478,84 @@ private:
     }
     
     
-    bucket* __bucket_insert(const item& pair, size_t h){
+    void __mark_dirty(size_t h) noexcept{
+        if (__track_dirty){
+            size_t r = h >> __dirty_shift;
+            __dirty[r >> 6] |= uint64_t(1) << (r & 63);
+        }
+    }
+    
+    
+    // every range is dirty and the bucket of a key may have changed, so an incremental checkpoint must write a full image
+    void __mark_all_dirty(size_t buckets){
+        if (!__track_dirty) return;
+        size_t ranges = (buckets + (size_t(1) << __dirty_shift) - 1) >> __dirty_shift;
+        __dirty.assign(std::max<size_t>(1, (ranges + 63) / 64), ~uint64_t(0));
+        __layout_changed = true;
+    }
+    
+    
+    // an out-of-line node gives its pair back to the node allocator before the node itself
+    void __free_node(bucket* g) noexcept{
+        g->release(bucket_alloc);
+        B_AllocTraits::destroy(bucket_alloc, g);
+        B_AllocTraits::deallocate(bucket_alloc, g, 1);
+    }
+    
+    
+    bucket* __bucket_insert(const item& pair, size_t h, size_t fh){
         if (array[h].next == nullptr){
             array[h].next = B_AllocTraits::allocate(bucket_alloc, 1);
-            B_AllocTraits::construct(bucket_alloc, array[h].next, pair, h, __start.next);
+            B_AllocTraits::construct(bucket_alloc, array[h].next, bucket_alloc, pair, h, __start.next, fh);
             
             __start.next = array[h].next;
             return array[h].next;
         }
         auto* g = array[h].next;
-        if (cmp(g->item.first, pair.first)) return nullptr;
+        if (g->same_hash(fh) && cmp(g->get().first, pair.first)) return nullptr;
         
         while(g->next != __end && g->next->hash == h){
-            if (cmp(g->item.first, pair.first)) return nullptr;
+            if (g->same_hash(fh) && cmp(g->get().first, pair.first)) return nullptr;
             g = g->next;
         }
         
-        if (cmp(g->item.first, pair.first)) return nullptr;
+        if (g->same_hash(fh) && cmp(g->get().first, pair.first)) return nullptr;
         
         auto* next = g->next;
         g->next = B_AllocTraits::allocate(bucket_alloc, 1);
-        B_AllocTraits::construct(bucket_alloc, g->next, pair, h, next);
+        B_AllocTraits::construct(bucket_alloc, g->next, bucket_alloc, pair, h, next, fh);
         return g->next;
     }
     
     
-    bucket* __bucket_insert(item&& pair, size_t h){
+    bucket* __bucket_insert(item&& pair, size_t h, size_t fh){
         if (array[h].next == nullptr){
             array[h].next = B_AllocTraits::allocate(bucket_alloc, 1);
-            B_AllocTraits::construct(bucket_alloc, array[h].next, std::move(pair), h, __start.next);
+            B_AllocTraits::construct(bucket_alloc, array[h].next, bucket_alloc, std::move(pair), h, __start.next, fh);
             
             __start.next = array[h].next;
             return array[h].next;
         }
         auto* g = array[h].next;
-        if (cmp(g->item.first, pair.first)) return nullptr;
+        if (g->same_hash(fh) && cmp(g->get().first, pair.first)) return nullptr;
         
         while(g->next != __end && g->next->hash == h){
-            if (cmp(g->item.first, pair.first)) return nullptr;
+            if (g->same_hash(fh) && cmp(g->get().first, pair.first)) return nullptr;
             g = g->next;
         }
         
-        if (cmp(g->item.first, pair.first)) return nullptr;
+        if (g->same_hash(fh) && cmp(g->get().first, pair.first)) return nullptr;
         
         auto* next = g->next;
         g->next = B_AllocTraits::allocate(bucket_alloc, 1);
-        B_AllocTraits::construct(bucket_alloc, g->next, std::move(pair), h, next);
+        B_AllocTraits::construct(bucket_alloc, g->next, bucket_alloc, std::move(pair), h, next, fh);
         return g->next;
     }
     
     
     void __rehash(size_t new_size){
+        __mark_all_dirty(new_size);
+        ++__rehashes;
         Buckets* newarr = A_AllocTraits::allocate(array_alloc, new_size);
         for (size_t i = 0; i < new_size; ++i)
             A_AllocTraits::construct(array_alloc, newarr + i);
@@ -235,7 +567,7 @@ private:
         __start.next = __end;
         __size = new_size;
         while(i != __end){
-            size_t h = __constrain_hash(hash(i->item.first), __size);
+            size_t h = __constrain_hash(i->full_hash(hash), __size);
             bucket* tmp = i->next;
             if (array[h].next == nullptr){
                 i->next = __start.next;
@@ -252,44 +584,148 @@ private:
     }
 
     
+    bucket* __find_hashed(const Key& key, size_t fh) const noexcept{
+        size_t h = __constrain_hash(fh, __size);
+        
+        if (array[h].next == nullptr) return __end;
+        
+        for(bucket* g = array[h].next; g != __end && h == g->hash; g = g->next){
+            if (g->same_hash(fh) && cmp(g->get().first, key)) return g;
+        }
+        return __end;
+    }
+    
+    
     bucket* __find(const Key& key) noexcept{
-        size_t h = hash(key);
-        h = __constrain_hash(h, __size);
+        size_t fh = hash(key);
+        size_t h = __constrain_hash(fh, __size);
         
         if (array[h].next == nullptr) return __end;
         
         for(bucket* g = array[h].next; g != __end && h == g->hash; g = g->next){
-            if (cmp(g->item.first, key)) return g;
+            if (g->same_hash(fh) && cmp(g->get().first, key)) return g;
         }
         return __end;
     }
     
     
     const bucket* __find(const Key& key) const noexcept{
-        size_t h = hash(key);
-        h = __constrain_hash(h, __size);
+        size_t fh = hash(key);
+        size_t h = __constrain_hash(fh, __size);
         
         if (array[h].next == nullptr) return __end;
         
         for(bucket* g = array[h].next; g != __end && h == g->hash; g = g->next){
-            if (cmp(g->item.first, key)) return g;
+            if (g->same_hash(fh) && cmp(g->get().first, key)) return g;
         }
         return __end;
     }
     
     
     bucket* __find(Key&& key) noexcept{
-        size_t h = hash(key);
-        h = __constrain_hash(h, __size);
+        size_t fh = hash(key);
+        size_t h = __constrain_hash(fh, __size);
         
         if (array[h].next == nullptr) return __end;
         
         for(bucket* g = array[h].next; g != __end && h == g->hash; g = g->next){
-            if (cmp(g->item.first, key)) return g;
+            if (g->same_hash(fh) && cmp(g->get().first, key)) return g;
         }
         return __end;
     }
+
+
+    // the lookup behind the public calls, which time and sample it; a hit marks its range dirty, since the caller may change the value
+    bucket* __lookup(const Key& key, size_t fh) noexcept{
+        if (array == nullptr) return __end;
+        bucket* g = __find_hashed(key, fh);
+        if (g != __end) __mark_dirty(g->hash);
+        return g;
+    }
     
+    
+    // the insert behind the public calls, which time and sample it; fh is the hash of pair.first. Returns nullptr if the key is present.
+    template<typename P>
+    bucket* __insert_hashed(P&& pair, size_t fh){
+        if ((!__defer_rehash || __size == 0) && __size * __max_load_factor < __count + 1)
+            __rehash(std::max<size_t>(2 * __count + !__is_hash_power2(__count),
+            size_t(ceil(float(__count + 1) / __max_load_factor))));
+        
+        size_t h = __constrain_hash(fh, __size);
+        auto* res = __bucket_insert(std::forward<P>(pair), h, fh);
+        if (res){
+            ++__count;
+            __mark_dirty(h);
+            if (__listener) __listener->on_insert(res->get().first, res->get().second);
+        }
+        return res;
+    }
+
+
+    /*
+     times a call for the recorder; a call slower than the threshold is reported with the bucket of the key and the length of its chain.
+     the timer hashes the key itself, inside the timed region, and the call reuses that hash through hash()
+     */
+    class __op_timer{
+        const mumap& __map;
+        MyMapRecorder* __rec;
+        MyMapOp __op;
+        size_t __fh = 0;
+        uint64_t __start = 0;
+        
+    public:
+        __op_timer(const mumap& map, MyMapOp op, const Key& key): __map(map), __rec(map.__recorder), __op(op){
+            if (__rec != nullptr) __start = my_ticks();
+            __fh = map.hash(key);
+        }
+        
+        // for calls that were given the hash
+        __op_timer(const mumap& map, MyMapOp op, const Key&, size_t fh): __map(map), __rec(map.__recorder), __op(op), __fh(fh){
+            if (__rec != nullptr) __start = my_ticks();
+        }
+        
+        __op_timer(const __op_timer&) = delete;
+        __op_timer& operator=(const __op_timer&) = delete;
+        
+        // calls that find or insert report what they did, once they know it
+        void set_op(MyMapOp op) noexcept{ __op = op; }
+        
+        size_t hash() const noexcept{ return __fh; }
+        
+        ~__op_timer(){
+            if (__rec == nullptr) return;
+            uint64_t ticks = my_ticks() - __start;
+            if (ticks < __rec->threshold.load(std::memory_order_relaxed)) return;
+            size_t b = __map.__size == 0 ? 0 : __constrain_hash(__fh, __map.__size);
+            __rec->record(__op, __fh, b, __map.__size == 0 ? 0 : __map.bucket_size(b), __map.__count, __map.__size, ticks);
+        }
+    };
+    
+    
+    // walks the chain of key once more to tell the sampler where key is; only sampled calls get here
+    void __sample(MyMapOp op, const Key& key, size_t fh) const noexcept{
+        size_t h = 0, position = 0;
+        bool hit = false;
+        if (array != nullptr){
+            h = __constrain_hash(fh, __size);
+            for (bucket* g = array[h].next; g != nullptr && g != __end && g->hash == h; g = g->next, ++position)
+                if (g->same_hash(fh) && cmp(g->get().first, key)){
+                    hit = true;
+                    break;
+                }
+        }
+        __sampler->record(op, fh, h, position, hit);
+    }
+
+
+    // tells the listener that the whole content was replaced
+    void __replay(){
+        if (__listener == nullptr) return;
+        __listener->on_clear();
+        for (bucket* g = __start.next; g != __end; g = g->next)
+            __listener->on_insert(g->get().first, g->get().second);
+    }
+
 public:
     
     /**
@@ -302,6 +738,92 @@ public:
     }
     
     
+    /**
+     @brief while on, inserts do not grow the bucket array and chains get longer instead. A rehash rewrites every node, so holding it off
+        keeps untouched nodes untouched, e.g. while a forked child snapshots the map and every written page is duplicated. Turning it off rehashes if needed.
+     @param bool on
+     @exception std::bad_alloc();
+     */
+    void defer_rehash(bool on){
+        __defer_rehash = on;
+        if (!on && __size * __max_load_factor < __count)
+            __rehash(std::max<size_t>(2 * __count + !__is_hash_power2(__count),
+            size_t(ceil(float(__count) / __max_load_factor))));
+    }
+
+
+    bool rehash_deferred() const noexcept{
+        return __defer_rehash;
+    }
+
+
+    /**
+     @brief starts tracking which ranges of range_buckets consecutive buckets changed, for incremental checkpoints, or stops it with 0.
+        A range becomes dirty on insert, erase, insert_or_assign, operator[] and a non-const find that hits, which may hand out a reference to the value.
+        Writes through iterators from begin() or begin(n) are not tracked. A rehash, clear or assignment marks every range dirty and sets layout_changed().
+        Tracking starts with every range dirty. Not copied or moved with the map.
+     @param size_t range_buckets, rounded up to a power of two
+     @exception std::bad_alloc();
+     */
+    void track_dirty(size_t range_buckets){
+        __track_dirty = range_buckets != 0;
+        if (!__track_dirty){
+            __dirty.clear();
+            __dirty.shrink_to_fit();
+            return;
+        }
+        __dirty_shift = 0;
+        while ((size_t(1) << __dirty_shift) < range_buckets) ++__dirty_shift;
+        __mark_all_dirty(__size);
+    }
+
+
+    /**
+     @brief returns the number of buckets per dirty range, 0 when tracking is off
+     */
+    size_t dirty_range_buckets() const noexcept{
+        return __track_dirty ? size_t(1) << __dirty_shift : 0;
+    }
+
+
+    /**
+     @brief checks whether buckets [r * dirty_range_buckets(), (r + 1) * dirty_range_buckets()) changed since the last clear_dirty()
+     @param size_t r
+     @returns bool
+     */
+    bool range_dirty(size_t r) const noexcept{
+        return __track_dirty && (r >> 6) < __dirty.size() && (__dirty[r >> 6] >> (r & 63) & 1);
+    }
+
+
+    /**
+     @brief returns the number of dirty ranges
+     */
+    size_t dirty_ranges() const noexcept{
+        size_t res = 0;
+        for (uint64_t w : __dirty)
+            for (; w != 0; w &= w - 1) ++res;
+        return res;
+    }
+
+
+    /**
+     @brief checks whether the bucket count changed or the map was cleared or assigned since the last clear_dirty()
+     */
+    bool layout_changed() const noexcept{
+        return __track_dirty && __layout_changed;
+    }
+
+
+    /**
+     @brief marks every range clean, e.g. after a checkpoint
+     */
+    void clear_dirty() noexcept{
+        std::fill(__dirty.begin(), __dirty.end(), uint64_t(0));
+        __layout_changed = false;
+    }
+
+
     /**
      @brief manages maximum average number of elements per bucket
         Returns current maximum load factor
@@ -310,6 +832,126 @@ public:
         return __max_load_factor;
     }
     
+    /**
+     @brief returns the function used to hash the keys
+     @returns Hash
+     */
+    Hash hash_function() const{
+        return hash;
+    }
+    
+    
+    /**
+     @brief attaches a listener that receives every insert, insert_or_assign, erase and clear, or detaches it with nullptr.
+        The listener is not copied or moved with the map. Changes made through references returned by operator[], find or iterators are not reported,
+        use insert_or_assign for writes that must be observed.
+     @param MyMapListener<Key, T>* listener
+     */
+    void set_listener(MyMapListener<Key, T>* listener) noexcept{
+        __listener = listener;
+    }
+
+
+    MyMapListener<Key, T>* listener() const noexcept{
+        return __listener;
+    }
+
+
+    /**
+     @brief attaches a sampler that sees a sample of the find and insert calls, or detaches it with nullptr. Not copied or moved with the map.
+        Calls made while the sampler is being attached or detached may still reach the old one, so detach it before destroying it and
+        while no other thread uses the map.
+     @param MyMapSampler* sampler
+     */
+    void set_sampler(MyMapSampler* sampler) noexcept{
+        __sampler = sampler;
+    }
+
+
+    MyMapSampler* sampler() const noexcept{
+        return __sampler;
+    }
+
+
+    /**
+     @brief attaches a recorder of slow find, insert and erase calls, or detaches it with nullptr. Not copied or moved with the map.
+        Detach it before destroying it and while no other thread uses the map.
+     @param MyMapRecorder* recorder
+     */
+    void set_recorder(MyMapRecorder* recorder) noexcept{
+        __recorder = recorder;
+    }
+
+
+    MyMapRecorder* recorder() const noexcept{
+        return __recorder;
+    }
+
+
+    /**
+     @brief returns the function that compares keys for equality
+     @returns Cmp
+     */
+    Cmp key_eq() const{
+        return cmp;
+    }
+    
+    
+    /**
+     @brief returns the index of the bucket a key with the given full hash belongs to. Meaningful only while size() is not zero.
+     @param size_t h
+     @returns size_t
+     */
+    size_t bucket_of_hash(size_t h) const noexcept{
+        return __constrain_hash(h, __size);
+    }
+    
+    
+    /**
+     @brief returns the index of the bucket of key
+     @param const Key& key
+     @returns size_t
+     */
+    size_t bucket_index(const Key& key) const{
+        return __constrain_hash(hash(key), __size);
+    }
+    
+    
+    /**
+     @brief returns the number of elements in bucket n
+     @param size_t n
+     @returns size_t
+     */
+    size_t bucket_size(size_t n) const{
+        size_t res = 0;
+        for (auto it = cbegin(n); it != cend(n); ++it)
+            ++res;
+        return res;
+    }
+    
+    
+    /**
+     @brief prefetches the bucket array slot of a key with full hash h. Batched lookups call it for a whole batch, then prefetch_node, then find(key, h).
+     @param size_t h
+     */
+    void prefetch_bucket(size_t h) const noexcept{
+#if defined(__GNUC__) || defined(__clang__)
+        if (array != nullptr) __builtin_prefetch(&array[__constrain_hash(h, __size)]);
+#endif
+    }
+    
+    
+    /**
+     @brief prefetches the first node of the bucket of a key with full hash h
+     @param size_t h
+     */
+    void prefetch_node(size_t h) const noexcept{
+#if defined(__GNUC__) || defined(__clang__)
+        if (array != nullptr) __builtin_prefetch(array[__constrain_hash(h, __size)].next);
+#endif
+    }
+    
+    
     /**
      @brief eturns the number of buckets
      */
@@ -339,6 +981,54 @@ public:
     }
     
     
+    /**
+     @brief returns the number of times the bucket array was rebuilt
+     */
+    size_t rehash_count() const noexcept{
+        return __rehashes;
+    }
+    
+    
+    /**
+     @brief returns the number of elements of the longest bucket. Walks every node.
+     */
+    size_t max_chain_length() const noexcept{
+        size_t res = 0, run = 0, h = size_t(-1);
+        for (const bucket* g = __start.next; g != __end; g = g->next){
+            run = g->hash == h ? run + 1 : 1;
+            h = g->hash;
+            res = std::max(res, run);
+        }
+        return res;
+    }
+    
+    
+    /**
+     @brief returns the bytes taken by the map, its nodes and its bucket array, without memory owned by the keys and values themselves
+     */
+    size_t memory_usage() const noexcept{
+        size_t pairs = my_unordered_map_out_of_line<Key, T>::value ? __count * sizeof(item) : 0;
+        return sizeof(*this) + __size * sizeof(Buckets) + (__count + 1) * sizeof(bucket) + pairs + __dirty.capacity() * sizeof(uint64_t);
+    }
+    
+    
+    /**
+     @brief adds the map to MyMapRegistry under name, or renames it there. Defined in my_map_registry.hpp.
+     @param const std::string& name
+     @exception std::bad_alloc();
+     */
+    void register_as(const std::string& name);
+    
+    
+    /**
+     @brief removes the map from MyMapRegistry
+     */
+    void unregister() noexcept{
+        delete __registration;
+        __registration = nullptr;
+    }
+    
+    
     /**
      @brief returns average number of elements per bucket
      @returns float
@@ -358,6 +1048,15 @@ public:
         __start.next = __end;
     }
     
+    
+    /**
+     @brief constructs an empty map that is listed in MyMapRegistry under name while it lives. Copies and moves of it are not listed.
+        Defined in my_map_registry.hpp.
+     @param const MyMapName& name
+     @exception std::bad_alloc();
+     */
+    explicit MyUnorderedMap(const MyMapName& name);
+    
      
     /**
      @brief copy constructor. Constructs the container with the copy of the contents of other, copies the load factor, the predicate, and the hash function as well. If alloc is not provided, allocator is obtained by calling
@@ -380,14 +1079,13 @@ public:
             for(auto* g = map.__start.next; g != map.__end; g = g->next){
             // i break the old order, but now idw fix it
             // i can little bit faster but it would be copy-past
-                __bucket_insert(g->item, g->hash);
+                __bucket_insert(g->get(), g->hash, g->stored_hash());
             }
         }catch(...){
             auto* i = __start.next;
             while(i != __end){
                 auto* next = i->next;
-                B_AllocTraits::destroy(bucket_alloc, i);
-                B_AllocTraits::deallocate(bucket_alloc, i, 1);
+                __free_node(i);
                 i = next;
             }
             B_AllocTraits::destroy(bucket_alloc, __end);
@@ -415,6 +1113,8 @@ public:
         std::swap(tmp.__start, __start);
         std::swap(tmp.__end, __end);
         std::swap(tmp.__max_load_factor, __max_load_factor);
+        __mark_all_dirty(__size);
+        __replay();
         return *this;
     }
     
@@ -455,6 +1155,8 @@ public:
         std::swap(tmp.__end, __end);
         std::swap(tmp.__max_load_factor, __max_load_factor);
         map.__start.next = map.__end;
+        __mark_all_dirty(__size);
+        __replay();
         return *this;
     }
     
@@ -479,16 +1181,11 @@ public:
      @exception std::bad_alloc();
      */
     std::pair<iterator, bool> insert(const item& pair){
-        if (__size * __max_load_factor < __count + 1)
-            __rehash(std::max<size_t>(2 * __count + !__is_hash_power2(__count),
-            size_t(ceil(float(__count + 1) / __max_load_factor))));
-        
-        size_t h =__constrain_hash(hash(pair.first), __size);
-        auto* res = __bucket_insert(pair, h);
-        if (res){
-            ++__count;
-            return std::make_pair(iterator(res), true);
-        }
+        __op_timer timer(*this, MyMapOp::insert, pair.first);
+        size_t fh = timer.hash();
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::insert, pair.first, fh);
+        auto* res = __insert_hashed(pair, fh);
+        if (res) return std::make_pair(iterator(res), true);
         return std::make_pair(iterator(__end), false);
     }
     
@@ -500,16 +1197,11 @@ public:
      @exception std::bad_alloc();
      */
     std::pair<iterator, bool> insert(item&& pair){
-        if (__size * __max_load_factor < __count + 1)
-            __rehash(std::max<size_t>(2 * __count + !__is_hash_power2(__count),
-            size_t(ceil(float(__count + 1) / __max_load_factor))));
-        
-        size_t h = __constrain_hash(hash(pair.first), __size);
-        auto* res = __bucket_insert(std::move(pair), h);
-        if (res){
-            ++__count;
-            return std::make_pair(iterator(res), true);
-        }
+        __op_timer timer(*this, MyMapOp::insert, pair.first);
+        size_t fh = timer.hash();
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::insert, pair.first, fh);
+        auto* res = __insert_hashed(std::move(pair), fh);
+        if (res) return std::make_pair(iterator(res), true);
         return std::make_pair(iterator(__end), false);
     }
     
@@ -556,12 +1248,13 @@ public:
      @exception std::bad_alloc();
      */
     T& operator[](const Key& key){
-        auto it = find(key);
-        if (it == end()){
-            auto [a, b] = emplace(key, T());
-            return a->second;
-        }
-        return it->second;
+        __op_timer timer(*this, MyMapOp::insert, key);
+        size_t fh = timer.hash();
+        bucket* g = __lookup(key, fh);
+        if (g != __end) timer.set_op(MyMapOp::find);
+        if (__sampler && __sampler->sample()) __sample(g == __end ? MyMapOp::insert : MyMapOp::find, key, fh);
+        if (g == __end) g = __insert_hashed(item(key, T()), fh);
+        return g->get().second;
     }
     
     
@@ -572,23 +1265,49 @@ public:
      @exception std::bad_alloc();
      */
     T& operator[](Key&& key){
-        auto it = find(key);
-        if (it == end()){
-            auto [a, b] = emplace(std::move(key), T());
-            return a->second;
-        }
-        return it->second;
+        __op_timer timer(*this, MyMapOp::insert, key);
+        size_t fh = timer.hash();
+        bucket* g = __lookup(key, fh);
+        if (g != __end) timer.set_op(MyMapOp::find);
+        if (__sampler && __sampler->sample()) __sample(g == __end ? MyMapOp::insert : MyMapOp::find, key, fh);
+        if (g == __end) g = __insert_hashed(item(std::move(key), T()), fh);
+        return g->get().second;
     }
 
     
+    /**
+     @brief Inserts the element if there is no element with an equivalent key, otherwise assigns value to the mapped value of that element.
+        Unlike writes through operator[], the assignment is reported to the listener.
+     @param const Key& key
+     @param M&& value
+     @returns std::pair<iterator, bool>, true if the element was inserted
+     @exception std::bad_alloc();
+     */
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& value){
+        __op_timer timer(*this, MyMapOp::insert, key);
+        size_t fh = timer.hash();
+        bucket* g = __lookup(key, fh);
+        if (g != __end) timer.set_op(MyMapOp::find);
+        if (__sampler && __sampler->sample()) __sample(g == __end ? MyMapOp::insert : MyMapOp::find, key, fh);
+        if (g == __end)
+            return std::make_pair(iterator(__insert_hashed(item(key, std::forward<M>(value)), fh)), true);
+        g->get().second = std::forward<M>(value);
+        if (__listener) __listener->on_assign(g->get().first, g->get().second);
+        return std::make_pair(iterator(g), false);
+    }
+
+
     /**
      @brief Finds an element with key equivalent to key.
      @param const Key& key
      @returns iterator
      */
     iterator find(const Key& key){
-        if (array == nullptr) return end();
-        return iterator(__find(key));
+        __op_timer timer(*this, MyMapOp::find, key);
+        size_t fh = timer.hash();
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::find, key, fh);
+        return iterator(__lookup(key, fh));
     }
     
     
@@ -598,8 +1317,32 @@ public:
      @returns const_iterator
      */
     const_iterator find(const Key& key) const{
+        __op_timer timer(*this, MyMapOp::find, key);
+        size_t fh = timer.hash();
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::find, key, fh);
         if (array == nullptr) return cend();
-        return const_iterator(__find(key));
+        return const_iterator(__find_hashed(key, fh));
+    }
+    
+    
+    /**
+     @brief Finds an element with key equivalent to key when the hash of key is already known.
+     @param const Key& key
+     @param size_t h, the value of hash_function() for key
+     @returns iterator
+     */
+    iterator find(const Key& key, size_t h){
+        __op_timer timer(*this, MyMapOp::find, key, h);
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::find, key, h);
+        return iterator(__lookup(key, h));
+    }
+    
+    
+    const_iterator find(const Key& key, size_t h) const{
+        __op_timer timer(*this, MyMapOp::find, key, h);
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::find, key, h);
+        if (array == nullptr) return cend();
+        return const_iterator(__find_hashed(key, h));
     }
     
     
@@ -609,8 +1352,10 @@ public:
      @returns iterator
      */
     iterator find(Key&& key){
-        if (array == nullptr) return end();
-        return iterator(__find(std::move(key)));
+        __op_timer timer(*this, MyMapOp::find, key);
+        size_t fh = timer.hash();
+        if (__sampler && __sampler->sample()) __sample(MyMapOp::find, key, fh);
+        return iterator(__lookup(key, fh));
     }
     
     
@@ -622,14 +1367,17 @@ public:
      @returns bool
      */
     bool erase(const Key& key){
+        __op_timer timer(*this, MyMapOp::erase, key);
+        size_t fh = timer.hash();
         if (array == nullptr) return false;
-        size_t h = hash(key);
-        h = __constrain_hash(h, __size);
+        size_t h = __constrain_hash(fh, __size);
         
         if (array[h].next == nullptr) return false;
         
         for (bucket* g = array[h].next; g != __end && g->hash == h; g = g->next){
-            if (cmp(g->item.first, key)){
+            if (g->same_hash(fh) && cmp(g->get().first, key)){
+                if (__listener) __listener->on_erase(key);
+                __mark_dirty(h);
                 
                 if (array[h].next == g){
                     if (g->next == __end)
@@ -645,8 +1393,7 @@ public:
                 
                 auto* next = g->next;
                 *g = std::move(*g->next);
-                B_AllocTraits::destroy(bucket_alloc, next);
-                B_AllocTraits::deallocate(bucket_alloc, next, 1);
+                __free_node(next);
                 --__count;
                 return true;
             }
@@ -663,14 +1410,17 @@ public:
      @returns bool
      */
     bool erase(Key&& key){
+        __op_timer timer(*this, MyMapOp::erase, key);
+        size_t fh = timer.hash();
         if (array == nullptr) return false;
-        size_t h = hash(key);
-        h = __constrain_hash(h, __size);
+        size_t h = __constrain_hash(fh, __size);
         
         if (array[h].next == nullptr) return false;
         
         for (bucket* g = array[h].next; g != __end && g->hash == h; g = g->next){
-            if (cmp(g->item.first, key)){
+            if (g->same_hash(fh) && cmp(g->get().first, key)){
+                if (__listener) __listener->on_erase(key);
+                __mark_dirty(h);
                 
                 if (array[h].next == g){
                     if (g->next == __end)
@@ -686,8 +1436,7 @@ public:
                 
                 auto* next = g->next;
                 *g = std::move(*g->next);
-                B_AllocTraits::destroy(bucket_alloc, next);
-                B_AllocTraits::deallocate(bucket_alloc, next, 1);
+                __free_node(next);
                 --__count;
                 return true;
             }
@@ -705,8 +1454,7 @@ public:
         bucket* g = __start.next;
         while (g != __end){
             bucket* next = g->next;
-            B_AllocTraits::destroy(bucket_alloc, g);
-            B_AllocTraits::deallocate(bucket_alloc, g, 1);
+            __free_node(g);
             g = next;
         }
         if (array != nullptr){
@@ -716,6 +1464,11 @@ public:
         __size = 0;
         __count = 0;
         __start.next = __end;
+        if (__track_dirty){
+            std::fill(__dirty.begin(), __dirty.end(), ~uint64_t(0));
+            __layout_changed = true;
+        }
+        if (__listener) __listener->on_clear();
     }
     
     
@@ -723,6 +1476,8 @@ public:
      @brief Move assignment operator. Replaces the contents with those of other using move semantics (i.e. the data in other is moved from other into this container). other is in a valid but unspecified state afterwards.
      */
     ~MyUnorderedMap(){
+        unregister();
+        __listener = nullptr;
         clear();
         B_AllocTraits::destroy(bucket_alloc, __end);
         B_AllocTraits::deallocate(bucket_alloc, __end, 1);
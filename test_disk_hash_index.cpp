@@ -0,0 +1,145 @@
+//
+//  test_disk_hash_index.cpp
+//  MySpace
+//
+//  Tests MyDiskHashIndex against a local file, including a crash between two flush() calls.
+//
+//  g++ -std=c++17 -O2 -I. test_disk_hash_index.cpp -o test_disk_hash_index && ./test_disk_hash_index [dir] > test_output.txt
+//
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "my_disk_hash_index.hpp"
+
+
+using Index = MyDiskHashIndex<uint64_t, uint64_t>;
+
+static int failures = 0;
+
+#define CHECK(cond) do{ if (!(cond)){ fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } }while (0)
+
+
+static void test_basic(const std::string& path){
+    unlink(path.c_str());
+    {
+        Index index(path, 16, 8);
+        for (uint64_t i = 0; i < 20000; ++i)
+            CHECK(index.insert(i, i * 3));
+        CHECK(!index.insert(5, 0));
+        CHECK(!index.insert_or_assign(5, 7));
+        CHECK(index.count() == 20000);
+        CHECK(index.pages() > 17);
+        for (uint64_t i = 0; i < 20000; i += 2)
+            CHECK(index.erase(i));
+        CHECK(!index.erase(0));
+    }
+    Index index(path, 16, 8);
+    CHECK(index.count() == 10000);
+    std::vector<uint64_t> keys;
+    for (uint64_t i = 0; i < 20000; ++i)
+        keys.push_back(i);
+    auto found = index.multi_get(keys);
+    for (uint64_t i = 0; i < 20000; ++i){
+        if (i % 2 == 0) CHECK(!found[i]);
+        else CHECK(found[i] && *found[i] == (i == 5 ? 7 : i * 3));
+    }
+
+    // flushes without growth alternate between two directory slots instead of moving the directory forward
+    struct stat st;
+    index.flush();
+    stat(path.c_str(), &st);
+    off_t size = st.st_size;
+    for (int i = 0; i < 5; ++i){
+        index.flush();
+        stat(path.c_str(), &st);
+        CHECK(st.st_size <= size + off_t(__disk_page));
+    }
+    printf("basic: %zu pages, direct %d, io_uring %d\n", index.pages(), int(index.direct()), int(index.uses_io_uring()));
+}
+
+
+// a child flushes, keeps inserting with a tiny cache so that evictions write new overflow pages, and dies without flushing again;
+// every key of the flush must be found in the file it leaves, and the count must agree with the keys that are there
+static void test_crash_after_flush(const std::string& path){
+    unlink(path.c_str());
+    pid_t pid = fork();
+    if (pid == 0){
+        Index* index = new Index(path, 4, 4);     // never destroyed, as in a crash
+        for (uint64_t i = 0; i < 5000; ++i)
+            index->insert(i, i + 1);
+        index->flush();
+        for (uint64_t i = 5000; i < 20000; ++i)
+            index->insert(i, i + 1);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+
+    try{
+        Index index(path, 4, 4);
+        std::vector<uint64_t> keys;
+        for (uint64_t i = 0; i < 20000; ++i)
+            keys.push_back(i);
+        auto found = index.multi_get(keys);
+        size_t ok = 0, later = 0;
+        for (uint64_t i = 0; i < 20000; ++i){
+            if (found[i]) CHECK(*found[i] == i + 1);
+            if (i < 5000) ok += found[i].has_value();
+            else later += found[i].has_value();
+        }
+        CHECK(ok == 5000);
+        CHECK(index.count() == ok + later);
+        for (uint64_t i = 0; i < 20000; ++i)
+            if (found[i]) CHECK(index.erase(i));
+        CHECK(index.count() == 0);
+        printf("crash after flush: %zu of 5000 flushed keys and %zu later ones found\n", ok, later);
+    }catch(std::exception& e){
+        fprintf(stderr, "reopen after crash: %s\n", e.what());
+        ++failures;
+    }
+}
+
+
+// superblocks whose directory cannot hold all pages, or whose pages cannot hold all buckets, are refused
+static void test_corrupt_superblock(const std::string& path){
+    const size_t fields[] = {2, 5};     // buckets and dir_pages, in 8-byte words
+    for (size_t field : fields){
+        unlink(path.c_str());
+        {
+            Index index(path, 16, 8);
+            index.insert(1, 2);
+        }
+        int fd = open(path.c_str(), O_RDWR);
+        uint64_t bad = field == 2 ? 1000 : 0;
+        CHECK(pwrite(fd, &bad, sizeof(bad), off_t(field * sizeof(uint64_t))) == sizeof(bad));
+        close(fd);
+        bool refused = false;
+        try{
+            Index index(path, 16, 8);
+        }catch(std::invalid_argument&){
+            refused = true;
+        }
+        CHECK(refused);
+    }
+}
+
+
+int main(int argc, char** argv){
+    std::string dir = argc > 1 ? argv[1] : ".";
+    std::string path = dir + "/test_disk_hash_index." + std::to_string(getpid()) + ".idx";
+    test_basic(path);
+    test_crash_after_flush(path);
+    test_corrupt_superblock(path);
+    unlink(path.c_str());
+    printf(failures ? "FAILED\n" : "ok\n");
+    return failures ? 1 : 0;
+}